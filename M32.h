@@ -3,11 +3,442 @@
 
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <netinet/in.h>
+
+#define BSIZE 512 // MAX receive buffer size
+#define TIMEOUT 50 // default timeout
+
+#define round4(x) (((x) + 3) & ~0x3)
+
+#define X32_STRING_MAX 32 // longest string parameter kept by value
+
+// How a leaf value is displayed, see M32Tree.c
+enum osc_scale{
+	OSC_INT, // plain integer
+	OSC_ONOFF, // OFF, ON
+	OSC_ENUM, // one of labels, stored as its index
+	OSC_LIN, // min to max, linear
+	OSC_LOG, // min to max, logarithmic
+	OSC_FADER, // dB, -oo to +10, the console's 4 segment fader law
+};
+
+// Range and scale of a leaf value. OSC_INT values range from min to max,
+// the console sends the others as 0.0 to 1.0 floats, displayed per scale
+struct osc_format{
+	uint8_t scale; // enum osc_scale
+	float min, max;
+	const char *const *labels; // OSC_ENUM
+	int n_labels;
+};
+
+// Node of the console's OSC address tree, leaves have no children
+typedef struct osc_node{
+	char *label;
+	int no_children;
+	const struct osc_node *children;
+	char type; // OSC type of a leaf value ('i', 'f', 's')
+	const struct osc_format *format; // of a leaf value, NULL for plain numbers and strings
+} osc_node_t;
+
+extern const osc_node_t top; // config
+extern const osc_node_t ch_root;
+extern const osc_node_t bus_root;
+extern const osc_node_t mtx_root;
+extern const osc_node_t main_root;
+extern const osc_node_t dca_root;
+extern const osc_node_t fx_root;
+extern const osc_node_t *const osc_roots[]; // every subtree, in node index order
+extern const int osc_root_count;
+
+// Socket of a console session, see X32Connect
+struct x32_socket{
+	int fd; // -1 until connected
+	int state; // 1 once the console answered /info
+	struct sockaddr_in address;
+	struct x32_outbox *outbox; // coalescing send queue, see M32Outbox.c
+	struct x32_subscriptions *_Atomic subscriptions; // pattern callbacks, see M32Subscribe.c
+	int bundles; // BUNDLE_AUTO until X32ProbeBundles, see M32Bundle.c
+};
 
 int X32Connect(char *ip_str, int port);
+int X32Send(char *buffer, int length);
+int X32Transmit(char *buffer, int length);
+int X32Recv(char *buffer, int timeout);
+
+#define BATCH_OFF 0 // one system call per datagram
+#define BATCH_ON 1 // sendmmsg and recvmmsg
+#define BATCH_MAX 32 // datagrams per system call
+#define BATCH_BYTES 16384 // room for the datagrams of one send batch
+
+extern int BATCH_MODE;
+
+// Datagrams collected by X32Transmit between X32BatchBegin and X32BatchEnd
+struct x32_batch{
+	struct x32_socket *socket;
+	int count, used;
+	bool failed; // a datagram could not be sent
+	uint16_t offsets[BATCH_MAX];
+	uint16_t lengths[BATCH_MAX];
+	char slab[BATCH_BYTES];
+};
+
+void X32BatchBegin(struct x32_batch *batch);
+int X32BatchEnd(struct x32_batch *batch);
+
+#define PACKET_SIZE 1500 // largest datagram received whole, an ethernet MTU
+#define PACKET_POOL_SIZE 256 // preallocated packets, more come from the heap
+
+// A received datagram shared by reference, see M32Packet.c
+struct x32_packet{
+	_Atomic int refs;
+	_Atomic uint32_t next; // free stack link, pool index + 1
+	int length;
+	char data[PACKET_SIZE];
+};
+
+struct x32_packet *X32PacketAlloc(void);
+struct x32_packet *X32PacketRetain(struct x32_packet *packet);
+void X32PacketRelease(struct x32_packet *packet);
+struct x32_packet *X32PacketOf(const char *data);
+int X32RecvMany(struct x32_packet **packets, int max, int timeout);
+
+#define OUTBOX_SIZE 256 // parameters with a write waiting to be sent
+#define OUTBOX_RATE 100 // default packets per second
+#define OUTBOX_PERIOD 10 // ms between timer flushes
+
+extern atomic_int OUTBOX_COALESCED;
+
+int X32OutboxStart(int rate);
+int X32OutboxFlush(void);
+void X32OutboxStop(void);
+void X32OutboxFree(void);
+int X32OutboxSend(char *buffer, int length);
+
+#define TRACE_OFF 0
+#define TRACE_RECORD 1 // record packets in the trace ring
+#define TRACE_PRINT 2 // also print every packet as it happens
+
+#define TRACE_SEND 0
+#define TRACE_RECV 1
+
+#define TRACE_RING_SIZE 4096 // events kept, a power of 2
+#define TRACE_ADDRESS_MAX 40 // longer addresses are truncated
+#define TRACE_VERSION 1
+
+// One packet seen by the library, see M32Trace.c
+struct trace_event{
+	long long time; // us, CLOCK_MONOTONIC
+	int32_t latency; // us since the request of a reply, -1 for other packets
+	uint16_t size; // bytes
+	uint8_t kind; // TRACE_SEND or TRACE_RECV
+	char address[TRACE_ADDRESS_MAX];
+};
+
+extern int TRACE_LEVEL;
+
+#ifdef M32_NO_TRACE
+#define X32_TRACE(kind, buffer, length, latency) ((void)0)
+#else
+#define X32_TRACE(kind, buffer, length, latency) do{ if(TRACE_LEVEL != TRACE_OFF) traceRecord(kind, buffer, length, latency); }while(0)
+#endif
+
+void traceRecord(int kind, const char *buffer, int length, int latency);
+int X32TraceRead(struct trace_event *events, int max);
+void X32TraceClear(void);
+int X32TracePrint(void);
+int X32TraceSave(const char *path);
+
+// Counters, see M32Metrics.c
+enum{
+	METRIC_SENDS,
+	METRIC_SEND_BYTES,
+	METRIC_SEND_ERRORS,
+	METRIC_RECEIVES,
+	METRIC_RECV_BYTES,
+	METRIC_RECV_ERRORS, // polling or socket errors
+	METRIC_PARSE_ERRORS, // malformed messages received
+	METRIC_UNSOLICITED, // messages no request was waiting for
+	METRIC_RETRANSMITS,
+	METRIC_TIMEOUTS, // X32Query gave up
+	METRIC_GETS, // X32GetInt, X32GetFloat, X32GetString calls
+	METRIC_GET_ERRORS,
+	METRIC_CONNECTS,
+	METRIC_CONNECT_FAILURES,
+	METRIC_POOL_MISSES, // packets taken from the heap, the pool being empty
+	METRIC_COUNTERS
+};
+
+// Timed operations
+enum{
+	METRIC_RTT, // from the last transmission of a query to its reply
+	METRIC_GET, // a getter call, retransmissions included
+	METRIC_CONNECT,
+	METRIC_OPS
+};
+
+// Address classes, by the first address component
+enum{
+	METRIC_CH,
+	METRIC_BUS,
+	METRIC_MTX,
+	METRIC_MAIN,
+	METRIC_DCA,
+	METRIC_FX,
+	METRIC_CONFIG,
+	METRIC_OTHER,
+	METRIC_CLASSES
+};
+
+#define METRIC_BUCKETS 448 // histogram buckets, 1 us to 2^30 us
+#define METRICS_TEXT 0
+#define METRICS_JSON 1
+#define METRICS_TEXT_MAX 16384 // longest formatted snapshot
+
+// Latencies of one operation on one address class, in us
+struct metric_histogram{
+	unsigned long long count;
+	unsigned long long sum;
+	unsigned long long max;
+	unsigned long long buckets[METRIC_BUCKETS];
+};
+
+struct x32_metrics{
+	long long time; // monotonicMs() of the snapshot
+	unsigned long long counters[METRIC_COUNTERS];
+	struct metric_histogram histograms[METRIC_OPS][METRIC_CLASSES];
+};
+
+void metricCount(int counter, unsigned long long n);
+int metricClass(const char *address, int len);
+void metricLatency(int op, int class, long long us);
+unsigned long long metricPercentile(const struct metric_histogram *histogram, double p);
+void X32MetricsSnapshot(struct x32_metrics *metrics);
+void X32MetricsReset(void);
+int X32MetricsFormat(const struct x32_metrics *metrics, int format, char *text, int size);
+int X32MetricsDump(int fd, int format);
+int X32MetricsEvery(int period, int fd, int format);
+
+#define DISCOVER_MAX_HOSTS 65536 // largest range X32Discover sweeps, a /16
+
+// A console that answered discovery, see M32Discover.c
+struct x32_console{
+	char ip[16];
+	char name[X32_STRING_MAX]; // console or server name
+	char model[X32_STRING_MAX]; // eg. "X32", "M32", "XR18"
+	char firmware[X32_STRING_MAX];
+};
+
+int X32Discover(const char *network, int port, struct x32_console *consoles, int max, int timeout);
+int Search(int port);
+
+#define OSC_MAX_ARGS 16 // most arguments oscDecode accepts in one message
+
+// A string or blob inside a received buffer, not null terminated for blobs
+struct osc_view{
+	const char *ptr;
+	int len;
+};
+
+// One decoded argument, strings and blobs point into the receive buffer
+struct osc_arg{
+	char type; // 'i', 'f', 's', 'b', or a flag type ('T', 'F', 'N', 'I') without value
+	union{
+		int32_t i;
+		float f;
+		struct osc_view s;
+		struct osc_view b;
+	};
+};
+
+struct osc_message{
+	struct osc_view address;
+	struct osc_view types; // type tags without the leading ','
+	int argc;
+	struct osc_arg args[OSC_MAX_ARGS];
+};
+
+// A parameter value of any type, eg. in the state mirror
+struct x32_value{
+	char type; // 'i', 'f', 's', or 0 when not known
+	union{
+		int32_t i;
+		float f;
+		char s[X32_STRING_MAX];
+	};
+};
+
+int oscDecode(const char *buffer, int length, struct osc_message *msg);
+int oscArgValue(const struct osc_arg *arg, struct x32_value *value);
+char** parseArgs(char* buffer, int length);
+void printBuffer(char* buffer, int length);
+
+int oscEncodeMessage(char *buffer, int size, const char *address, const char *argtypes, char **args);
+int oscEncodeQuery(char *buffer, int size, const char *address);
+int oscEncodeInt(char *buffer, int size, const char *address, int value);
+int oscEncodeFloat(char *buffer, int size, const char *address, float value);
+int oscEncodeString(char *buffer, int size, const char *address, const char *value);
+
+#define BUNDLE_MTU 1472 // largest UDP payload that is not fragmented on ethernet
+#define BUNDLE_MAX_MESSAGES 128
+
+// #bundle packing many messages into one datagram, see M32Bundle.c
+struct osc_bundle{
+	char buffer[BUNDLE_MTU];
+	int length;
+	int count;
+	int datagrams; // sent by all flushes since oscBundleInit
+	uint16_t offsets[BUNDLE_MAX_MESSAGES]; // start of each element's size field
+};
+
+#define BUNDLE_OFF 0 // send bundled messages one datagram each
+#define BUNDLE_ON 1
+#define BUNDLE_AUTO 2 // probe the console on first use
+#define BUNDLE_PROBES 4 // probe attempts before falling back to BUNDLE_OFF
+
+extern int BUNDLE_MODE;
+
+void oscBundleInit(struct osc_bundle *bundle);
+int oscBundleAdd(struct osc_bundle *bundle, const char *message, int length);
+int oscBundleAddInt(struct osc_bundle *bundle, const char *address, int value);
+int oscBundleAddFloat(struct osc_bundle *bundle, const char *address, float value);
+int oscBundleAddString(struct osc_bundle *bundle, const char *address, const char *value);
+int oscBundleFlush(struct osc_bundle *bundle);
+int X32ProbeBundles(void);
+int X32BundleMode(void);
+
+#define X32_ADDRESS_MAX 64 // longest OSC address a request can wait on
+#define X32_MAX_PENDING 256 // requests waiting for a reply at any time
+#define X32_QUEUE_SIZE 64 // unsolicited messages kept for X32NextMessage
+
+// Called with a reply matched to a pending request, see M32IO.c
+typedef void (*x32_reply_cb)(const struct osc_message *msg, const char *buffer, int length, void *ctx);
+
+extern atomic_int X32_QUEUE_DROPPED;
+extern atomic_int X32_DUPLICATES; // late replies to retransmitted requests dropped
+
+#define RTO_MIN 20 // ms, bounds of the adaptive timeout
+#define RTO_MAX 1000
+#define X32_RETRIES 3 // retransmissions before X32Query gives up
+
+// Result of the reliable request functions
+enum x32_status{
+	X32_OK = 0,
+	X32_TIMEOUT = -1, // no reply after all retransmissions
+	X32_IO_ERROR = -2,
+	X32_TYPE_ERROR = -3, // the reply does not carry the expected type
+	X32_NO_SLOT = -4, // address too long or all X32_MAX_PENDING slots taken
+};
+
+long long monotonicMs(void);
+long long monotonicUs(void);
+void X32Dispatch(char *buffer, int length);
+void X32DispatchPacket(struct x32_packet *packet);
+int X32Expect(const char *address, x32_reply_cb callback, void *ctx);
+int X32Submit(const char *address, x32_reply_cb callback, void *ctx);
+int X32SubmitId(int id, x32_reply_cb callback, void *ctx);
+int X32SubmitNode(const char *path, x32_reply_cb callback, void *ctx);
+int X32Resend(int id);
+int X32Cancel(int id);
+int X32Wait(unsigned *generation, int timeout);
+int X32Request(char *address, char *buffer, int timeout);
+int X32RequestWith(char *address, char *message, int length, char *buffer, int timeout);
+int X32Timeout(void);
+enum x32_status X32Query(const char *address, char *buffer, int *length);
+const char *X32StatusString(enum x32_status status);
+int X32NextMessage(char *buffer, int timeout);
+struct x32_packet *X32NextPacket(int timeout);
+int X32Subscribe(const char *pattern, x32_reply_cb callback, void *ctx);
+int X32Unsubscribe(int sub);
+void X32UnsubscribeAll(void);
+int X32SubscriptionsApply(int id, const struct osc_message *msg, const char *buffer, int length);
+struct x32_subscriptions *X32SubscriptionsTake(void);
+int X32StartIO(void);
+void X32StopIO(void);
+
+#define X32_MAX_TIMERS 8
+
+typedef void (*x32_timer_cb)(void *ctx);
+
+int X32Every(int period, x32_timer_cb callback, void *ctx);
+void X32CancelTimer(int id);
+void X32Service(void);
+
+struct x32_session; // one console, see M32IO.c
+struct x32_loop;
+
+struct x32_session *X32SessionNew(void);
+void X32SessionFree(struct x32_session *s);
+struct x32_session *X32Use(struct x32_session *s);
+struct x32_session *X32Current(void);
+struct x32_socket *X32Socket(void);
+struct x32_loop *X32LoopNew(void);
+void X32LoopFree(struct x32_loop *loop);
+int X32LoopAdd(struct x32_loop *loop, struct x32_session *s);
+int X32LoopRemove(struct x32_loop *loop, struct x32_session *s);
+int X32LoopRun(struct x32_loop *loop, int timeout);
+
+int oscIndexInit(void);
+int oscIndexCount(void);
+int oscIndexLookup(const char *address, int len);
+const char *oscIndexAddress(int id);
+char oscIndexType(int id);
+const struct osc_format *oscIndexFormat(int id);
+int oscEncodeIdQuery(char *buffer, int size, int id);
+int oscEncodeIdInt(char *buffer, int size, int id, int value);
+int oscEncodeIdFloat(char *buffer, int size, int id, float value);
+int oscEncodeIdString(char *buffer, int size, int id, const char *value);
+
+#define NODE_MAX_LEAVES 64 // most leaves right below one node, fx/N/par
+
+int oscNodeLeaves(const char *path, int len, int *ids, int max);
+int oscNodeFormat(int id, const struct x32_value *value, char *text, int size);
+int oscNodeParse(int id, const char *token, int len, struct x32_value *value);
+int oscNodeDecode(const char *text, int len, int *ids, struct x32_value *values, int max);
+
+#define XREMOTE_RENEW 9000 // ms, the console drops /xremote clients after 10 s
+
+int X32CacheStart(int window);
+void X32CacheStop(void);
+int X32CacheLoad(int window);
+int X32CacheApply(int id, const struct osc_message *msg);
+int X32CacheSet(int id, const struct x32_value *value);
+void X32CacheSent(const char *buffer, int length);
+int X32CacheGet(const char *address, struct x32_value *value, long long *updated);
+int X32CacheGetId(int id, struct x32_value *value, long long *updated);
+int X32CacheConfirmedId(int id, struct x32_value *value);
+int getIntValueCached(char *address, bool fresh);
+float getFloatValueCached(char *address, bool fresh);
+char *getStringValueCached(char *address, bool fresh);
+
+#define METER_BANKS 17 // /meters/0 to /meters/16
+#define METER_MAX_VALUES 128 // most values kept from one meter blob
+#define METER_RING_SIZE 32 // frames buffered, a power of 2
+#define METER_RENEW 9000 // ms, meter subscriptions expire after 10 s
+#define METER_DB_FLOOR -120.0f // meterToDb result for silence
+
+// One /meters/N blob as received
+struct meter_frame{
+	int bank;
+	int count;
+	long long time; // monotonicMs() of reception
+	float values[METER_MAX_VALUES]; // linear
+};
+
+extern atomic_int METER_DROPPED;
+
+int X32MetersStart(int bank, int channel, int factor);
+void X32MetersStop(void);
+int X32MetersApply(const struct osc_message *msg);
+int X32MetersNext(struct meter_frame *frame);
+void meterToDb(const float *linear, float *db, int count);
 
 int generateAndSendMessageWithArgs(char* address, char* argtypes, char** args);
 int generateAndSendMessage(char* address);
+enum x32_status X32GetInt(const char *address, int *value);
+enum x32_status X32GetFloat(const char *address, float *value);
+enum x32_status X32GetString(const char *address, char *value, int size);
 int getIntValue(char* address);
 float getFloatValue(char* address);
 char *getStringValue(char* address);
@@ -94,8 +525,32 @@ struct chan_eq{
 	struct eq_band band_4;
 };
 
+struct send{
+	bool on;
+	float level;
+	float pan; // odd sends, the pair's even send follows
+	uint8_t type; // odd sends, 0-5 {IN/LC, <-EQ, EQ->, PRE, POST, GRP}
+	bool pan_follow; // odd sends
+};
+
 struct mix{
+	bool on;
+	float fader;
+	bool st;
+	float pan;
+	bool mono;
+	float mlevel;
+	struct send sends[16]; // to mix buses 01-16
+};
+
+struct grp{
+	uint8_t dca; // 0-255, one bit per DCA group
+	uint8_t mute; // 0-63, one bit per mute group
+};
 
+struct automix{
+	uint8_t group; // {OFF, X, Y}
+	float weight;
 };
 
 struct channel{
@@ -107,8 +562,119 @@ struct channel{
 	struct insert insert;
 	bool eq_on;
 	struct chan_eq eq;
+	struct mix mix;
+	struct grp grp;
+	struct automix automix;
+};
+
+// Storage kind of a struct channel member, used to convert OSC replies
+enum field_kind { FIELD_BOOL, FIELD_U8, FIELD_FLOAT, FIELD_STRING, FIELD_VALUE /* struct x32_value */, FIELD_NODE /* struct channel, from /node */ };
+
+// Describes one OSC leaf of a channel (path relative to /ch/NN) and where
+// its value lives in struct channel
+struct channel_field{
+	const char *path;
+	uint8_t kind;
+	uint8_t size;
+	uint16_t offset;
+};
+
+extern const struct channel_field channel_fields[];
+extern const int channel_field_count;
+
+// One parameter query in a pipelined fetch
+struct x32_query{
+	char address[X32_ADDRESS_MAX]; // node path for FIELD_NODE, eg. "ch/01/gate"
+	int id; // node index leaf id of address, -1 if not indexed
+	void *dest; // where the decoded value is stored
+	uint8_t kind; // enum field_kind
+	uint16_t size; // size of dest in bytes
+	_Atomic uint8_t state; // QUERY_* below, set by the reply callback
+	uint8_t retries;
+	int slot; // pending request id
+	long long sent; // ms timestamp of last transmission
+};
+
+#define QUERY_QUEUED 0
+#define QUERY_INFLIGHT 1
+#define QUERY_DONE 2
+#define QUERY_FAILED 3
+
+#define PIPELINE_WINDOW 16 // default number of queries kept on the wire
+#define PIPELINE_RETRIES X32_RETRIES // retransmissions before a query is given up
+
+int X32Pipeline(struct x32_query *queries, int count, int window);
+struct channel* getChannelInfo(int ch);
+int getChannelsInfo(struct channel *channels, int first, int count, int window);
+int getChannelsInfoNode(struct channel *channels, int first, int count, int window);
+int setChannelsInfo(const struct channel *channels, int first, int count);
+int copyChannelConfig(int chsrc, int chdst);
+
+#define STORE_CHANNELS 32 // channels of a store, one bit each in a uint32_t mask
+#define STORE_FLOATS 64 // columns per kind, enough for channel_fields
+#define STORE_BYTES 32
+#define STORE_BOOLS 48
+#define STORE_STRINGS 2
+#define STORE_STRING_MAX 16
+
+// Channel state with one column per channel_fields entry, see M32Store.c
+struct channel_store{
+	float floats[STORE_FLOATS][STORE_CHANNELS];
+	uint8_t bytes[STORE_BYTES][STORE_CHANNELS];
+	uint32_t bits[STORE_BOOLS]; // switches, as channel masks
+	char strings[STORE_STRINGS][STORE_CHANNELS][STORE_STRING_MAX];
+	int count; // channels held
+};
+
+int channelFieldIndex(const char *path);
+float *channelStoreFloats(struct channel_store *store, int field);
+uint8_t *channelStoreBytes(struct channel_store *store, int field);
+uint32_t *channelStoreBits(struct channel_store *store, int field);
+int channelStoreLoad(struct channel_store *store, const struct channel *channels, int count);
+int channelStoreSave(const struct channel_store *store, struct channel *channels, int count);
+uint32_t channelStoreMatch(const struct channel_store *store, int field, float min, float max);
+int channelStoreAdd(struct channel_store *store, int field, float delta, uint32_t channels);
+uint32_t channelStoreDiff(const struct channel_store *a, const struct channel_store *b, int field);
+int channelStoreDiffAll(const struct channel_store *a, const struct channel_store *b, uint32_t *masks);
+
+#define SYNC_RATE 1000 // messages per second X32Sync sends by default
+#define SYNC_BURST 32 // most messages in one paced bundle
+#define SYNC_EPSILON 1e-6f // floats closer than this are not rewritten
+
+int X32Sync(const int *ids, const struct x32_value *values, int count, int rate);
+int X32SyncChannels(const struct channel *channels, int first, int count, int rate);
+
+#define SHOW_VERSION 2 // show file format written by X32ShowWrite
+#define SHOW_NAME_MAX 32 // scene name length, with the null
+
+// A show file mapped by X32ShowOpen, see M32Show.c
+struct x32_show{
+	const char *map;
+	size_t size;
+	int sections;
+	int scenes;
+	int leaves; // in the tree the show was written with
+	int32_t *slots; // show leaf of each running leaf id, NULL if the trees match
 };
 
+int X32ShowFetch(struct x32_value *values, int window);
+long X32ShowWrite(const char *path, const char *const *names, const struct x32_value *const *scenes, int count);
+int X32ShowOpen(const char *path, struct x32_show *show);
+void X32ShowClose(struct x32_show *show);
+int X32ShowFindScene(const struct x32_show *show, const char *name);
+const char *X32ShowSceneName(const struct x32_show *show, int scene);
+int X32ShowFindSection(const struct x32_show *show, const char *name, int *first, int *count);
+int X32ShowValue(const struct x32_show *show, int scene, int id, struct x32_value *value);
+int X32ShowApply(const struct x32_show *show, int scene, const char *section, int rate);
+
+#define PARALLEL_MAX 16 // most sockets of a parallel snapshot
+#define PARALLEL_ROUNDS 4 // fetches of the leaves missing or changed, the first one included
+
+struct x32_parallel; // sessions of a parallel snapshot, see M32Parallel.c
+
+struct x32_parallel *X32ParallelNew(int sockets);
+void X32ParallelFree(struct x32_parallel *p);
+int X32ParallelFetch(struct x32_parallel *p, struct x32_value *values, int window, unsigned long long *generation);
 
 
 #endif
\ No newline at end of file
@@ -0,0 +1,535 @@
+/*
+ * M32Bench.c
+ *
+ * Microbenchmarks for the OSC codec and the request path, built and run by
+ * "make bench". Measures encode and decode throughput, heap allocations per
+ * message (malloc, calloc and realloc are wrapped at link time), the packet
+ * pool, subscription dispatch, sends and receives with and without system
+ * call batching, and getter round trip latency percentiles against a
+ * console emulated by a thread of this process on the loopback interface.
+ * Parallel snapshots run against M32Emu instead, started with per client
+ * and global request limits that pace requests rather than drop them, to
+ * show how throughput scales with the number of sockets against the
+ * limits until the emulated console pushes back.
+ *
+ * Library logging goes to stdout, so it is sent to /dev/null and the
+ * results are printed on the original stdout.
+ */
+#include "M32.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <signal.h>
+#include <spawn.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <arpa/inet.h>
+
+#define ENCODE_ROUNDS 2000000
+#define SEND_ROUNDS 200000
+#define DECODE_ROUNDS 2000000
+#define PARSE_ROUNDS 500000
+#define LATENCY_ROUNDS 20000
+#define RECV_ROUNDS 200000
+#define FETCH_ROUNDS 20
+#define PARALLEL_MS 2000 // parallel snapshots taken for each socket count
+#define PARALLEL_WARMUP_MS 1000 // untimed first, so the emulator's one second of burst is spent
+#define EMU_CLIENT_RATE 4000 // requests/s M32Emu answers per client
+#define EMU_RATE 16000 // requests/s M32Emu answers in all
+
+static FILE *out; // stdout before the library logging was silenced
+
+// Allocation counting, see the --wrap flags of the bench target
+static atomic_long allocations;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size){
+	allocations++;
+	return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t n, size_t size){
+	allocations++;
+	return __real_calloc(n, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size){
+	allocations++;
+	return __real_realloc(ptr, size);
+}
+
+static long long nowNs(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void report(const char *group, const char *name, long long ns, int rounds, long allocs){
+	fprintf(out, "%-8s %-34s %9.1f ns/msg %8.2f M msg/s %6.2f allocs/msg\n", group, name,
+			(double)ns / rounds, rounds * 1e3 / ns, (double)allocs / rounds);
+}
+
+/**
+ * Emulated console: answers /info, and queries on any node index leaf with
+ * a value of the leaf's type. Set messages are ignored.
+ */
+static void *responder(void *arg){
+	int fd = *(int *)arg;
+	char r_buf[BSIZE], s_buf[BSIZE];
+	struct sockaddr_in from;
+	socklen_t from_len;
+	struct osc_message msg;
+
+	for(;;){
+		from_len = sizeof(from);
+		int r_len = recvfrom(fd, r_buf, BSIZE, 0, (struct sockaddr *)&from, &from_len);
+		if(r_len <= 0 || oscDecode(r_buf, r_len, &msg) < 0){
+			continue;
+		}
+
+		int s_len = -1;
+		if(msg.address.len == 5 && memcmp(msg.address.ptr, "/info", 5) == 0){
+			char *args[] = {"V2.07", "osc-server", "M32", "4.06"};
+			s_len = oscEncodeMessage(s_buf, BSIZE, "/info", "ssss", args);
+		}else if(msg.argc == 0){
+			int id = oscIndexLookup(msg.address.ptr, msg.address.len);
+			switch(oscIndexType(id)){
+			case 'i':
+				s_len = oscEncodeIdInt(s_buf, BSIZE, id, 1);
+				break;
+			case 'f':
+				s_len = oscEncodeIdFloat(s_buf, BSIZE, id, 0.75f);
+				break;
+			case 's':
+				s_len = oscEncodeIdString(s_buf, BSIZE, id, "Bench");
+				break;
+			}
+		}
+		if(s_len > 0){
+			sendto(fd, s_buf, s_len, 0, (struct sockaddr *)&from, from_len);
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Binds a loopback UDP socket on a free port.
+ *
+ * Returns the socket, or -1 on error
+ */
+static int loopbackSocket(int *port){
+	struct sockaddr_in addr;
+	socklen_t addr_len = sizeof(addr);
+
+	int fd = socket(PF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if(fd < 0 || bind(fd, (struct sockaddr *)&addr, addr_len) < 0 || getsockname(fd, (struct sockaddr *)&addr, &addr_len) < 0){
+		return -1;
+	}
+	*port = ntohs(addr.sin_port);
+	return fd;
+}
+
+static void benchEncode(void){
+	char buffer[BSIZE];
+	float value = 0.5f;
+	uint32_t bits;
+	memcpy(&bits, &value, 4);
+	bits = htonl(bits);
+	char *args[] = {(char *)&bits};
+	int id = oscIndexLookup("/ch/01/mix/fader", 16);
+	volatile int sink = 0;
+
+	long a = allocations;
+	long long t = nowNs();
+	for(int i = 0; i < ENCODE_ROUNDS; i++){
+		sink += oscEncodeMessage(buffer, BSIZE, "/ch/01/mix/fader", "f", args);
+	}
+	report("encode", "oscEncodeMessage", nowNs() - t, ENCODE_ROUNDS, allocations - a);
+
+	a = allocations;
+	t = nowNs();
+	for(int i = 0; i < ENCODE_ROUNDS; i++){
+		sink += oscEncodeFloat(buffer, BSIZE, "/ch/01/mix/fader", value);
+	}
+	report("encode", "oscEncodeFloat", nowNs() - t, ENCODE_ROUNDS, allocations - a);
+
+	a = allocations;
+	t = nowNs();
+	for(int i = 0; i < ENCODE_ROUNDS; i++){
+		sink += oscEncodeIdFloat(buffer, BSIZE, id, value);
+	}
+	report("encode", "oscEncodeIdFloat", nowNs() - t, ENCODE_ROUNDS, allocations - a);
+
+	struct osc_bundle bundle;
+	oscBundleInit(&bundle);
+	BUNDLE_MODE = BUNDLE_ON;
+	a = allocations;
+	t = nowNs();
+	for(int i = 0; i < SEND_ROUNDS; i++){
+		oscBundleAddFloat(&bundle, "/ch/01/mix/fader", value);
+	}
+	oscBundleFlush(&bundle);
+	report("encode", "oscBundleAddFloat (incl. sends)", nowNs() - t, SEND_ROUNDS, allocations - a);
+
+	a = allocations;
+	t = nowNs();
+	for(int i = 0; i < SEND_ROUNDS; i++){
+		generateAndSendMessageWithArgs("/ch/01/mix/fader", "f", args);
+	}
+	report("encode", "generateAndSendMessageWithArgs", nowNs() - t, SEND_ROUNDS, allocations - a);
+}
+
+static void benchDecode(void){
+	char buffer[BSIZE];
+	struct osc_message msg;
+	char *args[] = {"V2.07", "osc-server", "M32", "4.06"};
+	int lengths[2];
+	char messages[2][BSIZE];
+	const char *names[2] = {"1 float", "4 strings"};
+	volatile int sink = 0;
+
+	lengths[0] = oscEncodeFloat(messages[0], BSIZE, "/ch/01/mix/fader", 0.75f);
+	lengths[1] = oscEncodeMessage(messages[1], BSIZE, "/info", "ssss", args);
+
+	for(int m = 0; m < 2; m++){
+		char name[64];
+		memcpy(buffer, messages[m], lengths[m]);
+
+		long a = allocations;
+		long long t = nowNs();
+		for(int i = 0; i < DECODE_ROUNDS; i++){
+			sink += oscDecode(buffer, lengths[m], &msg);
+		}
+		snprintf(name, sizeof(name), "oscDecode, %s", names[m]);
+		report("decode", name, nowNs() - t, DECODE_ROUNDS, allocations - a);
+
+		a = allocations;
+		t = nowNs();
+		for(int i = 0; i < PARSE_ROUNDS; i++){
+			char **parsed = parseArgs(buffer, lengths[m]);
+			for(int j = 0; parsed != NULL && j < msg.argc; j++){
+				free(parsed[j]);
+			}
+			free(parsed);
+		}
+		snprintf(name, sizeof(name), "parseArgs, %s", names[m]);
+		report("decode", name, nowNs() - t, PARSE_ROUNDS, allocations - a);
+	}
+}
+
+/**
+ * Packet pool: a receive and release cycle, and a message kept past its
+ * dispatch.
+ */
+static void benchPool(void){
+	struct x32_packet *packets[BATCH_MAX];
+
+	long a = allocations;
+	long long t = nowNs();
+	for(int i = 0; i < ENCODE_ROUNDS; i++){
+		X32PacketRelease(X32PacketAlloc());
+	}
+	report("pool", "X32PacketAlloc + Release", nowNs() - t, ENCODE_ROUNDS, allocations - a);
+
+	a = allocations;
+	t = nowNs();
+	for(int i = 0; i < ENCODE_ROUNDS; i += BATCH_MAX){
+		for(int k = 0; k < BATCH_MAX; k++){
+			packets[k] = X32PacketAlloc();
+			X32PacketRetain(packets[k]);
+			X32PacketRelease(packets[k]);
+		}
+		for(int k = 0; k < BATCH_MAX; k++){
+			X32PacketRelease(packets[k]);
+		}
+	}
+	report("pool", "BATCH_MAX packets held, retained", nowNs() - t, ENCODE_ROUNDS, allocations - a);
+}
+
+static void subscriber(const struct osc_message *msg, const char *buffer, int length, void *ctx){
+	(*(int *)ctx)++;
+}
+
+/**
+ * Subscriptions: dispatch of a pushed fader change as the number of
+ * subscriptions grows, and the cost of compiling a pattern.
+ */
+static void benchSubscribe(void){
+	char buffer[BSIZE];
+	char name[64];
+	int calls = 0;
+	int len = oscEncodeFloat(buffer, BSIZE, "/ch/05/mix/fader", 0.5f);
+	int leaves = oscIndexCount();
+	int subscribed = 0;
+
+	long a = allocations;
+	long long t = nowNs();
+	X32Subscribe("/ch/*/mix/fader", subscriber, &calls);
+	report("subscr", "X32Subscribe /ch/*/mix/fader", nowNs() - t, 1, allocations - a);
+	subscribed++;
+
+	const int counts[] = {1, 10, 100, 1000};
+	for(int c = 0; c < (int)(sizeof(counts) / sizeof(counts[0])); c++){
+		// other leaves, spread over the whole tree
+		while(subscribed < counts[c]){
+			X32Subscribe(oscIndexAddress(subscribed * 7919 % leaves), subscriber, &calls);
+			subscribed++;
+		}
+		snprintf(name, sizeof(name), "X32Dispatch, %d subscriptions", subscribed);
+		a = allocations;
+		t = nowNs();
+		for(int i = 0; i < PARSE_ROUNDS; i++){
+			X32Dispatch(buffer, len);
+		}
+		report("subscr", name, nowNs() - t, PARSE_ROUNDS, allocations - a);
+	}
+	X32UnsubscribeAll();
+}
+
+/**
+ * System call batching: sends and receives with BATCH_MODE off and on, and
+ * a whole console fetch through the pipeline both ways.
+ */
+static void benchBatch(void){
+	char buffer[BSIZE];
+	struct x32_packet *packets[BATCH_MAX];
+	struct x32_batch batch;
+	int len = oscEncodeFloat(buffer, BSIZE, "/ch/01/mix/fader", 0.5f);
+
+	BATCH_MODE = BATCH_OFF;
+	long a = allocations;
+	long long t = nowNs();
+	for(int i = 0; i < SEND_ROUNDS; i++){
+		X32Transmit(buffer, len);
+	}
+	report("batch", "send, sendto", nowNs() - t, SEND_ROUNDS, allocations - a);
+
+	BATCH_MODE = BATCH_ON;
+	a = allocations;
+	t = nowNs();
+	for(int i = 0; i < SEND_ROUNDS; i += BATCH_MAX){
+		X32BatchBegin(&batch);
+		for(int k = 0; k < BATCH_MAX; k++){
+			X32Transmit(buffer, len);
+		}
+		X32BatchEnd(&batch);
+	}
+	report("batch", "send, sendmmsg", nowNs() - t, SEND_ROUNDS, allocations - a);
+
+	// bursts of BATCH_MAX datagrams from another socket, only the draining
+	// is timed
+	struct sockaddr_in addr;
+	socklen_t addr_len = sizeof(addr);
+	int port;
+	int fd = loopbackSocket(&port);
+	if(fd < 0 || getsockname(X32Socket()->fd, (struct sockaddr *)&addr, &addr_len) < 0){
+		return;
+	}
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	for(int mode = BATCH_OFF; mode <= BATCH_ON; mode++){
+		long long ns = 0;
+		int received = 0;
+		BATCH_MODE = mode;
+		a = allocations;
+		while(received < RECV_ROUNDS){
+			for(int k = 0; k < BATCH_MAX; k++){
+				sendto(fd, buffer, len, 0, (struct sockaddr *)&addr, addr_len);
+			}
+			t = nowNs();
+			int n = X32RecvMany(packets, BATCH_MAX, 0);
+			for(int k = 0; k < n; k++){
+				X32PacketRelease(packets[k]);
+			}
+			ns += nowNs() - t;
+			if(n <= 0){
+				break;
+			}
+			received += n;
+		}
+		report("batch", mode == BATCH_ON ? "receive, recvmmsg" : "receive, recvfrom", ns, received, allocations - a);
+	}
+	close(fd);
+
+	// a whole console: queries go out a window at a time, replies come in
+	// bursts
+	struct x32_value *values = malloc(oscIndexCount() * sizeof(struct x32_value));
+	if(values == NULL){
+		return;
+	}
+	usleep(200000);
+	while(X32Recv(buffer, 10) > 0);
+	for(int mode = BATCH_OFF; mode <= BATCH_ON; mode++){
+		BATCH_MODE = mode;
+		a = allocations;
+		t = nowNs();
+		for(int i = 0; i < FETCH_ROUNDS; i++){
+			X32ShowFetch(values, 0);
+		}
+		report("batch", mode == BATCH_ON ? "X32ShowFetch, batched" : "X32ShowFetch, unbatched", nowNs() - t,
+				FETCH_ROUNDS * oscIndexCount(), allocations - a);
+	}
+	free(values);
+}
+
+static int compareLong(const void *a, const void *b){
+	long long x = *(const long long *)a, y = *(const long long *)b;
+	return x < y ? -1 : x > y;
+}
+
+static void benchLatency(const char *name, long long *samples){
+	int failed = 0;
+	long a = allocations;
+	for(int i = 0; i < LATENCY_ROUNDS; i++){
+		long long t = nowNs();
+		if(getFloatValue("/ch/01/mix/fader") != 0.75f){
+			failed++;
+		}
+		samples[i] = nowNs() - t;
+	}
+	a = allocations - a;
+
+	qsort(samples, LATENCY_ROUNDS, sizeof(long long), compareLong);
+	fprintf(out, "latency  %-34s p50 %6.1f  p90 %6.1f  p99 %6.1f  p99.9 %7.1f  max %7.1f us  %.2f allocs/msg  %d failed\n", name,
+			samples[LATENCY_ROUNDS / 2] / 1e3, samples[LATENCY_ROUNDS * 9 / 10] / 1e3, samples[LATENCY_ROUNDS * 99 / 100] / 1e3,
+			samples[LATENCY_ROUNDS * 999 / 1000] / 1e3, samples[LATENCY_ROUNDS - 1] / 1e3, (double)a / LATENCY_ROUNDS, failed);
+}
+
+/**
+ * Parallel snapshots over 1 to PARALLEL_MAX sockets, each count for
+ * PARALLEL_MS after a warm up, against a rate limited M32Emu that delays
+ * requests over its limits (-P) instead of dropping them, so retransmission
+ * backoff does not distort the figures. Throughput is reported against
+ * one socket and against the ceiling the limits allow, the smaller of
+ * sockets x EMU_CLIENT_RATE and EMU_RATE.
+ */
+static void benchParallel(void){
+	extern char **environ;
+	char port_arg[8], client_rate_arg[16], rate_arg[16];
+	int port;
+	int fd = loopbackSocket(&port);
+	if(fd < 0){
+		return;
+	}
+	close(fd);
+	snprintf(port_arg, sizeof(port_arg), "%d", port);
+	snprintf(client_rate_arg, sizeof(client_rate_arg), "%d", EMU_CLIENT_RATE);
+	snprintf(rate_arg, sizeof(rate_arg), "%d", EMU_RATE);
+
+	char *argv[] = {"./M32Emu", "-p", port_arg, "-l", "1", "-R", client_rate_arg, "-r", rate_arg, "-P", "-s", "0", NULL};
+	posix_spawn_file_actions_t actions;
+	pid_t emu;
+	posix_spawn_file_actions_init(&actions);
+	posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+	int res = posix_spawn(&emu, argv[0], &actions, NULL, argv, environ);
+	posix_spawn_file_actions_destroy(&actions);
+	if(res != 0){
+		fprintf(out, "parallel %s not found, skipped\n", argv[0]);
+		return;
+	}
+
+	struct x32_session *s = X32SessionNew();
+	struct x32_session *previous = X32Use(s);
+	struct x32_value *values = malloc(oscIndexCount() * sizeof(struct x32_value));
+	int connected = 0;
+	for(int i = 0; i < 50 && connected != 1; i++){
+		usleep(20000);
+		connected = X32Connect("127.0.0.1", port);
+	}
+	if(s == NULL || values == NULL || connected != 1){
+		fprintf(out, "parallel cannot connect to %s, skipped\n", argv[0]);
+		goto done;
+	}
+
+	double base = 0;
+	for(int sockets = 1; sockets <= PARALLEL_MAX; sockets *= 2){
+		struct x32_parallel *p = X32ParallelNew(sockets);
+		if(p == NULL){
+			break;
+		}
+		int snapshots = 0, failed = 0;
+		unsigned long long generation = 0;
+		long long t = nowNs();
+		while(nowNs() - t < PARALLEL_WARMUP_MS * 1000000LL){
+			X32ParallelFetch(p, values, 0, NULL);
+		}
+		t = nowNs();
+		while(nowNs() - t < PARALLEL_MS * 1000000LL){
+			int f = X32ParallelFetch(p, values, 0, &generation);
+			failed += f > 0 ? f : 0;
+			snapshots++;
+		}
+		t = nowNs() - t;
+		X32ParallelFree(p);
+
+		double rate = (double)snapshots * oscIndexCount() * 1e9 / t;
+		double limit = sockets * EMU_CLIENT_RATE < EMU_RATE ? sockets * EMU_CLIENT_RATE : EMU_RATE;
+		if(sockets == 1){
+			base = rate;
+		}
+		fprintf(out, "parallel %2d sockets %8.1f ms/snapshot %8.0f leaves/s  x%.2f  %3.0f%% of %5.0f/s  %d failed  generation %llu\n",
+				sockets, t / 1e6 / snapshots, rate, rate / base, rate * 100 / limit, limit, failed, generation);
+	}
+
+done:
+	X32Use(previous);
+	X32SessionFree(s);
+	free(values);
+	kill(emu, SIGTERM);
+	waitpid(emu, NULL, 0);
+}
+
+int main(){
+	int port;
+	pthread_t thread;
+
+	out = fdopen(dup(STDOUT_FILENO), "w");
+	if(out == NULL || freopen("/dev/null", "w", stdout) == NULL){
+		return 1;
+	}
+	setvbuf(out, NULL, _IOLBF, 0);
+
+	int fd = loopbackSocket(&port);
+	if(fd < 0 || oscIndexInit() < 0 || pthread_create(&thread, NULL, responder, &fd) != 0){
+		fprintf(out, "bench: cannot start the emulated console\n");
+		return 1;
+	}
+	if(X32Connect("127.0.0.1", port) != 1){
+		fprintf(out, "bench: cannot connect to the emulated console\n");
+		return 1;
+	}
+
+	benchEncode();
+	benchDecode();
+	benchPool();
+	benchSubscribe();
+	benchBatch();
+
+	// let the emulator drain the set messages before timing round trips
+	char r_buf[BSIZE];
+	usleep(200000);
+	while(X32Recv(r_buf, 10) > 0);
+
+	long long *samples = malloc(LATENCY_ROUNDS * sizeof(long long));
+	if(samples == NULL){
+		return 1;
+	}
+	benchLatency("getFloatValue, caller pumps", samples);
+	X32StartIO();
+	benchLatency("getFloatValue, I/O thread", samples);
+	X32StopIO();
+	free(samples);
+
+	benchParallel();
+	return 0;
+}
@@ -0,0 +1,243 @@
+/*
+ * M32Bundle.c
+ *
+ * OSC bundle builder. Set-messages are encoded straight into a datagram
+ * sized buffer behind a "#bundle" header; when the next message does not
+ * fit, the bundle is flushed as one UDP packet and a new one is started.
+ *
+ * Consoles that do not handle bundles get the very same messages sent one
+ * datagram each, see BUNDLE_MODE and X32ProbeBundles().
+ */
+#include "M32.h"
+
+#include <string.h>
+#include <arpa/inet.h>
+
+#define BUNDLE_HEADER_LEN 16 // "#bundle\0" + 8 byte timetag
+
+// BUNDLE_AUTO: each session probes its console on the first flush
+int BUNDLE_MODE = BUNDLE_AUTO;
+
+/**
+ * Empties the bundle, keeping its datagram count.
+ */
+static void bundleReset(struct osc_bundle *bundle){
+	memcpy(bundle->buffer, "#bundle\0", 8);
+	// timetag 0x0000000000000001 means "immediately"
+	memset(bundle->buffer + 8, 0, 7);
+	bundle->buffer[15] = 1;
+	bundle->length = BUNDLE_HEADER_LEN;
+	bundle->count = 0;
+}
+
+/**
+ * Starts an empty bundle with an "immediately" timetag.
+ */
+void oscBundleInit(struct osc_bundle *bundle){
+	bundleReset(bundle);
+	bundle->datagrams = 0;
+}
+
+/**
+ * Free space for the next element's message, after its size field.
+ */
+static int bundleRoom(struct osc_bundle *bundle){
+	int room = BUNDLE_MTU - bundle->length - 4;
+	if(bundle->count == BUNDLE_MAX_MESSAGES || room < 0){
+		return 0;
+	}
+	return room;
+}
+
+/**
+ * Records a message of length bytes that was encoded in place after the
+ * current end of the bundle.
+ *
+ * Returns the number of messages in the bundle
+ */
+static int bundleCommit(struct osc_bundle *bundle, int length){
+	uint32_t size = htonl(length);
+	memcpy(bundle->buffer + bundle->length, &size, 4);
+	bundle->offsets[bundle->count++] = bundle->length;
+	bundle->length += 4 + length;
+	return bundle->count;
+}
+
+/**
+ * Sends the elements of a bundle as individual messages, for consoles which
+ * do not take bundles; still as few system calls as a batch allows.
+ *
+ * Returns the number of datagrams sent, or -1 on error
+ */
+static int bundleSendEach(struct osc_bundle *bundle){
+	struct x32_batch batch;
+	int res = bundle->count;
+
+	X32BatchBegin(&batch);
+	for(int i = 0; i < bundle->count; i++){
+		uint32_t size;
+		memcpy(&size, bundle->buffer + bundle->offsets[i], 4);
+		if(X32Send(bundle->buffer + bundle->offsets[i] + 4, ntohl(size)) < 0){
+			res = -1;
+			break;
+		}
+	}
+	if(X32BatchEnd(&batch) < 0){
+		res = -1;
+	}
+	return res;
+}
+
+/**
+ * Sends a bundle wrapping a single /info query and waits for the answer to
+ * find out whether the console of the current session handles bundles.
+ * The probe is sent up to BUNDLE_PROBES times, doubling the wait each time,
+ * so that a lost datagram does not turn bundles off; the outcome is kept
+ * with the session's socket, see X32BundleMode.
+ *
+ * Returns 1 if bundles are answered, 0 if not, -1 on error
+ */
+int X32ProbeBundles(void){
+	struct x32_socket *x = X32Socket();
+	struct osc_bundle bundle;
+	char r_buf[BSIZE];
+
+	oscBundleInit(&bundle);
+	int len = oscEncodeQuery(bundle.buffer + bundle.length + 4, bundleRoom(&bundle), "/info");
+	bundleCommit(&bundle, len);
+
+	int timeout = 2 * X32Timeout();
+	for(int i = 0; i < BUNDLE_PROBES; i++, timeout *= 2){
+		int r_len = X32RequestWith("/info", bundle.buffer, bundle.length, r_buf, timeout);
+		if(r_len < 0){
+			return -1;
+		}
+		if(r_len > 0){
+			x->bundles = BUNDLE_ON;
+			return 1;
+		}
+	}
+	x->bundles = BUNDLE_OFF;
+	return 0;
+}
+
+/**
+ * Returns BUNDLE_MODE when it is BUNDLE_ON or BUNDLE_OFF, otherwise what
+ * X32ProbeBundles found for the current session, BUNDLE_AUTO until then
+ */
+int X32BundleMode(void){
+	if(BUNDLE_MODE != BUNDLE_AUTO){
+		return BUNDLE_MODE;
+	}
+	return X32Socket()->bundles;
+}
+
+/**
+ * Sends the bundle and starts a new empty one in its place, adding the
+ * datagrams sent to bundle->datagrams.
+ * A bundle with a single message is sent as a plain message; when the
+ * console does not take bundles every message goes out as its own datagram.
+ *
+ * Returns the number of datagrams sent, or -1 on error
+ */
+int oscBundleFlush(struct osc_bundle *bundle){
+	int res = 0;
+
+	if(bundle->count == 1){
+		res = bundleSendEach(bundle);
+	}else if(bundle->count > 1){
+		int mode = X32BundleMode();
+		if(mode == BUNDLE_AUTO && (mode = X32ProbeBundles()) < 0){
+			res = -1;
+		}else if(mode == BUNDLE_OFF){
+			res = bundleSendEach(bundle);
+		}else{
+			res = X32Send(bundle->buffer, bundle->length) < 0 ? -1 : 1;
+		}
+	}
+
+	bundleReset(bundle);
+	if(res > 0){
+		bundle->datagrams += res;
+	}
+	return res;
+}
+
+/**
+ * Adds an already encoded message to the bundle, flushing first when it
+ * does not fit anymore.
+ *
+ * Returns the number of messages in the bundle, or -1 on error or if the
+ * message is larger than an empty bundle
+ */
+int oscBundleAdd(struct osc_bundle *bundle, const char *message, int length){
+	if(length > bundleRoom(bundle)){
+		if(bundle->count == 0 || oscBundleFlush(bundle) < 0 || length > bundleRoom(bundle)){
+			return -1;
+		}
+	}
+	memcpy(bundle->buffer + bundle->length + 4, message, length);
+	return bundleCommit(bundle, length);
+}
+
+// encodes one set-message as oscEncodeInt does, -1 if it does not fit in size
+typedef int (*bundle_encoder)(char *buffer, int size, const char *address, const void *value);
+
+static int encodeInt(char *buffer, int size, const char *address, const void *value){
+	return oscEncodeInt(buffer, size, address, *(const int *)value);
+}
+
+static int encodeFloat(char *buffer, int size, const char *address, const void *value){
+	return oscEncodeFloat(buffer, size, address, *(const float *)value);
+}
+
+static int encodeString(char *buffer, int size, const char *address, const void *value){
+	return oscEncodeString(buffer, size, address, value);
+}
+
+/**
+ * Encodes a message in place at the end of the bundle, flushing first when
+ * it does not fit anymore.
+ *
+ * Returns the number of messages in the bundle, or -1 on error
+ */
+static int bundleAddWith(struct osc_bundle *bundle, bundle_encoder encode, const char *address, const void *value){
+	int len = encode(bundle->buffer + bundle->length + 4, bundleRoom(bundle), address, value);
+	if(len < 0){
+		if(bundle->count == 0 || oscBundleFlush(bundle) < 0){
+			return -1;
+		}
+		len = encode(bundle->buffer + bundle->length + 4, bundleRoom(bundle), address, value);
+		if(len < 0){
+			return -1;
+		}
+	}
+	return bundleCommit(bundle, len);
+}
+
+/**
+ * Adds a set-message with one int argument, see oscEncodeInt.
+ *
+ * Returns the number of messages in the bundle, or -1 on error
+ */
+int oscBundleAddInt(struct osc_bundle *bundle, const char *address, int value){
+	return bundleAddWith(bundle, encodeInt, address, &value);
+}
+
+/**
+ * Adds a set-message with one float argument, see oscEncodeFloat.
+ *
+ * Returns the number of messages in the bundle, or -1 on error
+ */
+int oscBundleAddFloat(struct osc_bundle *bundle, const char *address, float value){
+	return bundleAddWith(bundle, encodeFloat, address, &value);
+}
+
+/**
+ * Adds a set-message with one string argument, see oscEncodeString.
+ *
+ * Returns the number of messages in the bundle, or -1 on error
+ */
+int oscBundleAddString(struct osc_bundle *bundle, const char *address, const char *value){
+	return bundleAddWith(bundle, encodeString, address, value);
+}
@@ -0,0 +1,333 @@
+/*
+ * M32Cache.c
+ *
+ * In-process mirror of the console state. Every leaf of the node index has
+ * one entry, filled once by a pipelined fetch of the whole tree and kept
+ * current afterwards by applying every received message that carries a
+ * value: replies to our own queries as well as the updates the console
+ * pushes to /xremote clients. /xremote is renewed from a timer, see
+ * X32Every(). The console does not echo our own set-messages, so X32Send
+ * stores their values too.
+ *
+ * Lookups go through the node index hash, so a cached getter costs a hash
+ * and a copy instead of a network round trip.
+ *
+ * The mirror follows the session it was started on (see X32Use); messages
+ * of other consoles leave it alone.
+ */
+#include "M32.h"
+
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <arpa/inet.h>
+
+struct cache_entry{
+	struct x32_value value;
+	long long updated; // monotonicMs() of the last update, 0 if never
+	bool confirmed; // value came from the console, not from a write of ours
+};
+
+static struct cache_entry *entries; // by leaf id
+static pthread_rwlock_t cache_lock = PTHREAD_RWLOCK_INITIALIZER;
+static atomic_int cache_enabled;
+static int renew_timer = -1;
+static struct x32_session *cache_session; // whose console is mirrored
+
+static void renewXremote(void *ctx){
+	generateAndSendMessage("/xremote");
+}
+
+/**
+ * Stores the value carried by a received message. Called by X32Dispatch
+ * for every message whose address is a leaf of the node index.
+ * id: leaf id of the message address
+ *
+ * Returns the leaf id updated, or -1 if the message was not cached
+ */
+int X32CacheApply(int id, const struct osc_message *msg){
+	if(!cache_enabled || msg->argc < 1 || id < 0 || id >= oscIndexCount() || X32Current() != cache_session){
+		return -1;
+	}
+
+	struct x32_value value;
+	if(oscArgValue(msg->args, &value) < 0){
+		return -1;
+	}
+
+	pthread_rwlock_wrlock(&cache_lock);
+	if(entries != NULL){
+		entries[id].value = value;
+		entries[id].updated = monotonicMs();
+		entries[id].confirmed = true;
+	}
+	pthread_rwlock_unlock(&cache_lock);
+	return id;
+}
+
+/**
+ * Fetches every leaf of the node index with a pipelined query window;
+ * the replies land in the mirror through X32CacheApply.
+ * window: in-flight query limit, 0 for PIPELINE_WINDOW
+ *
+ * Returns the number of leaves that could not be fetched, or -1 on error
+ */
+int X32CacheLoad(int window){
+	int count = oscIndexCount();
+	if(count == 0){
+		return -1;
+	}
+
+	struct x32_query *queries = malloc(count * sizeof(struct x32_query));
+	struct x32_value *scratch = malloc(count * sizeof(struct x32_value));
+	if(queries == NULL || scratch == NULL){
+		free(queries);
+		free(scratch);
+		return -1;
+	}
+
+	for(int id = 0; id < count; id++){
+		strcpy(queries[id].address, oscIndexAddress(id));
+		queries[id].id = id;
+		queries[id].dest = scratch + id;
+		queries[id].kind = FIELD_VALUE;
+		queries[id].size = sizeof(struct x32_value);
+	}
+
+	int res = X32Pipeline(queries, count, window);
+	free(queries);
+	free(scratch);
+	if(res < 0){
+		return -1;
+	}
+	return count - res;
+}
+
+/**
+ * Cancels the /xremote renewal on the session it was started on.
+ */
+static void cacheCancelRenew(void){
+	if(renew_timer < 0){
+		return;
+	}
+	struct x32_session *previous = X32Use(cache_session);
+	X32CancelTimer(renew_timer);
+	X32Use(previous);
+	renew_timer = -1;
+}
+
+/**
+ * Enables the mirror: subscribes with /xremote, renews the subscription
+ * every XREMOTE_RENEW ms and loads the whole tree once. Started again on
+ * another session, the mirror moves to that session's console: the
+ * renewal on the previous one stops and every entry starts over.
+ * window: in-flight query limit for the initial load, 0 for PIPELINE_WINDOW
+ *
+ * Returns the number of leaves that could not be fetched, or -1 on error
+ */
+int X32CacheStart(int window){
+	if(oscIndexInit() < 0){
+		return -1;
+	}
+
+	struct x32_session *session = X32Current();
+	bool moved = renew_timer >= 0 && cache_session != session;
+	if(moved){
+		cache_enabled = 0;
+		cacheCancelRenew();
+	}
+
+	pthread_rwlock_wrlock(&cache_lock);
+	if(entries == NULL){
+		entries = calloc(oscIndexCount(), sizeof(struct cache_entry));
+	}else if(moved){
+		memset(entries, 0, oscIndexCount() * sizeof(struct cache_entry));
+	}
+	pthread_rwlock_unlock(&cache_lock);
+	if(entries == NULL){
+		return -1;
+	}
+	cache_session = session;
+	cache_enabled = 1;
+
+	if(renew_timer < 0){
+		renew_timer = X32Every(XREMOTE_RENEW, renewXremote, NULL);
+	}
+	if(generateAndSendMessage("/xremote") < 0){
+		return -1;
+	}
+	return X32CacheLoad(window);
+}
+
+/**
+ * Stops updating the mirror and frees it.
+ */
+void X32CacheStop(void){
+	cache_enabled = 0;
+	cacheCancelRenew();
+
+	pthread_rwlock_wrlock(&cache_lock);
+	free(entries);
+	entries = NULL;
+	pthread_rwlock_unlock(&cache_lock);
+}
+
+/**
+ * Stores a value we wrote to the console, which does not echo our own
+ * set-messages back to us. Until the console reports the leaf again the
+ * value is only what we asked for, see X32CacheConfirmedId.
+ * id: leaf id of the value
+ *
+ * Returns the leaf id updated, or -1 if the mirror is not enabled
+ */
+int X32CacheSet(int id, const struct x32_value *value){
+	if(!cache_enabled || id < 0 || id >= oscIndexCount()){
+		return -1;
+	}
+
+	int res = -1;
+	pthread_rwlock_wrlock(&cache_lock);
+	if(entries != NULL){
+		entries[id].value = *value;
+		entries[id].updated = monotonicMs();
+		entries[id].confirmed = false;
+		res = id;
+	}
+	pthread_rwlock_unlock(&cache_lock);
+	return res;
+}
+
+static void cacheSentMessage(const char *buffer, int length){
+	struct osc_message msg;
+	struct x32_value value;
+
+	if(oscDecode(buffer, length, &msg) < 0 || msg.argc < 1 || oscArgValue(msg.args, &value) < 0){
+		return;
+	}
+	X32CacheSet(oscIndexLookup(msg.address.ptr, msg.address.len), &value);
+}
+
+/**
+ * Stores the values of the set-messages in a datagram sent to the console,
+ * a single message or the elements of a bundle. Called by X32Send; queries
+ * and messages for leaves outside the node index are ignored.
+ */
+void X32CacheSent(const char *buffer, int length){
+	if(!cache_enabled || X32Current() != cache_session){
+		return;
+	}
+	if(length < 16 || memcmp(buffer, "#bundle\0", 8) != 0){
+		cacheSentMessage(buffer, length);
+		return;
+	}
+	// elements after the "#bundle" header and timetag
+	for(int offset = 16; offset + 4 <= length;){
+		uint32_t size;
+		memcpy(&size, buffer + offset, 4);
+		size = ntohl(size);
+		if(size > (uint32_t)(length - offset - 4)){
+			break;
+		}
+		cacheSentMessage(buffer + offset + 4, size);
+		offset += 4 + size;
+	}
+}
+
+/**
+ * Reads a value from the mirror.
+ * value: receives the value
+ * updated: if not NULL, receives the monotonicMs() time of the last update
+ *
+ * Returns 0 on success, -1 if the mirror holds no value for address
+ */
+int X32CacheGet(const char *address, struct x32_value *value, long long *updated){
+	return X32CacheGetId(oscIndexLookup(address, strlen(address)), value, updated);
+}
+
+/**
+ * X32CacheGet by node index leaf id.
+ *
+ * Returns 0 on success, -1 if the mirror holds no value for id
+ */
+int X32CacheGetId(int id, struct x32_value *value, long long *updated){
+	if(id < 0 || id >= oscIndexCount()){
+		return -1;
+	}
+
+	int res = -1;
+	pthread_rwlock_rdlock(&cache_lock);
+	if(entries != NULL && entries[id].updated != 0){
+		*value = entries[id].value;
+		if(updated != NULL){
+			*updated = entries[id].updated;
+		}
+		res = 0;
+	}
+	pthread_rwlock_unlock(&cache_lock);
+	return res;
+}
+
+/**
+ * X32CacheGetId for a value the console itself reported, in a reply or an
+ * /xremote update. A write of ours may have been lost or overridden, so
+ * after one the leaf has to be read again before the mirror is taken as
+ * the console state.
+ *
+ * Returns 0 on success, -1 if the mirror holds no confirmed value for id
+ */
+int X32CacheConfirmedId(int id, struct x32_value *value){
+	if(id < 0 || id >= oscIndexCount()){
+		return -1;
+	}
+
+	int res = -1;
+	pthread_rwlock_rdlock(&cache_lock);
+	if(entries != NULL && entries[id].updated != 0 && entries[id].confirmed){
+		*value = entries[id].value;
+		res = 0;
+	}
+	pthread_rwlock_unlock(&cache_lock);
+	return res;
+}
+
+/**
+ * getIntValue answered from the mirror when it holds the value.
+ * fresh: true to always query the console (which also refreshes the mirror)
+ *
+ * Returns integer response, or -1 on failure
+ */
+int getIntValueCached(char *address, bool fresh){
+	struct x32_value value;
+	if(!fresh && X32CacheGet(address, &value, NULL) == 0 && value.type == 'i'){
+		return value.i;
+	}
+	return getIntValue(address);
+}
+
+/**
+ * getFloatValue answered from the mirror when it holds the value.
+ * fresh: true to always query the console (which also refreshes the mirror)
+ *
+ * Returns float response, or -1 on failure
+ */
+float getFloatValueCached(char *address, bool fresh){
+	struct x32_value value;
+	if(!fresh && X32CacheGet(address, &value, NULL) == 0 && value.type == 'f'){
+		return value.f;
+	}
+	return getFloatValue(address);
+}
+
+/**
+ * getStringValue answered from the mirror when it holds the value.
+ * fresh: true to always query the console (which also refreshes the mirror)
+ *
+ * Returns malloced string response, or NULL on failure
+ */
+char *getStringValueCached(char *address, bool fresh){
+	struct x32_value value;
+	if(!fresh && X32CacheGet(address, &value, NULL) == 0 && value.type == 's'){
+		return strdup(value.s);
+	}
+	return getStringValue(address);
+}
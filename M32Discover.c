@@ -0,0 +1,198 @@
+/*
+ * M32Discover.c
+ *
+ * Finds consoles on the network. /info (X32, M32) and /xinfo (XR series)
+ * queries go out back to back from one socket to every host of a CIDR
+ * range, or to a broadcast address, and replies are collected as they
+ * come until one overall deadline. A /24 is swept in one round trip plus
+ * the send time instead of one timeout per host.
+ */
+#include "M32.h"
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <poll.h>
+
+#define DISCOVER_RCVBUF (256 * 1024) // room for the replies of a large sweep
+
+static const char info_query[8] = "/info";
+static const char xinfo_query[8] = "/xinfo";
+
+/**
+ * Parses "a.b.c.d/prefix" or a single address (a /32) into the first host
+ * to probe, in host byte order. Ranges bigger than /31 skip the
+ * network and broadcast addresses.
+ *
+ * Returns the number of hosts, or -1 on a malformed or too large range
+ */
+static int discoverRange(const char *network, uint32_t *first){
+	char addr[16];
+	int prefix = 32;
+
+	const char *slash = strchr(network, '/');
+	int len = slash != NULL ? slash - network : (int)strlen(network);
+	if(len >= (int)sizeof(addr)){
+		return -1;
+	}
+	memcpy(addr, network, len);
+	addr[len] = '\0';
+
+	if(slash != NULL){
+		char *end;
+		prefix = strtol(slash + 1, &end, 10);
+		if(*end != '\0' || end == slash + 1 || prefix < 0 || prefix > 32){
+			return -1;
+		}
+	}
+
+	struct in_addr in;
+	if(inet_pton(AF_INET, addr, &in) != 1){
+		return -1;
+	}
+	uint64_t size = 1ull << (32 - prefix);
+	if(size > DISCOVER_MAX_HOSTS){
+		return -1;
+	}
+
+	*first = ntohl(in.s_addr) & ~(uint32_t)(size - 1);
+	if(size > 2){
+		(*first)++;
+		size -= 2;
+	}
+	return size;
+}
+
+/**
+ * Copies a string argument into a fixed size field, truncating.
+ */
+static void discoverField(char *dest, const struct osc_message *msg, int arg){
+	dest[0] = '\0';
+	if(arg < msg->argc && msg->args[arg].type == 's'){
+		int len = msg->args[arg].s.len;
+		if(len >= X32_STRING_MAX){
+			len = X32_STRING_MAX - 1;
+		}
+		memcpy(dest, msg->args[arg].s.ptr, len);
+		dest[len] = '\0';
+	}
+}
+
+/**
+ * Reads every pending reply without waiting and records new consoles.
+ * /info answers version, server name, model, firmware; /xinfo answers
+ * ip, name, model, firmware.
+ *
+ * Returns the updated number of consoles found
+ */
+static int discoverDrain(int fd, struct x32_console *consoles, int found, int max){
+	char r_buf[BSIZE];
+	struct sockaddr_in from;
+	socklen_t from_len;
+	struct osc_message msg;
+
+	for(;;){
+		from_len = sizeof(from);
+		int r_len = recvfrom(fd, r_buf, BSIZE, MSG_DONTWAIT, (struct sockaddr *)&from, &from_len);
+		if(r_len < 0){
+			return found;
+		}
+		if(oscDecode(r_buf, r_len, &msg) < 0 || msg.argc < 4){
+			continue;
+		}
+
+		bool xinfo;
+		if(msg.address.len == 5 && memcmp(msg.address.ptr, info_query, 5) == 0){
+			xinfo = false;
+		}else if(msg.address.len == 6 && memcmp(msg.address.ptr, xinfo_query, 6) == 0){
+			xinfo = true;
+		}else{
+			continue;
+		}
+
+		char ip[16];
+		inet_ntop(AF_INET, &from.sin_addr, ip, sizeof(ip));
+
+		// a console answering both queries is listed once
+		int i;
+		for(i = 0; i < found && strcmp(consoles[i].ip, ip) != 0; i++);
+		if(i == found){
+			if(found == max){
+				continue;
+			}
+			found++;
+		}else if(!xinfo){
+			continue; // keep the console name /xinfo gave
+		}
+
+		struct x32_console *console = consoles + i;
+		strcpy(console->ip, ip);
+		discoverField(console->name, &msg, 1);
+		discoverField(console->model, &msg, 2);
+		discoverField(console->firmware, &msg, 3);
+	}
+}
+
+/**
+ * Sends /info and /xinfo to every host of a network without waiting in
+ * between, then collects the answers until the deadline.
+ * network: CIDR range ("192.168.0.0/24"), a single host, or a broadcast
+ *          address ("255.255.255.255", "192.168.0.255"); at most a /16
+ * consoles: array of at least max entries, receives the consoles found
+ * timeout: overall time in ms to wait for answers after the last send
+ *
+ * Returns the number of consoles found, or
+ *     -1 on a malformed network
+ *     -2 on socket creation error
+ */
+int X32Discover(const char *network, int port, struct x32_console *consoles, int max, int timeout){
+	uint32_t first;
+	int hosts = discoverRange(network, &first);
+	if(hosts < 0){
+		return -1;
+	}
+
+	int fd = socket(PF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	if(fd < 0){
+		return -2;
+	}
+	int on = 1, rcvbuf = DISCOVER_RCVBUF;
+	setsockopt(fd, SOL_SOCKET, SO_BROADCAST, &on, sizeof(on));
+	setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+	struct sockaddr_in dest;
+	memset(&dest, 0, sizeof(dest));
+	dest.sin_family = AF_INET;
+	dest.sin_port = htons(port);
+
+	int found = 0;
+	for(int i = 0; i < hosts; i++){
+		dest.sin_addr.s_addr = htonl(first + i);
+		// a full send queue only loses this host, keep sweeping
+		sendto(fd, info_query, sizeof(info_query), 0, (struct sockaddr *)&dest, sizeof(dest));
+		sendto(fd, xinfo_query, sizeof(xinfo_query), 0, (struct sockaddr *)&dest, sizeof(dest));
+
+		// early replies must not overflow the receive buffer on big sweeps
+		if((i & 63) == 63){
+			found = discoverDrain(fd, consoles, found, max);
+		}
+	}
+
+	struct pollfd pfd = {.fd = fd, .events = POLLIN};
+	long long deadline = monotonicMs() + timeout;
+	for(;;){
+		found = discoverDrain(fd, consoles, found, max);
+		int left = deadline - monotonicMs();
+		if(left <= 0){
+			break;
+		}
+		if(poll(&pfd, 1, left) < 0 && errno != EINTR){
+			break;
+		}
+	}
+
+	close(fd);
+	return found;
+}
@@ -0,0 +1,641 @@
+/*
+ * M32Emu.c
+ *
+ * Console emulator for load and latency testing without hardware, built
+ * by "make emu". Listens on UDP like an X32/M32 and answers /info, /xinfo,
+ * /status, queries and sets on every leaf of the node index, /node text
+ * queries, /xremote subscriptions (sets from one client are pushed to the
+ * others) and /meters subscriptions (blobs every 50 ms times the factor),
+ * for any number of clients at once. Bundles are unpacked like the console
+ * does.
+ *
+ * Every datagram can be delayed by a fixed latency plus random jitter,
+ * dropped at random in either direction, and requests can be rate limited
+ * globally and per client to model a console that saturates: requests over
+ * the limit are dropped, or with -P answered late, at the limited rate.
+ * Counters are printed every few seconds and on exit.
+ *
+ * usage: M32Emu [-p port] [-l latency ms] [-j jitter ms] [-d loss 0-1]
+ *               [-r requests/s] [-R requests/s per client] [-P]
+ *               [-s stats period s]
+ */
+#define _GNU_SOURCE // ppoll
+#include "M32.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <signal.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <poll.h>
+#include <math.h>
+#include <endian.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+#define EMU_MAX_CLIENTS 256
+#define EMU_QUEUE_SIZE 8192 // datagrams waiting for their latency to pass
+#define EMU_SUBSCRIPTION 10000000LL // us a /xremote or /meters request lasts
+#define EMU_METER_PERIOD 50000LL // us between meter blobs with factor 1
+#define EMU_NODE_MAX 480 // longest /node text answered, fx/N/par fits a BSIZE reply
+
+// Values sent by the /meters/N banks of the console
+static const int meter_sizes[METER_BANKS] = {70, 96, 49, 22, 82, 27, 4, 16, 6, 32, 32, 5, 4, 48, 80, 50, 48};
+
+struct emu_client{
+	struct sockaddr_in addr;
+	long long seen; // us, 0 for a free entry
+	long long xremote_until;
+	long long meter_until[METER_BANKS];
+	long long meter_due[METER_BANKS];
+	int meter_factor[METER_BANKS];
+	double tokens; // per client rate limit
+	long long tokens_time;
+	long requests;
+};
+
+struct emu_datagram{
+	long long due; // us
+	struct sockaddr_in addr;
+	int length;
+	char buffer[BSIZE];
+};
+
+static struct{
+	int port;
+	double latency, jitter; // us
+	double loss;
+	double rate, client_rate; // requests/s, 0 for unlimited
+	bool pace; // delay requests over the rates instead of dropping them
+	int stats_period; // s
+} options = {10023, 0, 0, 0, 0, 0, false, 5};
+
+static struct{
+	long received, requests, replies, pushes, meters;
+	long lost, limited, paced, overflow;
+} stats;
+
+static int fd;
+static struct emu_client clients[EMU_MAX_CLIENTS];
+static struct x32_value *values; // by leaf id
+static double tokens; // global rate limit
+static long long tokens_time;
+static long long pacing; // us the replies to the request being handled wait, see emuAdmit
+
+// min-heap on due
+static struct emu_datagram *queue;
+static int queue_count;
+
+static volatile sig_atomic_t stop;
+
+static long long nowUs(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+static uint64_t random_state = 0x9e3779b97f4a7c15ull;
+
+// xorshift64*, uniform in [0, 1)
+static double randomUnit(void){
+	random_state ^= random_state >> 12;
+	random_state ^= random_state << 25;
+	random_state ^= random_state >> 27;
+	return ((random_state * 2685821657736338717ull) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/**
+ * Queues a datagram to be sent after the configured latency and jitter,
+ * or drops it as configured.
+ */
+static void emuSend(const struct sockaddr_in *addr, const char *buffer, int length){
+	if(length <= 0 || length > BSIZE){
+		return;
+	}
+	if(options.loss > 0 && randomUnit() < options.loss){
+		stats.lost++;
+		return;
+	}
+	if(queue_count == EMU_QUEUE_SIZE){
+		stats.overflow++;
+		return;
+	}
+
+	int i = queue_count++;
+	long long due = nowUs() + pacing + (long long)(options.latency + options.jitter * randomUnit());
+	while(i > 0 && queue[(i - 1) / 2].due > due){
+		queue[i] = queue[(i - 1) / 2];
+		i = (i - 1) / 2;
+	}
+	queue[i].due = due;
+	queue[i].addr = *addr;
+	queue[i].length = length;
+	memcpy(queue[i].buffer, buffer, length);
+}
+
+/**
+ * Sends the queued datagrams that are due.
+ *
+ * Returns the due time of the next one, or -1 if the queue is empty
+ */
+static long long emuFlush(long long now){
+	while(queue_count > 0 && queue[0].due <= now){
+		sendto(fd, queue[0].buffer, queue[0].length, 0, (struct sockaddr *)&queue[0].addr, sizeof(queue[0].addr));
+
+		// sift the last entry down from the root
+		struct emu_datagram *last = queue + --queue_count;
+		int i = 0;
+		for(;;){
+			int child = 2 * i + 1;
+			if(child >= queue_count){
+				break;
+			}
+			if(child + 1 < queue_count && queue[child + 1].due < queue[child].due){
+				child++;
+			}
+			if(queue[child].due >= last->due){
+				break;
+			}
+			queue[i] = queue[child];
+			i = child;
+		}
+		if(i != queue_count){
+			queue[i] = *last;
+		}
+	}
+	return queue_count > 0 ? queue[0].due : -1;
+}
+
+static struct emu_client *emuClient(const struct sockaddr_in *addr, long long now){
+	struct emu_client *oldest = clients;
+	for(int i = 0; i < EMU_MAX_CLIENTS; i++){
+		struct emu_client *client = clients + i;
+		if(client->seen != 0 && client->addr.sin_addr.s_addr == addr->sin_addr.s_addr && client->addr.sin_port == addr->sin_port){
+			client->seen = now;
+			return client;
+		}
+		if(client->seen < oldest->seen){
+			oldest = client;
+		}
+	}
+
+	// new client, replaces a free or the least recently seen entry
+	memset(oldest, 0, sizeof(*oldest));
+	oldest->addr = *addr;
+	oldest->seen = now;
+	oldest->tokens = options.client_rate;
+	oldest->tokens_time = now;
+	return oldest;
+}
+
+/**
+ * Token buckets of the global and per client request rates, one second of
+ * burst each. With pacing the buckets go into debt instead, and the request
+ * waits until they have refilled for it, as in the input queue of a console
+ * working at its limit.
+ *
+ * Returns the us the reply has to wait, or -1 if the request is dropped
+ */
+static long long emuAdmit(struct emu_client *client, long long now){
+	double elapsed = (now - tokens_time) / 1e6;
+	double wait = 0; // s
+	tokens_time = now;
+	if(options.rate > 0){
+		tokens = fmin(options.rate, tokens + elapsed * options.rate);
+		if(tokens < 1){
+			if(!options.pace){
+				return -1;
+			}
+			wait = (1 - tokens) / options.rate;
+		}
+	}
+	if(options.client_rate > 0){
+		client->tokens = fmin(options.client_rate, client->tokens + (now - client->tokens_time) / 1e6 * options.client_rate);
+		client->tokens_time = now;
+		if(client->tokens < 1){
+			if(!options.pace){
+				return -1;
+			}
+			wait = fmax(wait, (1 - client->tokens) / options.client_rate);
+		}
+		client->tokens--;
+	}
+	if(options.rate > 0){
+		tokens--;
+	}
+	return (long long)(wait * 1e6);
+}
+
+/**
+ * Sends the value of a leaf.
+ *
+ * Returns true if a message was queued
+ */
+static bool emuSendValue(const struct sockaddr_in *addr, int id){
+	char s_buf[BSIZE];
+	int s_len = -1;
+	struct x32_value *value = values + id;
+
+	if(value->type == 'i'){
+		s_len = oscEncodeIdInt(s_buf, BSIZE, id, value->i);
+	}else if(value->type == 'f'){
+		s_len = oscEncodeIdFloat(s_buf, BSIZE, id, value->f);
+	}else if(value->type == 's'){
+		s_len = oscEncodeIdString(s_buf, BSIZE, id, value->s);
+	}
+	if(s_len < 0){
+		return false;
+	}
+	emuSend(addr, s_buf, s_len);
+	return true;
+}
+
+/**
+ * Sets a leaf and pushes the new value to the /xremote clients other than
+ * the one that made the change.
+ */
+static void emuSet(struct emu_client *from, int id, const struct osc_arg *arg, long long now){
+	struct x32_value value;
+	if(oscArgValue(arg, &value) < 0){
+		return;
+	}
+	// the console converts numbers to the type of the parameter
+	if(values[id].type == 'i' && value.type == 'f'){
+		value.i = value.f;
+		value.type = 'i';
+	}else if(values[id].type == 'f' && value.type == 'i'){
+		value.f = value.i;
+		value.type = 'f';
+	}
+	if(value.type != values[id].type){
+		return;
+	}
+	values[id] = value;
+
+	for(int i = 0; i < EMU_MAX_CLIENTS; i++){
+		struct emu_client *client = clients + i;
+		if(client != from && client->seen != 0 && client->xremote_until > now){
+			stats.pushes += emuSendValue(&client->addr, id);
+		}
+	}
+}
+
+/**
+ * Answers "/node ,s path" with the values of the leaves right below path
+ * (or of the leaf itself) on one text line, formatted as the console
+ * displays them.
+ */
+static void emuNode(const struct sockaddr_in *addr, const struct osc_view *path){
+	char text[EMU_NODE_MAX];
+	int ids[NODE_MAX_LEAVES];
+	const char *p = path->ptr;
+	int p_len = path->len;
+	while(p_len > 0 && p[0] == '/'){
+		p++;
+		p_len--;
+	}
+
+	int found = oscNodeLeaves(p, p_len, ids, NODE_MAX_LEAVES);
+	if(found <= 0 || p_len + 2 > EMU_NODE_MAX){
+		return;
+	}
+	int len = snprintf(text, sizeof(text), "/%.*s", p_len, p);
+	for(int i = 0; i < found; i++){
+		text[len++] = ' ';
+		int t_len = oscNodeFormat(ids[i], values + ids[i], text + len, EMU_NODE_MAX - 1 - len);
+		if(t_len < 0){
+			return;
+		}
+		len += t_len;
+	}
+	if(len >= EMU_NODE_MAX - 1){
+		return;
+	}
+	text[len++] = '\n';
+	text[len] = '\0';
+
+	char s_buf[BSIZE];
+	char *args[] = {text};
+	int s_len = oscEncodeMessage(s_buf, BSIZE, "node", "s", args);
+	if(s_len > 0){
+		emuSend(addr, s_buf, s_len);
+		stats.replies++;
+	}
+}
+
+/**
+ * Handles "/meters ,s[i[i]] /meters/N [channel] [factor]".
+ */
+static void emuMeters(struct emu_client *client, const struct osc_message *msg, long long now){
+	if(msg->argc < 1 || msg->args[0].type != 's' || msg->args[0].s.len < 9 || memcmp(msg->args[0].s.ptr, "/meters/", 8) != 0){
+		return;
+	}
+	int bank = atoi(msg->args[0].s.ptr + 8);
+	if(bank < 0 || bank >= METER_BANKS){
+		return;
+	}
+
+	int factor = 1;
+	if(msg->argc > 1 && msg->args[msg->argc - 1].type == 'i'){
+		factor = msg->args[msg->argc - 1].i;
+	}
+	if(factor < 1 || factor > 99){
+		factor = 1;
+	}
+
+	if(client->meter_until[bank] <= now){
+		client->meter_due[bank] = now;
+	}
+	client->meter_until[bank] = now + EMU_SUBSCRIPTION;
+	client->meter_factor[bank] = factor;
+}
+
+/**
+ * Sends the meter blobs that are due.
+ *
+ * Returns the due time of the next one, or -1 if there is no subscription
+ */
+static long long emuMeterPush(long long now){
+	long long next = -1;
+	char s_buf[BSIZE], address[16];
+
+	for(int i = 0; i < EMU_MAX_CLIENTS; i++){
+		struct emu_client *client = clients + i;
+		if(client->seen == 0){
+			continue;
+		}
+		for(int bank = 0; bank < METER_BANKS; bank++){
+			if(client->meter_until[bank] <= now){
+				continue;
+			}
+			if(client->meter_due[bank] <= now){
+				int count = meter_sizes[bank];
+				int a_len = snprintf(address, sizeof(address), "/meters/%i", bank);
+				int offset = round4(a_len + 1);
+				memset(s_buf, 0, offset);
+				memcpy(s_buf, address, a_len);
+				memcpy(s_buf + offset, ",b\0\0", 4);
+				uint32_t size = htonl(4 + 4 * count);
+				memcpy(s_buf + offset + 4, &size, 4);
+				offset += 8;
+
+				uint32_t le = htole32(count);
+				memcpy(s_buf + offset, &le, 4);
+				// slow moving levels, different for every meter
+				double t = now / 1e6;
+				for(int k = 0; k < count; k++){
+					float level = 0.5 + 0.45 * sin(t * 2 + k * 0.7);
+					uint32_t bits;
+					memcpy(&bits, &level, 4);
+					bits = htole32(bits);
+					memcpy(s_buf + offset + 4 + 4 * k, &bits, 4);
+				}
+				emuSend(&client->addr, s_buf, offset + 4 + 4 * count);
+				stats.meters++;
+				client->meter_due[bank] += EMU_METER_PERIOD * client->meter_factor[bank];
+				if(client->meter_due[bank] < now){
+					client->meter_due[bank] = now + EMU_METER_PERIOD * client->meter_factor[bank];
+				}
+			}
+			if(next < 0 || client->meter_due[bank] < next){
+				next = client->meter_due[bank];
+			}
+		}
+	}
+	return next;
+}
+
+static bool isAddress(const struct osc_message *msg, const char *address){
+	int len = strlen(address);
+	return msg->address.len == len && memcmp(msg->address.ptr, address, len) == 0;
+}
+
+static void emuMessage(struct emu_client *client, const char *buffer, int length, long long now){
+	struct osc_message msg;
+	if(oscDecode(buffer, length, &msg) < 0){
+		return;
+	}
+	stats.requests++;
+	client->requests++;
+	pacing = emuAdmit(client, now);
+	if(pacing < 0){
+		pacing = 0;
+		stats.limited++;
+		return;
+	}
+	stats.paced += pacing > 0;
+
+	char s_buf[BSIZE];
+	int s_len = -1;
+	if(isAddress(&msg, "/info")){
+		char *args[] = {"V2.07", "osc-server", "M32", "4.06"};
+		s_len = oscEncodeMessage(s_buf, BSIZE, "/info", "ssss", args);
+	}else if(isAddress(&msg, "/xinfo")){
+		char *args[] = {"127.0.0.1", "M32Emu", "M32", "4.06"};
+		s_len = oscEncodeMessage(s_buf, BSIZE, "/xinfo", "ssss", args);
+	}else if(isAddress(&msg, "/status")){
+		char *args[] = {"active", "127.0.0.1", "M32Emu"};
+		s_len = oscEncodeMessage(s_buf, BSIZE, "/status", "sss", args);
+	}else if(isAddress(&msg, "/xremote")){
+		client->xremote_until = now + EMU_SUBSCRIPTION;
+	}else if(isAddress(&msg, "/meters")){
+		emuMeters(client, &msg, now);
+	}else if(isAddress(&msg, "/node")){
+		if(msg.argc == 1 && msg.args[0].type == 's'){
+			emuNode(&client->addr, &msg.args[0].s);
+		}
+	}else{
+		int id = oscIndexLookup(msg.address.ptr, msg.address.len);
+		if(id >= 0 && msg.argc == 0){
+			stats.replies += emuSendValue(&client->addr, id);
+		}else if(id >= 0){
+			emuSet(client, id, msg.args, now);
+		}
+	}
+
+	if(s_len > 0){
+		emuSend(&client->addr, s_buf, s_len);
+		stats.replies++;
+	}
+	pacing = 0;
+}
+
+/**
+ * Handles one received datagram, a message or a bundle of messages.
+ */
+static void emuDatagram(const struct sockaddr_in *addr, const char *buffer, int length, long long now){
+	stats.received++;
+	if(options.loss > 0 && randomUnit() < options.loss){
+		stats.lost++;
+		return;
+	}
+	struct emu_client *client = emuClient(addr, now);
+
+	if(length < 16 || memcmp(buffer, "#bundle\0", 8) != 0){
+		emuMessage(client, buffer, length, now);
+		return;
+	}
+	// timetags are ignored, everything is "immediately"
+	for(int offset = 16; offset + 4 <= length;){
+		uint32_t size;
+		memcpy(&size, buffer + offset, 4);
+		size = ntohl(size);
+		if(size > (uint32_t)(length - offset - 4)){
+			break;
+		}
+		emuMessage(client, buffer + offset + 4, size, now);
+		offset += 4 + size;
+	}
+}
+
+/**
+ * Every leaf starts at a default value of its type, names are numbered.
+ */
+static int emuInitValues(void){
+	if(oscIndexInit() < 0){
+		return -1;
+	}
+	values = calloc(oscIndexCount(), sizeof(struct x32_value));
+	if(values == NULL){
+		return -1;
+	}
+	for(int id = 0; id < oscIndexCount(); id++){
+		char kind[8], number[8];
+		values[id].type = oscIndexType(id) != 0 ? oscIndexType(id) : 'i';
+		if(sscanf(oscIndexAddress(id), "/%7[a-z]/%7[0-9]/config/nam%c", kind, number, kind + 7) == 3){
+			kind[7] = '\0';
+			snprintf(values[id].s, X32_STRING_MAX, "%s%s", kind, number); // eg. "ch01"
+		}
+	}
+	return 0;
+}
+
+static void printStats(void){
+	int active = 0;
+	for(int i = 0; i < EMU_MAX_CLIENTS; i++){
+		active += clients[i].seen != 0;
+	}
+	fprintf(stderr, "clients %d  received %ld  requests %ld  replies %ld  pushes %ld  meters %ld  lost %ld  limited %ld  paced %ld  overflow %ld\n",
+			active, stats.received, stats.requests, stats.replies, stats.pushes, stats.meters, stats.lost, stats.limited, stats.paced, stats.overflow);
+}
+
+static void onSignal(int sig){
+	stop = 1;
+}
+
+static void usage(void){
+	fprintf(stderr, "usage: M32Emu [-p port] [-l latency ms] [-j jitter ms] [-d loss 0-1]\n"
+			"              [-r requests/s] [-R requests/s per client] [-P]\n"
+			"              [-s stats period s]\n");
+}
+
+int main(int argc, char **argv){
+	int opt;
+	while((opt = getopt(argc, argv, "p:l:j:d:r:R:Ps:h")) != -1){
+		switch(opt){
+		case 'p':
+			options.port = atoi(optarg);
+			break;
+		case 'l':
+			options.latency = atof(optarg) * 1000;
+			break;
+		case 'j':
+			options.jitter = atof(optarg) * 1000;
+			break;
+		case 'd':
+			options.loss = atof(optarg);
+			break;
+		case 'r':
+			options.rate = atof(optarg);
+			break;
+		case 'R':
+			options.client_rate = atof(optarg);
+			break;
+		case 'P':
+			options.pace = true;
+			break;
+		case 's':
+			options.stats_period = atoi(optarg);
+			break;
+		default:
+			usage();
+			return 1;
+		}
+	}
+
+	queue = malloc(EMU_QUEUE_SIZE * sizeof(struct emu_datagram));
+	if(queue == NULL || emuInitValues() < 0){
+		fprintf(stderr, "M32Emu: out of memory\n");
+		return 1;
+	}
+
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port = htons(options.port);
+	int buffer_size = 4 * 1024 * 1024;
+	if((fd = socket(PF_INET, SOCK_DGRAM, IPPROTO_UDP)) < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0){
+		perror("M32Emu");
+		return 1;
+	}
+	setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &buffer_size, sizeof(buffer_size));
+	setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &buffer_size, sizeof(buffer_size));
+
+	// the signals are only let in while waiting, so one cannot slip in
+	// between the test of stop and ppoll
+	sigset_t blocked, waiting;
+	sigemptyset(&blocked);
+	sigaddset(&blocked, SIGINT);
+	sigaddset(&blocked, SIGTERM);
+	sigprocmask(SIG_BLOCK, &blocked, &waiting);
+	signal(SIGINT, onSignal);
+	signal(SIGTERM, onSignal);
+	fprintf(stderr, "M32Emu: %d leaves on port %d\n", oscIndexCount(), options.port);
+
+	tokens = options.rate;
+	tokens_time = nowUs();
+	long long stats_due = options.stats_period > 0 ? nowUs() + options.stats_period * 1000000LL : LLONG_MAX;
+	struct pollfd pfd = {.fd = fd, .events = POLLIN};
+	char r_buf[BUNDLE_MTU]; // bundles are larger than BSIZE
+
+	while(!stop){
+		long long now = nowUs();
+		long long next = stats_due;
+		long long due = emuMeterPush(now);
+		if(due >= 0 && due < next){
+			next = due;
+		}
+		due = emuFlush(now);
+		if(due >= 0 && due < next){
+			next = due;
+		}
+		if(options.stats_period > 0 && now >= stats_due){
+			printStats();
+			stats_due = now + options.stats_period * 1000000LL;
+			continue;
+		}
+
+		long long wait = next > now ? next - now : 0;
+		struct timespec timeout = {wait / 1000000, (wait % 1000000) * 1000};
+		if(ppoll(&pfd, 1, &timeout, &waiting) <= 0){
+			continue;
+		}
+
+		now = nowUs();
+		for(;;){
+			struct sockaddr_in from;
+			socklen_t from_len = sizeof(from);
+			int r_len = recvfrom(fd, r_buf, BUNDLE_MTU, MSG_DONTWAIT, (struct sockaddr *)&from, &from_len);
+			if(r_len <= 0){
+				break;
+			}
+			emuDatagram(&from, r_buf, r_len, now);
+		}
+	}
+
+	printStats();
+	return 0;
+}
@@ -0,0 +1,1247 @@
+/*
+ * M32IO.c
+ *
+ * Request/response multiplexer. Every query registers a pending slot keyed
+ * by its OSC address before it is sent; every received message is matched
+ * against those slots and handed to the waiting request. Anything nobody
+ * asked for (/xremote updates, late replies, ...) goes to the callbacks
+ * subscribed to its address (M32Subscribe.c), or else to a subscriber
+ * queue, instead of being consumed by whichever getter happens to wait.
+ *
+ * Received data is pumped either by a dedicated I/O thread (X32StartIO) so
+ * any number of application threads can query concurrently, or, without
+ * the thread, by the waiting caller itself. Either way each wakeup drains
+ * every datagram waiting with X32RecvMany, a handful of recvmmsg calls
+ * rather than a poll and a recvfrom per datagram, into packets of the pool
+ * (M32Packet.c); the subscriber queue holds references to those packets.
+ *
+ * Round trip times of answered queries feed a smoothed estimator (SRTT and
+ * RTTVAR as in TCP, RFC 6298); X32Query and the pipeline time out after
+ * the resulting X32Timeout() instead of a fixed TIMEOUT and retransmit
+ * with exponential backoff. Replies to a retransmitted query that arrive
+ * after it completed are recognised and dropped instead of being queued
+ * as unsolicited messages.
+ *
+ * /node replies all come back as "node"; they are matched on the node
+ * path their text starts with, as if their address were "node/<path>".
+ *
+ * All of this state belongs to a session, one per console. Every function
+ * works on the calling thread's current session (X32Use), the default one
+ * unless the thread picked another, so code written for a single console
+ * drives any of them. An event loop (X32LoopRun) pumps the sockets of any
+ * number of sessions from one thread with epoll; each keeps its own slots,
+ * queue, timeout estimate and timers.
+ */
+#include "M32.h"
+
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/epoll.h>
+
+#define SLOT_FREE 0
+#define SLOT_PENDING 1
+
+#define IO_POLL 20 // ms between checks of the I/O thread stop flag
+#define ECHO_SLOTS 16 // retransmitted requests whose late replies are dropped
+#define LOOP_EVENTS 64 // sockets handled per epoll_wait
+#define LOOP_BATCH 32 // datagrams received from one socket per loop run
+
+struct x32_slot{
+	uint8_t state;
+	uint8_t transmissions; // queries sent for this slot
+	int seq; // bumped on every reuse, part of the slot id
+	int id; // node index leaf id, -1 if the address is not indexed
+	uint32_t hash;
+	char address[X32_ADDRESS_MAX];
+	long long sent; // monotonicUs() of the last transmission
+	x32_reply_cb callback;
+	void *ctx;
+};
+
+// replies still expected for a request that completed after a retransmission
+struct x32_echo{
+	int id;
+	uint32_t hash;
+	char address[X32_ADDRESS_MAX];
+	int copies;
+	long long expires; // monotonicUs()
+};
+
+// periodic job such as /xremote renewal
+struct x32_timer{
+	x32_timer_cb callback;
+	void *ctx;
+	int period;
+	long long due;
+};
+
+// One console: its socket and everything the multiplexer keeps for it
+struct x32_session{
+	struct x32_socket socket;
+
+	struct x32_slot slots[X32_MAX_PENDING];
+	int active[X32_MAX_PENDING]; // indices of pending slots, in submit order
+	int n_active;
+
+	struct x32_packet *queue[X32_QUEUE_SIZE]; // unsolicited, oldest dropped when full
+	int queue_head, queue_count;
+
+	struct x32_echo echoes[ECHO_SLOTS];
+	int echo_next;
+	bool echo_ambiguous; // set by echoRecord
+
+	// round trip estimator, in us
+	long long srtt, rttvar;
+	int rto_base; // ms, from the estimate alone
+	atomic_int rto; // ms, rto_base or backed off
+
+	pthread_mutex_t io_lock;
+	pthread_cond_t io_cond; // signalled on every dispatched message
+	unsigned io_generation;
+
+	pthread_t io_thread;
+	atomic_int io_running;
+	struct x32_loop *loop; // the event loop pumping the session, if any
+
+	struct x32_timer timers[X32_MAX_TIMERS];
+	pthread_mutex_t timer_lock;
+};
+
+// Event loop over the sockets of any number of sessions, see X32LoopRun
+struct x32_loop{
+	int fd; // epoll instance
+	pthread_t thread; // the thread running the loop
+	struct x32_session **sessions;
+	int count, size;
+};
+
+atomic_int X32_QUEUE_DROPPED = 0;
+atomic_int X32_DUPLICATES = 0;
+
+// used by threads that did not pick a session with X32Use
+static struct x32_session default_session;
+static pthread_once_t default_once = PTHREAD_ONCE_INIT;
+static _Thread_local struct x32_session *current;
+
+long long monotonicMs(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+long long monotonicUs(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void sessionInit(struct x32_session *s){
+	memset(s, 0, sizeof(struct x32_session));
+	s->socket.fd = -1;
+	s->socket.bundles = BUNDLE_AUTO;
+	s->srtt = -1;
+	s->rto_base = TIMEOUT;
+	atomic_init(&s->rto, TIMEOUT);
+
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&s->io_cond, &attr);
+	pthread_condattr_destroy(&attr);
+	pthread_mutex_init(&s->io_lock, NULL);
+	pthread_mutex_init(&s->timer_lock, NULL);
+}
+
+static void defaultInit(void){
+	sessionInit(&default_session);
+}
+
+/**
+ * Returns the session of the calling thread
+ */
+static struct x32_session *session(void){
+	if(current != NULL){
+		return current;
+	}
+	pthread_once(&default_once, defaultInit);
+	return &default_session;
+}
+
+/**
+ * Creates a session for another console; connect it with X32Connect
+ * after making it current with X32Use.
+ *
+ * Returns the session, or NULL if out of memory
+ */
+struct x32_session *X32SessionNew(void){
+	struct x32_session *s = malloc(sizeof(struct x32_session));
+	if(s != NULL){
+		sessionInit(s);
+	}
+	return s;
+}
+
+/**
+ * Closes a session created by X32SessionNew: takes it out of its event
+ * loop and stops its I/O thread, so that nothing dispatches to it anymore,
+ * then sends what its outbox holds, frees the outbox and the subscriptions
+ * and closes its socket. Pending requests are dropped without their
+ * callbacks.
+ */
+void X32SessionFree(struct x32_session *s){
+	if(s == NULL || s == &default_session){
+		return;
+	}
+	struct x32_session *previous = X32Use(s);
+	if(s->loop != NULL){
+		X32LoopRemove(s->loop, s);
+	}
+	X32StopIO();
+	X32OutboxFree();
+	X32UnsubscribeAll();
+	X32Use(previous == s ? NULL : previous);
+
+	if(s->socket.fd >= 0){
+		close(s->socket.fd);
+	}
+	for(int i = 0; i < s->queue_count; i++){
+		X32PacketRelease(s->queue[(s->queue_head + i) % X32_QUEUE_SIZE]);
+	}
+	pthread_cond_destroy(&s->io_cond);
+	pthread_mutex_destroy(&s->io_lock);
+	pthread_mutex_destroy(&s->timer_lock);
+	free(s);
+}
+
+/**
+ * Makes a session the current one of the calling thread: the session
+ * every other function of this file, and X32Connect, X32Send and X32Recv,
+ * work on.
+ * s: NULL for the default session
+ *
+ * Returns the previous current session
+ */
+struct x32_session *X32Use(struct x32_session *s){
+	struct x32_session *previous = session();
+	current = s;
+	return previous;
+}
+
+/**
+ * Returns the current session of the calling thread
+ */
+struct x32_session *X32Current(void){
+	return session();
+}
+
+/**
+ * Returns the socket of the current session
+ */
+struct x32_socket *X32Socket(void){
+	return &session()->socket;
+}
+
+static uint32_t addressHash(const char *address, int len){
+	uint32_t h = 2166136261u; // FNV-1a
+	for(int i = 0; i < len; i++){
+		h = (h ^ (uint8_t)address[i]) * 16777619u;
+	}
+	return h;
+}
+
+/**
+ * Releases a pending slot. io_lock must be held.
+ */
+static void slotRelease(struct x32_session *s, int index){
+	s->slots[index].state = SLOT_FREE;
+	for(int i = 0; i < s->n_active; i++){
+		if(s->active[i] == index){
+			memmove(s->active + i, s->active + i + 1, (s->n_active - i - 1) * sizeof(int));
+			s->n_active--;
+			break;
+		}
+	}
+}
+
+/**
+ * Looks up a slot id, io_lock must be held.
+ *
+ * Returns the slot index, or -1 if the id is stale (completed or cancelled)
+ */
+static int slotIndex(struct x32_session *s, int id){
+	if(id < 0){
+		return -1;
+	}
+	int index = id % X32_MAX_PENDING;
+	if(s->slots[index].state != SLOT_PENDING || s->slots[index].seq != id / X32_MAX_PENDING){
+		return -1;
+	}
+	return index;
+}
+
+/**
+ * Updates SRTT, RTTVAR and the retransmission timeout with a round trip
+ * time. Only queries sent once are sampled (Karn). io_lock must be held.
+ */
+static void rttSample(struct x32_session *s, long long sample){
+	if(s->srtt < 0){
+		s->srtt = sample;
+		s->rttvar = sample / 2;
+	}else{
+		s->rttvar = (3 * s->rttvar + llabs(s->srtt - sample)) / 4;
+		s->srtt = (7 * s->srtt + sample) / 8;
+	}
+	// 1 ms is the granularity of the waits
+	long long timeout = (s->srtt + (4 * s->rttvar > 1000 ? 4 * s->rttvar : 1000) + 999) / 1000;
+	s->rto_base = timeout < RTO_MIN ? RTO_MIN : timeout > RTO_MAX ? RTO_MAX : timeout;
+	s->rto = s->rto_base;
+}
+
+/**
+ * Looks up the echo entry of an address, io_lock must be held.
+ *
+ * Returns the entry index, or -1 if no late reply is expected
+ */
+static int echoFind(struct x32_session *s, int id, uint32_t hash, const struct osc_view *address, long long now){
+	for(int i = 0; i < ECHO_SLOTS; i++){
+		if(s->echoes[i].copies == 0 || s->echoes[i].expires < now){
+			continue;
+		}
+		if(id >= 0 ? s->echoes[i].id != id : s->echoes[i].id >= 0 || s->echoes[i].hash != hash || strncmp(s->echoes[i].address, address->ptr, address->len) != 0 || s->echoes[i].address[address->len] != '\0'){
+			continue;
+		}
+		return i;
+	}
+	return -1;
+}
+
+/**
+ * Accounts for the replies still on their way when a slot completes: one
+ * per extra transmission, plus those already expected for the address.
+ * If some were expected, the reply that completed the slot may have been
+ * one of them and must not be used as a round trip sample.
+ * io_lock must be held.
+ */
+static void echoRecord(struct x32_session *s, const struct x32_slot *slot, int id, uint32_t hash, const struct osc_view *address, long long now){
+	int i = echoFind(s, id, hash, address, now);
+	s->echo_ambiguous = i >= 0;
+	if(slot->transmissions == 1){
+		return; // nothing new on the way, an existing entry keeps its expiry
+	}
+	if(i < 0){
+		i = s->echo_next;
+		s->echo_next = (s->echo_next + 1) % ECHO_SLOTS;
+		s->echoes[i].id = slot->id;
+		s->echoes[i].hash = slot->hash;
+		strcpy(s->echoes[i].address, slot->address);
+		s->echoes[i].copies = 0;
+	}
+	s->echoes[i].copies += slot->transmissions - 1;
+	// the first copy was already late by a timeout when it was resent, if
+	// it does not show up within another one it is taken as lost
+	s->echoes[i].expires = now + 1000LL * s->rto_base;
+}
+
+/**
+ * Consumes an expected late reply, io_lock must be held.
+ *
+ * Returns true if the message is a duplicate to drop
+ */
+static bool echoMatch(struct x32_session *s, int id, uint32_t hash, const struct osc_view *address, long long now){
+	int i = echoFind(s, id, hash, address, now);
+	if(i < 0){
+		return false;
+	}
+	s->echoes[i].copies--;
+	return true;
+}
+
+/**
+ * Builds the matching address of a /node reply, "node" followed by the
+ * node path at the start of its text.
+ * key: at least X32_ADDRESS_MAX bytes
+ *
+ * Returns the key length, or -1 if the message is not a /node reply
+ */
+static int nodeKey(const struct osc_message *msg, char *key){
+	if(msg->address.len != 4 || memcmp(msg->address.ptr, "node", 4) != 0 || msg->argc < 1 || msg->args[0].type != 's'){
+		return -1;
+	}
+	const char *text = msg->args[0].s.ptr;
+	int len = 0;
+	while(len < msg->args[0].s.len && text[len] != ' ' && text[len] != '\n'){
+		len++;
+	}
+	if(len == 0 || text[0] != '/' || len + 4 >= X32_ADDRESS_MAX){
+		return -1;
+	}
+	memcpy(key, "node", 4);
+	memcpy(key + 4, text, len);
+	key[len + 4] = '\0';
+	return len + 4;
+}
+
+/**
+ * Hands a message received from the current session's console to the
+ * oldest pending slot with the same address, or to the subscriber queue
+ * if there is none. The queue takes a reference to the packet, the
+ * caller keeps its own.
+ */
+void X32DispatchPacket(struct x32_packet *packet){
+	char *buffer = packet->data;
+	int length = packet->length;
+	struct osc_message msg;
+	if(oscDecode(buffer, length, &msg) < 0){
+		metricCount(METRIC_PARSE_ERRORS, 1);
+		return;
+	}
+	// indexed addresses match by leaf id, others by hash and string
+	int id = oscIndexLookup(msg.address.ptr, msg.address.len);
+	char node_key[X32_ADDRESS_MAX];
+	struct osc_view address = msg.address;
+	int key_len = id < 0 ? nodeKey(&msg, node_key) : -1;
+	if(key_len > 0){
+		address.ptr = node_key;
+		address.len = key_len;
+	}
+	uint32_t hash = id < 0 ? addressHash(address.ptr, address.len) : 0;
+	long long now = monotonicUs();
+	struct x32_session *s = session();
+
+	pthread_mutex_lock(&s->io_lock);
+	// replies and pushed updates alike keep the state mirror current
+	if(id >= 0){
+		X32CacheApply(id, &msg);
+	}else if(X32MetersApply(&msg) >= 0){
+		X32_TRACE(TRACE_RECV, buffer, length, -1);
+		goto done; // meter blobs go to their own ring, never to the queue
+	}
+	for(int i = 0; i < s->n_active; i++){
+		struct x32_slot *slot = s->slots + s->active[i];
+		if(id >= 0 ? slot->id != id : slot->id >= 0 || slot->hash != hash || strncmp(slot->address, address.ptr, address.len) != 0 || slot->address[address.len] != '\0'){
+			continue;
+		}
+		echoRecord(s, slot, id, hash, &address, now);
+		if(slot->transmissions == 1 && !s->echo_ambiguous){
+			rttSample(s, now - slot->sent);
+		}else if(slot->transmissions == 1){
+			// no sample, but the link answers again: undo one backoff step
+			s->rto = s->rto / 2 > s->rto_base ? s->rto / 2 : s->rto_base;
+		}
+		X32_TRACE(TRACE_RECV, buffer, length, now - slot->sent);
+		metricLatency(METRIC_RTT, metricClass(slot->address, strlen(slot->address)), now - slot->sent);
+		x32_reply_cb callback = slot->callback;
+		void *ctx = slot->ctx;
+		slotRelease(s, s->active[i]);
+		callback(&msg, buffer, length, ctx);
+		goto done;
+	}
+	X32_TRACE(TRACE_RECV, buffer, length, -1);
+	if(echoMatch(s, id, hash, &address, now)){
+		X32_DUPLICATES++;
+		goto done;
+	}
+
+	// unsolicited: to the subscriptions matching it, or to the queue
+	metricCount(METRIC_UNSOLICITED, 1);
+	if(X32SubscriptionsApply(id, &msg, buffer, length) > 0){
+		goto done;
+	}
+	int tail = (s->queue_head + s->queue_count) % X32_QUEUE_SIZE;
+	if(s->queue_count == X32_QUEUE_SIZE){
+		X32PacketRelease(s->queue[s->queue_head]);
+		s->queue_head = (s->queue_head + 1) % X32_QUEUE_SIZE;
+		X32_QUEUE_DROPPED++;
+	}else{
+		s->queue_count++;
+	}
+	s->queue[tail] = X32PacketRetain(packet);
+
+done:
+	s->io_generation++;
+	pthread_cond_broadcast(&s->io_cond);
+	pthread_mutex_unlock(&s->io_lock);
+}
+
+/**
+ * As X32DispatchPacket, for a message received in a buffer of the caller;
+ * it is copied into a packet.
+ */
+void X32Dispatch(char *buffer, int length){
+	struct x32_packet *packet = X32PacketAlloc();
+	if(packet == NULL || length < 0 || length > PACKET_SIZE){
+		X32PacketRelease(packet);
+		return;
+	}
+	memcpy(packet->data, buffer, length);
+	packet->length = length;
+	X32DispatchPacket(packet);
+	X32PacketRelease(packet);
+}
+
+/**
+ * Registers a pending slot for a reply to address without sending anything,
+ * for replies triggered by some other message (eg. a bundle).
+ * callback: called once with the decoded reply, from the thread that pumps
+ *           the socket and with the multiplexer locked; it must not block
+ *           or call back into the multiplexer. Its buffer is the data of a
+ *           packet, which X32PacketRetain(X32PacketOf(buffer)) keeps
+ *           without a copy
+ *
+ * Returns the slot id, or -1 if the address is too long or all slots are taken
+ */
+int X32Expect(const char *address, x32_reply_cb callback, void *ctx){
+	int len = strlen(address);
+	if(len >= X32_ADDRESS_MAX){
+		return -1;
+	}
+
+	struct x32_session *s = session();
+	pthread_mutex_lock(&s->io_lock);
+	int id = -1;
+	for(int i = 0; i < X32_MAX_PENDING; i++){
+		struct x32_slot *slot = s->slots + i;
+		if(slot->state != SLOT_FREE){
+			continue;
+		}
+		slot->state = SLOT_PENDING;
+		slot->transmissions = 1;
+		slot->sent = monotonicUs();
+		slot->seq = (slot->seq + 1) % (INT_MAX / X32_MAX_PENDING);
+		slot->id = oscIndexLookup(address, len);
+		slot->hash = slot->id < 0 ? addressHash(address, len) : 0;
+		memcpy(slot->address, address, len + 1);
+		slot->callback = callback;
+		slot->ctx = ctx;
+		s->active[s->n_active++] = i;
+		id = slot->seq * X32_MAX_PENDING + i;
+		break;
+	}
+	pthread_mutex_unlock(&s->io_lock);
+	return id;
+}
+
+/**
+ * Registers a pending slot for address and sends the query.
+ *
+ * Returns the slot id, or -1 on error
+ */
+int X32Submit(const char *address, x32_reply_cb callback, void *ctx){
+	int id = X32Expect(address, callback, ctx);
+	if(id < 0){
+		return -1;
+	}
+	if(generateAndSendMessage((char *)address) < 0){
+		X32Cancel(id);
+		return -1;
+	}
+	return id;
+}
+
+/**
+ * X32Submit for a node index leaf: the query is built from the leaf's
+ * pre-encoded address.
+ *
+ * Returns the slot id, or -1 on error
+ */
+int X32SubmitId(int id, x32_reply_cb callback, void *ctx){
+	char message[X32_ADDRESS_MAX + 4];
+	int length = oscEncodeIdQuery(message, sizeof(message), id);
+	if(length < 0){
+		return -1;
+	}
+
+	int slot = X32Expect(oscIndexAddress(id), callback, ctx);
+	if(slot < 0){
+		return -1;
+	}
+	if(X32Send(message, length) < 0){
+		X32Cancel(slot);
+		return -1;
+	}
+	return slot;
+}
+
+/**
+ * Registers a pending slot for the /node reply of a node and sends the
+ * /node query, see M32Node.c.
+ * path: node path, eg. "ch/01/gate"
+ *
+ * Returns the slot id, or -1 on error
+ */
+int X32SubmitNode(const char *path, x32_reply_cb callback, void *ctx){
+	char key[X32_ADDRESS_MAX];
+	char message[X32_ADDRESS_MAX + 16];
+
+	while(*path == '/'){
+		path++;
+	}
+	if(snprintf(key, sizeof(key), "node/%s", path) >= (int)sizeof(key)){
+		return -1;
+	}
+	int length = oscEncodeString(message, sizeof(message), "/node", path);
+	if(length < 0){
+		return -1;
+	}
+
+	int slot = X32Expect(key, callback, ctx);
+	if(slot < 0){
+		return -1;
+	}
+	if(X32Send(message, length) < 0){
+		X32Cancel(slot);
+		return -1;
+	}
+	return slot;
+}
+
+/**
+ * Sends the query of a still pending slot again.
+ *
+ * Returns response from X32Send, or -1 if the slot is no longer pending
+ */
+int X32Resend(int id){
+	char address[X32_ADDRESS_MAX];
+	char message[X32_ADDRESS_MAX + 4];
+	struct x32_session *s = session();
+
+	pthread_mutex_lock(&s->io_lock);
+	int index = slotIndex(s, id);
+	int leaf = -1;
+	if(index >= 0){
+		leaf = s->slots[index].id;
+		strcpy(address, s->slots[index].address);
+		if(s->slots[index].transmissions < UINT8_MAX){
+			s->slots[index].transmissions++;
+		}
+		// back off to twice the wait that just expired until a query sent
+		// once is answered again (Karn)
+		long long now = monotonicUs();
+		long long backoff = (now - s->slots[index].sent) / 500;
+		if(s->rto < backoff){
+			s->rto = backoff < RTO_MAX ? backoff : RTO_MAX;
+		}
+		s->slots[index].sent = now;
+	}
+	pthread_mutex_unlock(&s->io_lock);
+
+	if(index < 0){
+		return -1;
+	}
+	metricCount(METRIC_RETRANSMITS, 1);
+	if(leaf >= 0){
+		return X32Send(message, oscEncodeIdQuery(message, sizeof(message), leaf));
+	}
+	if(strncmp(address, "node/", 5) == 0){
+		char node[X32_ADDRESS_MAX + 16];
+		return X32Send(node, oscEncodeString(node, sizeof(node), "/node", address + 5));
+	}
+	return generateAndSendMessage(address);
+}
+
+/**
+ * Drops a pending slot; its callback will not be called anymore.
+ *
+ * Returns 1 if the slot was still pending, 0 if it already completed
+ */
+int X32Cancel(int id){
+	struct x32_session *s = session();
+
+	pthread_mutex_lock(&s->io_lock);
+	int index = slotIndex(s, id);
+	if(index >= 0){
+		slotRelease(s, index);
+	}
+	pthread_mutex_unlock(&s->io_lock);
+	return index >= 0;
+}
+
+/**
+ * Waits until a message has been dispatched since *generation was taken,
+ * or until timeout ms have passed. Without an I/O thread or an event loop
+ * run by another thread, the caller receives and dispatches the messages
+ * waiting itself.
+ * generation: last value seen, updated on return; start with 0
+ *
+ * Returns 1 if something was dispatched, 0 on timeout, -1 on polling error
+ */
+int X32Wait(unsigned *generation, int timeout){
+	struct x32_session *s = session();
+
+	pthread_mutex_lock(&s->io_lock);
+	bool pumped = s->io_running || (s->loop != NULL && !pthread_equal(s->loop->thread, pthread_self()));
+	pthread_mutex_unlock(&s->io_lock);
+	if(!pumped){
+		X32Service();
+
+		struct x32_packet *packets[BATCH_MAX];
+		int n = X32RecvMany(packets, BATCH_MAX, timeout);
+		for(int i = 0; i < n; i++){
+			X32DispatchPacket(packets[i]);
+			X32PacketRelease(packets[i]);
+		}
+		return n < 0 ? -1 : n > 0;
+	}
+
+	struct timespec until;
+	clock_gettime(CLOCK_MONOTONIC, &until);
+	until.tv_sec += timeout / 1000;
+	until.tv_nsec += (timeout % 1000) * 1000000L;
+	if(until.tv_nsec >= 1000000000L){
+		until.tv_sec++;
+		until.tv_nsec -= 1000000000L;
+	}
+
+	pthread_mutex_lock(&s->io_lock);
+	int res = 1;
+	while(s->io_generation == *generation && (s->io_running || s->loop != NULL)){
+		if(pthread_cond_timedwait(&s->io_cond, &s->io_lock, &until) != 0){
+			res = 0;
+			break;
+		}
+	}
+	*generation = s->io_generation;
+	pthread_mutex_unlock(&s->io_lock);
+	return res;
+}
+
+struct x32_request{
+	char *buffer;
+	int length;
+	int done;
+};
+
+static void requestReply(const struct osc_message *msg, const char *buffer, int length, void *ctx){
+	struct x32_request *req = ctx;
+	req->length = length < BSIZE ? length : BSIZE;
+	memcpy(req->buffer, buffer, req->length);
+	req->done = 1;
+}
+
+/**
+ * Waits up to timeout ms for the reply registered for req.
+ *
+ * Returns 1 when it arrived, 0 on timeout, -1 on polling error
+ */
+static int requestPoll(struct x32_request *req, int timeout){
+	long long deadline = monotonicMs() + timeout;
+	unsigned generation = 0;
+	struct x32_session *s = session();
+
+	for(;;){
+		pthread_mutex_lock(&s->io_lock);
+		int done = req->done;
+		pthread_mutex_unlock(&s->io_lock);
+		if(done){
+			return 1;
+		}
+
+		long long left = deadline - monotonicMs();
+		if(left <= 0){
+			return 0;
+		}
+		if(X32Wait(&generation, left) < 0){
+			return -1;
+		}
+	}
+}
+
+/**
+ * Waits for the reply registered in slot id and copies it to buffer, then
+ * drops the slot if it did not complete.
+ *
+ * Returns the reply length, 0 on timeout, -1 on polling error
+ */
+static int requestWait(int id, struct x32_request *req, int timeout){
+	int res = requestPoll(req, timeout);
+	if(res != 1 && !X32Cancel(id)){
+		return req->length; // completed while giving up
+	}
+	return res < 0 ? -1 : req->length;
+}
+
+/**
+ * Sends a query and waits for the reply with the same address; other
+ * messages received meanwhile are dispatched to their own requests or
+ * to the subscriber queue.
+ * buffer: at least BSIZE bytes to receive the reply
+ * timeout: time in ms to wait before failing
+ *
+ * Returns the reply length, 0 on timeout, -1 on error
+ */
+int X32Request(char *address, char *buffer, int timeout){
+	struct x32_request req = {buffer, 0, 0};
+
+	int id = X32Submit(address, requestReply, &req);
+	if(id < 0){
+		return -1;
+	}
+	return requestWait(id, &req, timeout);
+}
+
+/**
+ * As X32Request, but waits for a reply to address triggered by the
+ * message already encoded in message (eg. a query wrapped in a bundle).
+ *
+ * Returns the reply length, 0 on timeout, -1 on error
+ */
+int X32RequestWith(char *address, char *message, int length, char *buffer, int timeout){
+	struct x32_request req = {buffer, 0, 0};
+
+	int id = X32Expect(address, requestReply, &req);
+	if(id < 0){
+		return -1;
+	}
+	if(X32Send(message, length) < 0){
+		X32Cancel(id);
+		return -1;
+	}
+	return requestWait(id, &req, timeout);
+}
+
+/**
+ * Returns the current retransmission timeout in ms, derived from the
+ * measured round trip times; TIMEOUT until the first reply
+ */
+int X32Timeout(void){
+	return session()->rto;
+}
+
+/**
+ * Sends a query and waits for the reply with the same address, resending
+ * it up to X32_RETRIES times. The first wait is X32Timeout(), and each
+ * retransmission doubles it.
+ * buffer: at least BSIZE bytes to receive the reply
+ * length: receives the reply length
+ *
+ * Returns X32_OK, or the error
+ */
+enum x32_status X32Query(const char *address, char *buffer, int *length){
+	struct x32_request req = {buffer, 0, 0};
+	enum x32_status status = X32_TIMEOUT;
+
+	int id = X32Expect(address, requestReply, &req);
+	if(id < 0){
+		return X32_NO_SLOT;
+	}
+	if(generateAndSendMessage((char *)address) < 0){
+		X32Cancel(id);
+		return X32_IO_ERROR;
+	}
+
+	int timeout = X32Timeout();
+	for(int tries = 0; ; tries++){
+		int res = requestPoll(&req, timeout);
+		if(res == 1){
+			status = X32_OK;
+			break;
+		}
+		if(res < 0){
+			status = X32_IO_ERROR;
+			break;
+		}
+		if(tries == X32_RETRIES){
+			break;
+		}
+		if(X32Resend(id) < 0){
+			break; // completed meanwhile, or a send error
+		}
+		timeout = timeout * 2 < RTO_MAX ? timeout * 2 : RTO_MAX;
+	}
+
+	if(status != X32_OK && !X32Cancel(id)){
+		status = X32_OK; // completed while giving up
+	}
+	if(status == X32_TIMEOUT){
+		metricCount(METRIC_TIMEOUTS, 1);
+	}
+	*length = req.length;
+	return status;
+}
+
+/**
+ * Returns a short description of a status
+ */
+const char *X32StatusString(enum x32_status status){
+	switch(status){
+	case X32_OK:
+		return "ok";
+	case X32_TIMEOUT:
+		return "no reply";
+	case X32_IO_ERROR:
+		return "socket error";
+	case X32_TYPE_ERROR:
+		return "unexpected reply type";
+	case X32_NO_SLOT:
+		return "too many pending requests";
+	}
+	return "unknown status";
+}
+
+/**
+ * Pops the oldest unsolicited message, waiting up to timeout ms for one.
+ * packet: receives it, with the queue's reference
+ *
+ * Returns 1 if there was one, 0 on timeout, -1 on polling error
+ */
+static int queuePop(int timeout, struct x32_packet **packet){
+	long long deadline = monotonicMs() + timeout;
+	unsigned generation = 0;
+	struct x32_session *s = session();
+
+	for(;;){
+		pthread_mutex_lock(&s->io_lock);
+		*packet = NULL;
+		if(s->queue_count > 0){
+			*packet = s->queue[s->queue_head];
+			s->queue_head = (s->queue_head + 1) % X32_QUEUE_SIZE;
+			s->queue_count--;
+		}
+		pthread_mutex_unlock(&s->io_lock);
+		if(*packet != NULL){
+			return 1;
+		}
+
+		long long left = deadline - monotonicMs();
+		if(left <= 0){
+			return 0;
+		}
+		if(X32Wait(&generation, left) < 0){
+			return -1;
+		}
+	}
+}
+
+/**
+ * Pops the oldest unsolicited message (one no request was waiting for).
+ * buffer: at least BSIZE bytes, longer messages are truncated (see
+ *         X32NextPacket)
+ * timeout: time in ms to wait for one if the queue is empty
+ *
+ * Returns the message length, 0 on timeout, -1 on polling error
+ */
+int X32NextMessage(char *buffer, int timeout){
+	struct x32_packet *packet;
+	int res = queuePop(timeout, &packet);
+	if(res <= 0){
+		return res;
+	}
+	int length = packet->length < BSIZE ? packet->length : BSIZE;
+	memcpy(buffer, packet->data, length);
+	X32PacketRelease(packet);
+	return length;
+}
+
+/**
+ * As X32NextMessage, without copying: the message is handed over in its
+ * packet, whole.
+ *
+ * Returns the packet, to be released with X32PacketRelease, or NULL on
+ * timeout or polling error
+ */
+struct x32_packet *X32NextPacket(int timeout){
+	struct x32_packet *packet;
+	return queuePop(timeout, &packet) > 0 ? packet : NULL;
+}
+
+/**
+ * Returns when the next timer of a session is due, LLONG_MAX if it has none
+ */
+static long long timerNext(struct x32_session *s){
+	long long due = LLONG_MAX;
+	pthread_mutex_lock(&s->timer_lock);
+	for(int i = 0; i < X32_MAX_TIMERS; i++){
+		if(s->timers[i].callback != NULL && s->timers[i].due < due){
+			due = s->timers[i].due;
+		}
+	}
+	pthread_mutex_unlock(&s->timer_lock);
+	return due;
+}
+
+static void *ioThread(void *arg){
+	struct x32_session *s = arg;
+	struct x32_packet *packets[BATCH_MAX];
+
+	X32Use(s);
+	while(s->io_running){
+		long long wait = timerNext(s) - monotonicMs();
+		int n = X32RecvMany(packets, BATCH_MAX, wait < 0 ? 0 : wait < IO_POLL ? wait : IO_POLL);
+		for(int i = 0; i < n; i++){
+			X32DispatchPacket(packets[i]);
+			X32PacketRelease(packets[i]);
+		}
+		X32Service();
+	}
+	return NULL;
+}
+
+/**
+ * Starts the I/O thread of the current session, which from now on owns
+ * reception on its socket. Call after X32Connect.
+ *
+ * Returns 0 on success, -1 on error or if an event loop pumps the session
+ */
+int X32StartIO(void){
+	struct x32_session *s = session();
+	if(s->io_running){
+		return 0;
+	}
+	if(s->loop != NULL){
+		return -1;
+	}
+	s->io_running = 1;
+	if(pthread_create(&s->io_thread, NULL, ioThread, s) != 0){
+		s->io_running = 0;
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Stops the I/O thread; callers pump the socket themselves again.
+ */
+void X32StopIO(void){
+	struct x32_session *s = session();
+	if(!s->io_running){
+		return;
+	}
+	s->io_running = 0;
+	pthread_join(s->io_thread, NULL);
+
+	// wake waiters so they switch to pumping themselves
+	pthread_mutex_lock(&s->io_lock);
+	s->io_generation++;
+	pthread_cond_broadcast(&s->io_cond);
+	pthread_mutex_unlock(&s->io_lock);
+}
+
+/**
+ * Takes the subscription table out of the current session with the
+ * multiplexer locked: X32SubscriptionsApply runs under the same lock, so
+ * once this returns no dispatch uses the table anymore and it may be freed.
+ *
+ * Returns the table, NULL if there was none
+ */
+struct x32_subscriptions *X32SubscriptionsTake(void){
+	struct x32_session *s = session();
+	pthread_mutex_lock(&s->io_lock);
+	struct x32_subscriptions *table = atomic_exchange(&s->socket.subscriptions, NULL);
+	pthread_mutex_unlock(&s->io_lock);
+	return table;
+}
+
+/**
+ * Registers a job of the current session run every period ms by
+ * X32Service(), ie. from the I/O thread or the event loop, or from callers
+ * waiting on a reply when there is neither. The first run is one period
+ * from now; the callback runs with the session current.
+ * callback: must not block, sending is fine
+ *
+ * Returns the timer id, or -1 if all X32_MAX_TIMERS are in use
+ */
+int X32Every(int period, x32_timer_cb callback, void *ctx){
+	struct x32_session *s = session();
+	int id = -1;
+	pthread_mutex_lock(&s->timer_lock);
+	for(int i = 0; i < X32_MAX_TIMERS; i++){
+		if(s->timers[i].callback == NULL){
+			s->timers[i].callback = callback;
+			s->timers[i].ctx = ctx;
+			s->timers[i].period = period;
+			s->timers[i].due = monotonicMs() + period;
+			id = i;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&s->timer_lock);
+	return id;
+}
+
+/**
+ * Removes a timer registered with X32Every.
+ */
+void X32CancelTimer(int id){
+	if(id < 0 || id >= X32_MAX_TIMERS){
+		return;
+	}
+	struct x32_session *s = session();
+	pthread_mutex_lock(&s->timer_lock);
+	s->timers[id].callback = NULL;
+	pthread_mutex_unlock(&s->timer_lock);
+}
+
+/**
+ * Runs the timers of the current session that are due. Applications that
+ * neither run the I/O thread or an event loop nor wait on replies
+ * regularly should call this themselves.
+ */
+void X32Service(void){
+	struct x32_session *s = session();
+	long long now = monotonicMs();
+
+	for(int i = 0; i < X32_MAX_TIMERS; i++){
+		pthread_mutex_lock(&s->timer_lock);
+		x32_timer_cb callback = s->timers[i].callback;
+		void *ctx = s->timers[i].ctx;
+		int due = callback != NULL && s->timers[i].due <= now;
+		if(due){
+			s->timers[i].due = now + s->timers[i].period;
+		}
+		pthread_mutex_unlock(&s->timer_lock);
+
+		if(due){
+			callback(ctx);
+		}
+	}
+}
+
+/**
+ * Creates an event loop. It belongs to the calling thread, the only one
+ * that may run it; other threads can still query its sessions, their
+ * waits are then served by the loop.
+ *
+ * Returns the loop, or NULL on error
+ */
+struct x32_loop *X32LoopNew(void){
+	struct x32_loop *loop = calloc(1, sizeof(struct x32_loop));
+	if(loop == NULL){
+		return NULL;
+	}
+	if((loop->fd = epoll_create1(EPOLL_CLOEXEC)) < 0){
+		free(loop);
+		return NULL;
+	}
+	loop->thread = pthread_self();
+	return loop;
+}
+
+/**
+ * Takes the sessions out of a loop and frees it.
+ */
+void X32LoopFree(struct x32_loop *loop){
+	if(loop == NULL){
+		return;
+	}
+	while(loop->count > 0){
+		X32LoopRemove(loop, loop->sessions[loop->count - 1]);
+	}
+	close(loop->fd);
+	free(loop->sessions);
+	free(loop);
+}
+
+/**
+ * Adds a connected session to a loop, which from now on pumps its socket
+ * and runs its timers.
+ *
+ * Returns 0 on success, -1 on error or if the session already has an I/O
+ * thread or a loop
+ */
+int X32LoopAdd(struct x32_loop *loop, struct x32_session *s){
+	if(s == NULL){
+		s = session();
+	}
+	if(s->io_running || s->loop != NULL || s->socket.fd < 0){
+		return -1;
+	}
+	if(loop->count == loop->size){
+		int size = loop->size ? 2 * loop->size : 4;
+		struct x32_session **sessions = realloc(loop->sessions, size * sizeof(struct x32_session *));
+		if(sessions == NULL){
+			return -1;
+		}
+		loop->sessions = sessions;
+		loop->size = size;
+	}
+
+	struct epoll_event event = {.events = EPOLLIN, .data.ptr = s};
+	if(epoll_ctl(loop->fd, EPOLL_CTL_ADD, s->socket.fd, &event) < 0){
+		return -1;
+	}
+	loop->sessions[loop->count++] = s;
+	pthread_mutex_lock(&s->io_lock);
+	s->loop = loop;
+	pthread_mutex_unlock(&s->io_lock);
+	return 0;
+}
+
+/**
+ * Takes a session out of its loop; callers pump its socket themselves
+ * again.
+ *
+ * Returns 0 on success, -1 if the session is not in the loop
+ */
+int X32LoopRemove(struct x32_loop *loop, struct x32_session *s){
+	if(s == NULL){
+		s = session();
+	}
+	int i = 0;
+	while(i < loop->count && loop->sessions[i] != s){
+		i++;
+	}
+	if(i == loop->count){
+		return -1;
+	}
+	loop->sessions[i] = loop->sessions[--loop->count];
+	epoll_ctl(loop->fd, EPOLL_CTL_DEL, s->socket.fd, NULL);
+
+	// wake waiters so they switch to pumping themselves
+	pthread_mutex_lock(&s->io_lock);
+	s->loop = NULL;
+	s->io_generation++;
+	pthread_cond_broadcast(&s->io_cond);
+	pthread_mutex_unlock(&s->io_lock);
+	return 0;
+}
+
+/**
+ * Runs one round of a loop: waits until a socket of its sessions is
+ * readable, a timer is due or timeout ms have passed, then dispatches what
+ * arrived, up to LOOP_BATCH datagrams per session, and runs the due
+ * timers. Callbacks run with their session current.
+ * timeout: negative to wait for traffic or a timer only
+ *
+ * Returns the number of messages dispatched, or -1 on error
+ */
+int X32LoopRun(struct x32_loop *loop, int timeout){
+	struct epoll_event events[LOOP_EVENTS];
+	long long now = monotonicMs();
+	long long next = timeout < 0 ? LLONG_MAX : now + timeout;
+
+	for(int i = 0; i < loop->count; i++){
+		long long due = timerNext(loop->sessions[i]);
+		next = due < next ? due : next;
+	}
+	int wait = next == LLONG_MAX ? -1 : next <= now ? 0 : next - now > INT_MAX ? INT_MAX : (int)(next - now);
+
+	int ready = epoll_wait(loop->fd, events, LOOP_EVENTS, wait);
+	if(ready < 0 && errno != EINTR){
+		return -1;
+	}
+
+	struct x32_session *previous = X32Use(NULL);
+	struct x32_packet *packets[LOOP_BATCH];
+	int dispatched = 0;
+	for(int i = 0; i < ready; i++){
+		X32Use(events[i].data.ptr);
+		int n = X32RecvMany(packets, LOOP_BATCH, 0);
+		for(int k = 0; k < n; k++){
+			X32DispatchPacket(packets[k]);
+			X32PacketRelease(packets[k]);
+		}
+		dispatched += n > 0 ? n : 0;
+	}
+	for(int i = 0; i < loop->count; i++){
+		X32Use(loop->sessions[i]);
+		X32Service();
+	}
+	X32Use(previous);
+	return dispatched;
+}
@@ -0,0 +1,381 @@
+/*
+ * M32Index.c
+ *
+ * Flat index of the OSC node tree. Every leaf of the tree gets a dense
+ * integer id, in tree walk order, so per-parameter state can live in plain
+ * arrays, and is stored pre-encoded: the address with its null and OSC
+ * padding, ready to be copied into a message.
+ *
+ * Incoming addresses are mapped to their id through a perfect hash built
+ * once from the static node tables (hash and displace): the address is
+ * hashed once, a per-bucket displacement picks a slot that no other leaf
+ * uses, and a single compare confirms the match. No snprintf to build
+ * addresses and no strcmp chains to recognise them.
+ */
+#include "M32.h"
+
+#include <string.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+
+#include <stdio.h>
+
+#define BUCKET_LOAD 4 // average leaves per displacement bucket
+#define MAX_DISPLACEMENT 1000000
+
+static int leaf_count;
+static char *encoded; // padded addresses, one after the other by id
+static int *encoded_offset; // id -> offset in encoded, leaf_count + 1 entries
+static uint8_t *address_len; // id -> strlen(address)
+static char *types; // id -> OSC type tag of the value
+static const struct osc_format **formats; // id -> format of the value, NULL if none
+
+static uint32_t *displacement; // bucket -> displacement
+static int *slot_ids; // slot -> leaf id, -1 when empty
+static int n_buckets, n_slots;
+
+static pthread_once_t index_once = PTHREAD_ONCE_INIT;
+static int index_status = -1;
+
+static uint64_t indexHash(const char *address, int len){
+	uint64_t h = 14695981039346656037ull; // FNV-1a
+	for(int i = 0; i < len; i++){
+		h = (h ^ (uint8_t)address[i]) * 1099511628211ull;
+	}
+	return h;
+}
+
+// murmur3 finalizer, spreads a displaced hash over the slots
+static uint32_t mix32(uint32_t h){
+	h ^= h >> 16;
+	h *= 0x85ebca6b;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35;
+	h ^= h >> 16;
+	return h;
+}
+
+static int hashBucket(uint64_t h){
+	return (h >> 32) % n_buckets;
+}
+
+static int hashSlot(uint64_t h, uint32_t d){
+	return mix32((uint32_t)h ^ d) % n_slots;
+}
+
+/**
+ * Walks the tree below node as walkTree() does. Counts the leaves and the
+ * size of their padded addresses, or stores them once encoded is allocated.
+ */
+static void indexWalk(char *string, int offset, const osc_node_t *node, int *pool){
+	int add = strlen(node->label) + 1;
+	if(offset + add >= X32_ADDRESS_MAX){
+		return;
+	}
+	snprintf(string+offset, add+1, "/%s", node->label);
+
+	if(node->no_children == 0){
+		int len = offset + add;
+		if(encoded != NULL){
+			encoded_offset[leaf_count] = *pool;
+			memset(encoded + *pool, 0, round4(len + 1));
+			memcpy(encoded + *pool, string, len);
+			address_len[leaf_count] = len;
+			types[leaf_count] = node->type;
+			formats[leaf_count] = node->format;
+		}
+		*pool += round4(len + 1);
+		leaf_count++;
+	}
+
+	for(int i = 0; i < node->no_children; i++){
+		indexWalk(string, offset + add, node->children + i, pool);
+	}
+}
+
+/**
+ * Finds a displacement for every bucket so all leaves land in distinct
+ * slots, biggest buckets first.
+ *
+ * Returns 0 on success, -1 if no displacement was found
+ */
+static int indexPerfectHash(void){
+	int res = -1;
+	uint64_t *hashes = malloc(leaf_count * sizeof(uint64_t));
+	int *order = malloc(leaf_count * sizeof(int)); // ids sorted by bucket
+	int *bucket_start = calloc(n_buckets + 1, sizeof(int));
+	int *buckets_by_size = malloc(n_buckets * sizeof(int));
+	int *taken = malloc(BUCKET_LOAD * 8 * sizeof(int));
+	if(hashes == NULL || order == NULL || bucket_start == NULL || buckets_by_size == NULL || taken == NULL){
+		goto done;
+	}
+
+	// counting sort of the leaves by bucket
+	for(int id = 0; id < leaf_count; id++){
+		hashes[id] = indexHash(encoded + encoded_offset[id], address_len[id]);
+		bucket_start[hashBucket(hashes[id]) + 1]++;
+	}
+	for(int b = 0; b < n_buckets; b++){
+		bucket_start[b + 1] += bucket_start[b];
+	}
+	for(int id = 0; id < leaf_count; id++){
+		int b = hashBucket(hashes[id]);
+		order[bucket_start[b]++] = id;
+	}
+	for(int b = n_buckets; b > 0; b--){
+		bucket_start[b] = bucket_start[b - 1];
+	}
+	bucket_start[0] = 0;
+
+	// insertion sort is fine, buckets hold a handful of leaves
+	for(int b = 0; b < n_buckets; b++){
+		int size = bucket_start[b + 1] - bucket_start[b];
+		int j = b;
+		while(j > 0 && bucket_start[buckets_by_size[j - 1] + 1] - bucket_start[buckets_by_size[j - 1]] < size){
+			buckets_by_size[j] = buckets_by_size[j - 1];
+			j--;
+		}
+		buckets_by_size[j] = b;
+	}
+
+	for(int i = 0; i < n_slots; i++){
+		slot_ids[i] = -1;
+	}
+
+	for(int i = 0; i < n_buckets; i++){
+		int b = buckets_by_size[i];
+		int size = bucket_start[b + 1] - bucket_start[b];
+		if(size == 0){
+			displacement[b] = 0;
+			continue;
+		}
+		if(size > BUCKET_LOAD * 8){
+			goto done;
+		}
+
+		uint32_t d;
+		for(d = 0; d < MAX_DISPLACEMENT; d++){
+			int k;
+			for(k = 0; k < size; k++){
+				int slot = hashSlot(hashes[order[bucket_start[b] + k]], d);
+				if(slot_ids[slot] >= 0){
+					break;
+				}
+				// two leaves of this bucket in the same slot
+				int j;
+				for(j = 0; j < k && taken[j] != slot; j++);
+				if(j < k){
+					break;
+				}
+				taken[k] = slot;
+			}
+			if(k == size){
+				break;
+			}
+		}
+		if(d == MAX_DISPLACEMENT){
+			goto done;
+		}
+
+		displacement[b] = d;
+		for(int k = 0; k < size; k++){
+			slot_ids[taken[k]] = order[bucket_start[b] + k];
+		}
+	}
+	res = 0;
+
+done:
+	free(hashes);
+	free(order);
+	free(bucket_start);
+	free(buckets_by_size);
+	free(taken);
+	return res;
+}
+
+static void indexBuild(void){
+	char string[X32_ADDRESS_MAX];
+	int pool = 0;
+
+	// first pass counts, second pass fills
+	leaf_count = 0;
+	for(int i = 0; i < osc_root_count; i++){
+		indexWalk(string, 0, osc_roots[i], &pool);
+	}
+
+	encoded = malloc(pool);
+	encoded_offset = malloc((leaf_count + 1) * sizeof(int));
+	address_len = malloc(leaf_count);
+	types = malloc(leaf_count);
+	formats = malloc(leaf_count * sizeof(struct osc_format *));
+	n_buckets = leaf_count / BUCKET_LOAD + 1;
+	n_slots = leaf_count + leaf_count / 4 + 1; // 80% load keeps the search short
+	displacement = malloc(n_buckets * sizeof(uint32_t));
+	slot_ids = malloc(n_slots * sizeof(int));
+	if(encoded == NULL || encoded_offset == NULL || address_len == NULL || types == NULL || formats == NULL || displacement == NULL || slot_ids == NULL){
+		return;
+	}
+
+	leaf_count = 0;
+	pool = 0;
+	for(int i = 0; i < osc_root_count; i++){
+		indexWalk(string, 0, osc_roots[i], &pool);
+	}
+	encoded_offset[leaf_count] = pool;
+
+	if(indexPerfectHash() == 0){
+		index_status = 0;
+	}
+}
+
+/**
+ * Builds the index on first use, later calls do nothing.
+ *
+ * Returns 0 on success, -1 on failure
+ */
+int oscIndexInit(void){
+	pthread_once(&index_once, indexBuild);
+	return index_status;
+}
+
+/**
+ * Returns the number of leaves in the index, ids are 0 to count - 1
+ */
+int oscIndexCount(void){
+	return oscIndexInit() < 0 ? 0 : leaf_count;
+}
+
+/**
+ * Maps an address to its leaf id.
+ * address: not necessarily null terminated, eg. a struct osc_view
+ * len: length of address
+ *
+ * Returns the leaf id, or -1 if the address is not a leaf of the tree
+ */
+int oscIndexLookup(const char *address, int len){
+	if(oscIndexInit() < 0){
+		return -1;
+	}
+
+	uint64_t h = indexHash(address, len);
+	int id = slot_ids[hashSlot(h, displacement[hashBucket(h)])];
+	if(id < 0 || address_len[id] != len || memcmp(encoded + encoded_offset[id], address, len) != 0){
+		return -1;
+	}
+	return id;
+}
+
+/**
+ * Returns the null terminated address of a leaf, or NULL for an invalid id
+ */
+const char *oscIndexAddress(int id){
+	if(oscIndexInit() < 0 || id < 0 || id >= leaf_count){
+		return NULL;
+	}
+	return encoded + encoded_offset[id];
+}
+
+/**
+ * Returns the OSC type tag of a leaf's value ('i', 'f', 's'), or 0 if
+ * unknown or for an invalid id
+ */
+char oscIndexType(int id){
+	if(oscIndexInit() < 0 || id < 0 || id >= leaf_count){
+		return 0;
+	}
+	return types[id];
+}
+
+/**
+ * Returns the range and scale of a leaf's value, NULL for plain numbers
+ * and strings or for an invalid id
+ */
+const struct osc_format *oscIndexFormat(int id){
+	if(oscIndexInit() < 0 || id < 0 || id >= leaf_count){
+		return NULL;
+	}
+	return formats[id];
+}
+
+/**
+ * Copies the pre-encoded, padded address of a leaf into an OSC message.
+ *
+ * Returns the number of bytes written, or -1 if it does not fit
+ */
+static int putAddress(char *buffer, int size, int id){
+	if(oscIndexInit() < 0 || id < 0 || id >= leaf_count){
+		return -1;
+	}
+	int len = encoded_offset[id + 1] - encoded_offset[id];
+	if(len > size){
+		return -1;
+	}
+	memcpy(buffer, encoded + encoded_offset[id], len);
+	return len;
+}
+
+/**
+ * oscEncodeQuery for a leaf id, copying the pre-encoded address.
+ *
+ * Returns the length of the encoded message, or -1 if it does not fit
+ */
+int oscEncodeIdQuery(char *buffer, int size, int id){
+	int len = putAddress(buffer, size - 4, id);
+	if(len < 0){
+		return -1;
+	}
+	memcpy(buffer + len, ",\0\0\0", 4);
+	return len + 4;
+}
+
+/**
+ * oscEncodeInt for a leaf id, copying the pre-encoded address.
+ *
+ * Returns the length of the encoded message, or -1 if it does not fit
+ */
+int oscEncodeIdInt(char *buffer, int size, int id, int value){
+	int len = putAddress(buffer, size - 8, id);
+	if(len < 0){
+		return -1;
+	}
+	uint32_t bits = htonl(value);
+	memcpy(buffer + len, ",i\0\0", 4);
+	memcpy(buffer + len + 4, &bits, 4);
+	return len + 8;
+}
+
+/**
+ * oscEncodeFloat for a leaf id, copying the pre-encoded address.
+ *
+ * Returns the length of the encoded message, or -1 if it does not fit
+ */
+int oscEncodeIdFloat(char *buffer, int size, int id, float value){
+	int len = putAddress(buffer, size - 8, id);
+	if(len < 0){
+		return -1;
+	}
+	uint32_t bits;
+	memcpy(&bits, &value, 4);
+	bits = htonl(bits);
+	memcpy(buffer + len, ",f\0\0", 4);
+	memcpy(buffer + len + 4, &bits, 4);
+	return len + 8;
+}
+
+/**
+ * oscEncodeString for a leaf id, copying the pre-encoded address.
+ *
+ * Returns the length of the encoded message, or -1 if it does not fit
+ */
+int oscEncodeIdString(char *buffer, int size, int id, const char *value){
+	int value_len = strlen(value);
+	int len = putAddress(buffer, size - 4 - round4(value_len + 1), id);
+	if(len < 0){
+		return -1;
+	}
+	memcpy(buffer + len, ",s\0\0", 4);
+	len += 4;
+	memset(buffer + len + value_len, 0, round4(value_len + 1) - value_len);
+	memcpy(buffer + len, value, value_len);
+	return len + round4(value_len + 1);
+}
@@ -0,0 +1,295 @@
+/*
+ * M32Meters.c
+ *
+ * Meter streaming. A /meters request makes the console send one bank of
+ * meter values every 50 ms (times a factor) for 10 seconds, as a blob of
+ * little-endian floats: a count followed by that many values. Subscribed
+ * banks are renewed from a timer, and every blob received is decoded into
+ * a frame of a single-producer single-consumer ring: the producer is
+ * X32Dispatch, serialized by the multiplexer lock, the consumer is the
+ * application reading X32MetersNext() at its own rate without ever
+ * blocking the receive path.
+ *
+ * Meters follow the session they were started on (see X32Use), which keeps
+ * a single producer when several consoles are pumped; banks of another
+ * session are only taken once X32MetersStop() ended the first.
+ *
+ * meterToDb() converts a whole frame from linear to dB in one pass, four
+ * values at a time with SSE2 where available.
+ */
+#include "M32.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <endian.h>
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define METER_RING_MASK (METER_RING_SIZE - 1)
+
+atomic_int METER_DROPPED = 0; // frames lost because the consumer fell behind
+
+static struct meter_frame ring[METER_RING_SIZE];
+static atomic_uint ring_head; // next frame to read, written by the consumer
+static atomic_uint ring_tail; // next frame to write, written by the producer
+
+static struct{
+	bool on;
+	int channel; // for per-channel banks, -1 if none
+	int factor;
+} banks[METER_BANKS];
+static pthread_mutex_t meter_lock = PTHREAD_MUTEX_INITIALIZER;
+static atomic_int meters_enabled;
+static int renew_timer = -1;
+static struct x32_session *meter_session; // whose meters are streamed
+
+/**
+ * Sends the /meters request for one bank.
+ *
+ * Returns response from X32Send
+ */
+static int meterSubscribe(int bank, int channel, int factor){
+	char message[64], path[16];
+	uint32_t bits[2];
+	char *args[3] = {path, (char *)&bits[0], (char *)&bits[1]};
+
+	snprintf(path, sizeof(path), "/meters/%i", bank);
+	if(channel >= 0){
+		bits[0] = htonl(channel);
+		bits[1] = htonl(factor);
+	}else{
+		bits[0] = htonl(factor);
+		args[1] = (char *)&bits[0];
+	}
+
+	int len = oscEncodeMessage(message, sizeof(message), "/meters", channel >= 0 ? "sii" : "si", args);
+	if(len < 0){
+		return -1;
+	}
+	return X32Send(message, len);
+}
+
+static void renewMeters(void *ctx){
+	pthread_mutex_lock(&meter_lock);
+	for(int i = 0; i < METER_BANKS; i++){
+		if(banks[i].on){
+			meterSubscribe(i, banks[i].channel, banks[i].factor);
+		}
+	}
+	pthread_mutex_unlock(&meter_lock);
+}
+
+/**
+ * Subscribes to a meter bank, renewed every METER_RENEW ms until
+ * X32MetersStop(). Frames are read with X32MetersNext.
+ * bank: 0 to METER_BANKS - 1, the N of /meters/N
+ * channel: channel argument of the per-channel banks (eg. /meters/6),
+ *          -1 for the others
+ * factor: update period in units of 50 ms, 1 to 99, 0 for the default
+ *
+ * Returns 0 on success, -1 on error or if meters are streamed from another
+ * session
+ */
+int X32MetersStart(int bank, int channel, int factor){
+	if(bank < 0 || bank >= METER_BANKS || factor < 0 || factor > 99){
+		return -1;
+	}
+	if(factor == 0){
+		factor = 1;
+	}
+
+	pthread_mutex_lock(&meter_lock);
+	if(renew_timer >= 0 && meter_session != X32Current()){
+		pthread_mutex_unlock(&meter_lock);
+		return -1;
+	}
+	banks[bank].on = true;
+	banks[bank].channel = channel;
+	banks[bank].factor = factor;
+	if(renew_timer < 0){
+		meter_session = X32Current();
+		renew_timer = X32Every(METER_RENEW, renewMeters, NULL);
+	}
+	pthread_mutex_unlock(&meter_lock);
+
+	meters_enabled = 1;
+	return meterSubscribe(bank, channel, factor) < 0 ? -1 : 0;
+}
+
+/**
+ * Stops renewing all meter subscriptions; the console stops sending within
+ * 10 seconds, frames still arriving until then are dropped.
+ */
+void X32MetersStop(void){
+	meters_enabled = 0;
+
+	pthread_mutex_lock(&meter_lock);
+	for(int i = 0; i < METER_BANKS; i++){
+		banks[i].on = false;
+	}
+	if(renew_timer < 0){
+		pthread_mutex_unlock(&meter_lock);
+		return;
+	}
+	struct x32_session *previous = X32Use(meter_session);
+	X32CancelTimer(renew_timer);
+	X32Use(previous);
+	renew_timer = -1;
+	pthread_mutex_unlock(&meter_lock);
+}
+
+/**
+ * Decodes a /meters/N blob into the next free frame of the ring. Called by
+ * X32Dispatch with the multiplexer locked, which makes it the only producer.
+ *
+ * Returns the bank of the frame, or -1 if the message is not a meter blob
+ */
+int X32MetersApply(const struct osc_message *msg){
+	if(!meters_enabled || X32Current() != meter_session || msg->argc != 1 || msg->args[0].type != 'b' || msg->address.len < 9 || memcmp(msg->address.ptr, "/meters/", 8) != 0){
+		return -1;
+	}
+
+	int bank = 0;
+	for(int i = 8; i < msg->address.len; i++){
+		if(msg->address.ptr[i] < '0' || msg->address.ptr[i] > '9'){
+			return -1;
+		}
+		bank = bank * 10 + msg->address.ptr[i] - '0';
+	}
+
+	const struct osc_view *blob = &msg->args[0].b;
+	uint32_t count;
+	if(blob->len < 4){
+		return -1;
+	}
+	memcpy(&count, blob->ptr, 4);
+	count = le32toh(count);
+	if(count > (uint32_t)(blob->len - 4) / 4){
+		return -1;
+	}
+	if(count > METER_MAX_VALUES){
+		count = METER_MAX_VALUES;
+	}
+
+	unsigned tail = atomic_load_explicit(&ring_tail, memory_order_relaxed);
+	if(tail - atomic_load_explicit(&ring_head, memory_order_acquire) == METER_RING_SIZE){
+		METER_DROPPED++;
+		return bank;
+	}
+
+	struct meter_frame *frame = ring + (tail & METER_RING_MASK);
+	frame->bank = bank;
+	frame->count = count;
+	frame->time = monotonicMs();
+	memcpy(frame->values, blob->ptr + 4, count * 4);
+#if __BYTE_ORDER != __LITTLE_ENDIAN
+	for(uint32_t i = 0; i < count; i++){
+		uint32_t bits;
+		memcpy(&bits, frame->values + i, 4);
+		bits = le32toh(bits);
+		memcpy(frame->values + i, &bits, 4);
+	}
+#endif
+
+	atomic_store_explicit(&ring_tail, tail + 1, memory_order_release);
+	return bank;
+}
+
+/**
+ * Takes the oldest meter frame out of the ring, never blocks. Only one
+ * thread may read frames.
+ * frame: receives the frame, values are linear (0.0 to 1.0 is -oo to 0 dB)
+ *
+ * Returns 1 if a frame was read, 0 if the ring is empty
+ */
+int X32MetersNext(struct meter_frame *frame){
+	unsigned head = atomic_load_explicit(&ring_head, memory_order_relaxed);
+	if(head == atomic_load_explicit(&ring_tail, memory_order_acquire)){
+		return 0;
+	}
+
+	const struct meter_frame *src = ring + (head & METER_RING_MASK);
+	frame->bank = src->bank;
+	frame->count = src->count;
+	frame->time = src->time;
+	memcpy(frame->values, src->values, src->count * sizeof(float));
+
+	atomic_store_explicit(&ring_head, head + 1, memory_order_release);
+	return 1;
+}
+
+/*
+ * ln(x) for x = m * 2^e with m reduced to [sqrt(1/2), sqrt(2)):
+ * ln(m) = 2 atanh(s) with s = (m - 1) / (m + 1), |s| < 0.172, so the series
+ * up to s^7 is exact to float precision.
+ */
+#define DB_PER_LN 8.6858896f // 20 / ln(10)
+#define DB_PER_OCTAVE 6.0205999f // 20 * log10(2)
+#define METER_FLOOR 1e-6f // METER_DB_FLOOR as a linear value
+
+static inline float meterDb(float x){
+	if(!(x > METER_FLOOR)){ // also catches NaN
+		x = METER_FLOOR;
+	}
+	uint32_t bits;
+	memcpy(&bits, &x, 4);
+	int e = (int)(bits >> 23) - 127;
+	bits = (bits & 0x7fffff) | 0x3f800000;
+	float m;
+	memcpy(&m, &bits, 4);
+	if(m > 1.41421356f){
+		m *= 0.5f;
+		e++;
+	}
+
+	float s = (m - 1.0f) / (m + 1.0f);
+	float s2 = s * s;
+	float ln = 2.0f * s * (1.0f + s2 * (1.0f / 3 + s2 * (1.0f / 5 + s2 * (1.0f / 7))));
+	return DB_PER_LN * ln + DB_PER_OCTAVE * e;
+}
+
+/**
+ * Converts linear meter values to dB, clamped below at METER_DB_FLOOR.
+ * db may be the same array as linear.
+ */
+void meterToDb(const float *linear, float *db, int count){
+	int i = 0;
+#ifdef __SSE2__
+	const __m128 floor = _mm_set1_ps(METER_FLOOR);
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 half = _mm_set1_ps(0.5f);
+	const __m128 sqrt2 = _mm_set1_ps(1.41421356f);
+	const __m128i mantissa = _mm_set1_epi32(0x7fffff);
+	const __m128i exponent_one = _mm_set1_epi32(0x3f800000);
+	const __m128i bias = _mm_set1_epi32(127);
+
+	for(; i + 4 <= count; i += 4){
+		// max_ps returns its second operand for NaN
+		__m128 x = _mm_max_ps(_mm_loadu_ps(linear + i), floor);
+		__m128i bits = _mm_castps_si128(x);
+		__m128i e = _mm_sub_epi32(_mm_srli_epi32(bits, 23), bias);
+		__m128 m = _mm_castsi128_ps(_mm_or_si128(_mm_and_si128(bits, mantissa), exponent_one));
+
+		__m128 big = _mm_cmpgt_ps(m, sqrt2);
+		m = _mm_mul_ps(m, _mm_or_ps(_mm_and_ps(big, half), _mm_andnot_ps(big, one)));
+		e = _mm_sub_epi32(e, _mm_castps_si128(big)); // mask is -1 where big
+
+		__m128 s = _mm_div_ps(_mm_sub_ps(m, one), _mm_add_ps(m, one));
+		__m128 s2 = _mm_mul_ps(s, s);
+		__m128 p = _mm_add_ps(_mm_set1_ps(1.0f / 5), _mm_mul_ps(s2, _mm_set1_ps(1.0f / 7)));
+		p = _mm_add_ps(_mm_set1_ps(1.0f / 3), _mm_mul_ps(s2, p));
+		p = _mm_add_ps(one, _mm_mul_ps(s2, p));
+		__m128 ln = _mm_mul_ps(_mm_add_ps(s, s), p);
+
+		__m128 res = _mm_add_ps(_mm_mul_ps(ln, _mm_set1_ps(DB_PER_LN)), _mm_mul_ps(_mm_cvtepi32_ps(e), _mm_set1_ps(DB_PER_OCTAVE)));
+		_mm_storeu_ps(db + i, res);
+	}
+#endif
+	for(; i < count; i++){
+		db[i] = meterDb(linear[i]);
+	}
+}
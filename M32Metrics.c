@@ -0,0 +1,334 @@
+/*
+ * M32Metrics.c
+ *
+ * Counters and latency histograms of the library's traffic: packets and
+ * bytes sent and received, errors, retransmissions and timeouts, and the
+ * latency of replies (from the last transmission of their query), of the
+ * getters (including retransmissions) and of X32Connect. Latencies are
+ * kept per address class, the first component of the address, so a slow
+ * part of the tree (eg. /fx) stands out.
+ *
+ * Histograms are log-linear like HDR histograms: values below
+ * METRIC_SUB_BUCKETS us have a bucket each, above that every power of two
+ * is split into METRIC_SUB_BUCKETS buckets, which bounds the error of any
+ * percentile to about 6% from 1 us to 18 minutes. Everything is a relaxed
+ * atomic counter, so recording costs a few increments and never blocks.
+ *
+ * X32MetricsSnapshot copies the current values; they can be formatted as
+ * text or JSON, and dumped periodically from a timer.
+ */
+#include "M32.h"
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdatomic.h>
+
+#define METRIC_SUB_BITS 4
+#define METRIC_SUB_BUCKETS (1 << METRIC_SUB_BITS)
+
+struct metric_atomic_histogram{
+	atomic_ullong count;
+	atomic_ullong sum;
+	atomic_ullong max;
+	atomic_ullong buckets[METRIC_BUCKETS];
+};
+
+static atomic_ullong counters[METRIC_COUNTERS];
+static struct metric_atomic_histogram histograms[METRIC_OPS][METRIC_CLASSES];
+
+static const char *counter_names[METRIC_COUNTERS] = {
+	[METRIC_SENDS] = "sends",
+	[METRIC_SEND_BYTES] = "send_bytes",
+	[METRIC_SEND_ERRORS] = "send_errors",
+	[METRIC_RECEIVES] = "receives",
+	[METRIC_RECV_BYTES] = "recv_bytes",
+	[METRIC_RECV_ERRORS] = "recv_errors",
+	[METRIC_PARSE_ERRORS] = "parse_errors",
+	[METRIC_UNSOLICITED] = "unsolicited",
+	[METRIC_RETRANSMITS] = "retransmits",
+	[METRIC_TIMEOUTS] = "timeouts",
+	[METRIC_GETS] = "gets",
+	[METRIC_GET_ERRORS] = "get_errors",
+	[METRIC_CONNECTS] = "connects",
+	[METRIC_CONNECT_FAILURES] = "connect_failures",
+	[METRIC_POOL_MISSES] = "pool_misses",
+};
+
+static const char *op_names[METRIC_OPS] = {
+	[METRIC_RTT] = "rtt",
+	[METRIC_GET] = "get",
+	[METRIC_CONNECT] = "connect",
+};
+
+// address prefix of every class but METRIC_OTHER
+static const struct{
+	const char *prefix;
+	int len;
+} class_prefixes[METRIC_OTHER] = {
+	[METRIC_CH] = {"/ch/", 4},
+	[METRIC_BUS] = {"/bus/", 5},
+	[METRIC_MTX] = {"/mtx/", 5},
+	[METRIC_MAIN] = {"/main/", 6},
+	[METRIC_DCA] = {"/dca/", 5},
+	[METRIC_FX] = {"/fx/", 4},
+	[METRIC_CONFIG] = {"/config/", 8},
+};
+
+static const char *class_names[METRIC_CLASSES] = {"ch", "bus", "mtx", "main", "dca", "fx", "config", "other"};
+
+// periodic dump, see X32MetricsEvery
+static int dump_timer = -1;
+static struct x32_session *dump_session;
+static int dump_fd, dump_format;
+
+/**
+ * Adds n to a counter.
+ */
+void metricCount(int counter, unsigned long long n){
+	atomic_fetch_add_explicit(counters + counter, n, memory_order_relaxed);
+}
+
+/**
+ * Returns the class of an address; /node keys ("node/ch/01/...") count
+ * for the node they ask for
+ */
+int metricClass(const char *address, int len){
+	if(len > 4 && memcmp(address, "node", 4) == 0){
+		address += 4;
+		len -= 4;
+	}
+	for(int i = 0; i < METRIC_OTHER; i++){
+		if(len >= class_prefixes[i].len && memcmp(address, class_prefixes[i].prefix, class_prefixes[i].len) == 0){
+			return i;
+		}
+	}
+	return METRIC_OTHER;
+}
+
+static int metricBucket(unsigned long long us){
+	if(us < METRIC_SUB_BUCKETS){
+		return us;
+	}
+	int shift = 63 - __builtin_clzll(us) - METRIC_SUB_BITS;
+	int bucket = (shift + 1) * METRIC_SUB_BUCKETS + (us >> shift) - METRIC_SUB_BUCKETS;
+	return bucket < METRIC_BUCKETS ? bucket : METRIC_BUCKETS - 1;
+}
+
+/**
+ * Returns the largest value that falls in a bucket
+ */
+static unsigned long long metricBucketMax(int bucket){
+	if(bucket < METRIC_SUB_BUCKETS){
+		return bucket;
+	}
+	int shift = bucket / METRIC_SUB_BUCKETS - 1;
+	unsigned long long low = (unsigned long long)(METRIC_SUB_BUCKETS + bucket % METRIC_SUB_BUCKETS) << shift;
+	return low + (1ULL << shift) - 1;
+}
+
+/**
+ * Records one latency.
+ * op: METRIC_RTT, METRIC_GET or METRIC_CONNECT
+ * class: see metricClass
+ */
+void metricLatency(int op, int class, long long us){
+	struct metric_atomic_histogram *h = &histograms[op][class];
+	unsigned long long value = us < 0 ? 0 : us;
+
+	atomic_fetch_add_explicit(&h->count, 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&h->sum, value, memory_order_relaxed);
+	atomic_fetch_add_explicit(h->buckets + metricBucket(value), 1, memory_order_relaxed);
+	unsigned long long max = atomic_load_explicit(&h->max, memory_order_relaxed);
+	while(value > max && !atomic_compare_exchange_weak_explicit(&h->max, &max, value, memory_order_relaxed, memory_order_relaxed)){
+	}
+}
+
+/**
+ * Copies the current counters and histograms.
+ */
+void X32MetricsSnapshot(struct x32_metrics *metrics){
+	metrics->time = monotonicMs();
+	for(int i = 0; i < METRIC_COUNTERS; i++){
+		metrics->counters[i] = atomic_load_explicit(counters + i, memory_order_relaxed);
+	}
+	for(int op = 0; op < METRIC_OPS; op++){
+		for(int c = 0; c < METRIC_CLASSES; c++){
+			struct metric_atomic_histogram *h = &histograms[op][c];
+			struct metric_histogram *dest = &metrics->histograms[op][c];
+			dest->count = atomic_load_explicit(&h->count, memory_order_relaxed);
+			dest->sum = atomic_load_explicit(&h->sum, memory_order_relaxed);
+			dest->max = atomic_load_explicit(&h->max, memory_order_relaxed);
+			for(int b = 0; b < METRIC_BUCKETS; b++){
+				dest->buckets[b] = atomic_load_explicit(h->buckets + b, memory_order_relaxed);
+			}
+		}
+	}
+}
+
+/**
+ * Sets every counter and histogram back to zero.
+ */
+void X32MetricsReset(void){
+	for(int i = 0; i < METRIC_COUNTERS; i++){
+		atomic_store_explicit(counters + i, 0, memory_order_relaxed);
+	}
+	for(int op = 0; op < METRIC_OPS; op++){
+		for(int c = 0; c < METRIC_CLASSES; c++){
+			struct metric_atomic_histogram *h = &histograms[op][c];
+			atomic_store_explicit(&h->count, 0, memory_order_relaxed);
+			atomic_store_explicit(&h->sum, 0, memory_order_relaxed);
+			atomic_store_explicit(&h->max, 0, memory_order_relaxed);
+			for(int b = 0; b < METRIC_BUCKETS; b++){
+				atomic_store_explicit(h->buckets + b, 0, memory_order_relaxed);
+			}
+		}
+	}
+}
+
+/**
+ * Returns the value below which a fraction p (0 to 1) of the recorded
+ * latencies fall, in us, 0 if there are none
+ */
+unsigned long long metricPercentile(const struct metric_histogram *histogram, double p){
+	unsigned long long total = 0;
+	for(int b = 0; b < METRIC_BUCKETS; b++){
+		total += histogram->buckets[b];
+	}
+	if(total == 0){
+		return 0;
+	}
+
+	unsigned long long rank = p * total + 0.5;
+	rank = rank < 1 ? 1 : rank > total ? total : rank;
+	unsigned long long seen = 0;
+	for(int b = 0; b < METRIC_BUCKETS; b++){
+		seen += histogram->buckets[b];
+		if(seen >= rank){
+			unsigned long long value = metricBucketMax(b);
+			return value < histogram->max ? value : histogram->max;
+		}
+	}
+	return histogram->max;
+}
+
+/**
+ * Appends to text as snprintf does, keeping track of the length needed.
+ */
+static void metricAppend(char *text, int size, int *length, const char *format, ...){
+	va_list args;
+	va_start(args, format);
+	int room = *length < size ? size - *length : 0;
+	int n = vsnprintf(room > 0 ? text + *length : NULL, room, format, args);
+	va_end(args);
+	if(n > 0){
+		*length += n;
+	}
+}
+
+/**
+ * Formats a snapshot as text, one line per counter and per histogram with
+ * samples, or as one JSON object.
+ * format: METRICS_TEXT or METRICS_JSON
+ *
+ * Returns the length of the text, which was truncated if it is size or
+ * more (as snprintf)
+ */
+int X32MetricsFormat(const struct x32_metrics *metrics, int format, char *text, int size){
+	bool json = format == METRICS_JSON;
+	int length = 0;
+	const char *sep = "";
+
+	if(size > 0){
+		text[0] = '\0';
+	}
+	if(json){
+		metricAppend(text, size, &length, "{\"time_ms\":%lld,\"counters\":{", metrics->time);
+	}
+	for(int i = 0; i < METRIC_COUNTERS; i++){
+		metricAppend(text, size, &length, json ? "%s\"%s\":%llu" : "%s%s %llu\n", sep, counter_names[i], metrics->counters[i]);
+		sep = json ? "," : "";
+	}
+	metricAppend(text, size, &length, json ? ",\"queue_dropped\":%d,\"duplicates\":%d,\"coalesced\":%d,\"meters_dropped\":%d},\"latency_us\":{" : "queue_dropped %d\nduplicates %d\ncoalesced %d\nmeters_dropped %d\n", X32_QUEUE_DROPPED, X32_DUPLICATES, OUTBOX_COALESCED, METER_DROPPED);
+
+	for(int op = 0; op < METRIC_OPS; op++){
+		if(json){
+			metricAppend(text, size, &length, "%s\"%s\":{", op > 0 ? "," : "", op_names[op]);
+		}
+		sep = "";
+		for(int c = 0; c < METRIC_CLASSES; c++){
+			const struct metric_histogram *h = &metrics->histograms[op][c];
+			if(h->count == 0){
+				continue;
+			}
+			unsigned long long p50 = metricPercentile(h, 0.5), p90 = metricPercentile(h, 0.9);
+			unsigned long long p99 = metricPercentile(h, 0.99), p999 = metricPercentile(h, 0.999);
+			if(json){
+				metricAppend(text, size, &length, "%s\"%s\":{\"count\":%llu,\"mean\":%llu,\"p50\":%llu,\"p90\":%llu,\"p99\":%llu,\"p999\":%llu,\"max\":%llu}", sep, class_names[c], h->count, h->sum / h->count, p50, p90, p99, p999, h->max);
+			}else{
+				metricAppend(text, size, &length, "%s %s count %llu mean %llu p50 %llu p90 %llu p99 %llu p99.9 %llu max %llu us\n", op_names[op], class_names[c], h->count, h->sum / h->count, p50, p90, p99, p999, h->max);
+			}
+			sep = ",";
+		}
+		if(json){
+			metricAppend(text, size, &length, "}");
+		}
+	}
+	if(json){
+		metricAppend(text, size, &length, "}}\n");
+	}
+	return length;
+}
+
+/**
+ * Writes a snapshot of the metrics to a file descriptor.
+ * format: METRICS_TEXT or METRICS_JSON
+ *
+ * Returns 0 on success, -1 on error
+ */
+int X32MetricsDump(int fd, int format){
+	struct x32_metrics *metrics = malloc(sizeof(struct x32_metrics));
+	char *text = malloc(METRICS_TEXT_MAX);
+	int res = -1;
+
+	if(metrics != NULL && text != NULL){
+		X32MetricsSnapshot(metrics);
+		int length = X32MetricsFormat(metrics, format, text, METRICS_TEXT_MAX);
+		if(length < METRICS_TEXT_MAX && write(fd, text, length) == length){
+			res = 0;
+		}
+	}
+	free(metrics);
+	free(text);
+	return res;
+}
+
+static void metricsTick(void *ctx){
+	X32MetricsDump(dump_fd, dump_format);
+}
+
+/**
+ * Dumps the metrics to a file descriptor every period ms from a timer of
+ * the current session, replacing an earlier periodic dump.
+ * period: 0 to stop dumping
+ *
+ * Returns 0 on success, -1 on error
+ */
+int X32MetricsEvery(int period, int fd, int format){
+	if(dump_timer >= 0){
+		struct x32_session *previous = X32Use(dump_session);
+		X32CancelTimer(dump_timer);
+		X32Use(previous);
+		dump_timer = -1;
+	}
+	if(period <= 0){
+		return 0;
+	}
+
+	dump_fd = fd;
+	dump_format = format;
+	dump_session = X32Current();
+	dump_timer = X32Every(period, metricsTick, NULL);
+	return dump_timer < 0 ? -1 : 0;
+}
@@ -0,0 +1,308 @@
+/*
+ * M32Node.c
+ *
+ * /node text. "/node ,s ch/01/gate" makes the console answer a whole
+ * parameter group in one message: "node ,s" with a line holding the node
+ * address followed by the value of every leaf right below it, in tree
+ * order, as the console displays them:
+ *
+ *     /ch/01/gate ON GATE -80.0 60.0 0.0 10.0 199 0
+ *
+ * Switches read ON/OFF, enumerations use their labels, strings are quoted
+ * and levels, times and frequencies are in dB, ms and Hz. The format of
+ * every leaf comes with the node tree (M32Tree.c); it converts display
+ * values to the normalized 0.0 to 1.0 floats a plain OSC query returns,
+ * and back. Leaves without a format are plain numbers.
+ */
+#include "M32.h"
+
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+
+/**
+ * Finds the node of the tree at path, with or without the leading '/'.
+ *
+ * Returns the node, or NULL if there is none
+ */
+static const osc_node_t *nodeFind(const char *path, int len){
+	const osc_node_t *node = NULL;
+	const osc_node_t *children = NULL;
+	int n_children = 0;
+
+	for(int i = 0; i < len;){
+		if(path[i] == '/'){
+			i++;
+			continue;
+		}
+		int end = i;
+		while(end < len && path[end] != '/'){
+			end++;
+		}
+
+		const osc_node_t *found = NULL;
+		if(node == NULL){
+			for(int r = 0; r < osc_root_count; r++){
+				if(strncmp(osc_roots[r]->label, path + i, end - i) == 0 && osc_roots[r]->label[end - i] == '\0'){
+					found = osc_roots[r];
+				}
+			}
+		}else{
+			for(int c = 0; c < n_children; c++){
+				if(strncmp(children[c].label, path + i, end - i) == 0 && children[c].label[end - i] == '\0'){
+					found = children + c;
+				}
+			}
+		}
+		if(found == NULL){
+			return NULL;
+		}
+		node = found;
+		children = node->children;
+		n_children = node->no_children;
+		i = end;
+	}
+	return node;
+}
+
+/**
+ * Lists the leaves a /node query for path answers: the leaves right below
+ * the node, in tree order, or the node itself if it is a leaf.
+ * ids: receives up to max leaf ids
+ *
+ * Returns the number of leaves, or -1 if path is not a node of the tree
+ */
+int oscNodeLeaves(const char *path, int len, int *ids, int max){
+	char address[X32_ADDRESS_MAX];
+	while(len > 0 && path[0] == '/'){
+		path++;
+		len--;
+	}
+	const osc_node_t *node = nodeFind(path, len);
+	if(node == NULL || len + 2 >= X32_ADDRESS_MAX){
+		return -1;
+	}
+	address[0] = '/';
+	memcpy(address + 1, path, len);
+	len++;
+
+	if(node->no_children == 0){
+		ids[0] = oscIndexLookup(address, len);
+		return ids[0] < 0 ? -1 : 1;
+	}
+
+	int count = 0;
+	address[len++] = '/';
+	for(int i = 0; i < node->no_children && count < max; i++){
+		const osc_node_t *child = node->children + i;
+		int c_len = strlen(child->label);
+		if(child->no_children != 0 || len + c_len >= X32_ADDRESS_MAX){
+			continue;
+		}
+		memcpy(address + len, child->label, c_len);
+		int id = oscIndexLookup(address, len + c_len);
+		if(id >= 0){
+			ids[count++] = id;
+		}
+	}
+	return count;
+}
+
+// dB of a normalized fader position, see OSC_FADER
+static float faderDb(float f){
+	if(f >= 0.5f){
+		return f * 40 - 30;
+	}else if(f >= 0.25f){
+		return f * 80 - 50;
+	}else if(f >= 0.0625f){
+		return f * 160 - 70;
+	}
+	return f * 480 - 90;
+}
+
+static float faderPosition(float db){
+	if(db >= -10){
+		return (db + 30) / 40;
+	}else if(db >= -30){
+		return (db + 50) / 80;
+	}else if(db >= -60){
+		return (db + 70) / 160;
+	}
+	return (db + 90) / 480;
+}
+
+/**
+ * Writes a leaf value the way /node displays it.
+ * text: receives the null terminated token
+ *
+ * Returns the token length, or -1 if it does not fit
+ */
+int oscNodeFormat(int id, const struct x32_value *value, char *text, int size){
+	const struct osc_format *format = oscIndexFormat(id);
+	int len = -1;
+
+	if(value->type == 's'){
+		len = snprintf(text, size, "\"%s\"", value->s);
+	}else if(format == NULL || format->scale == OSC_INT){
+		len = value->type == 'i' ? snprintf(text, size, "%i", value->i) : snprintf(text, size, "%.4f", value->f);
+	}else{
+		float f = value->type == 'i' ? value->i : value->f;
+		int index = f;
+		switch(format->scale){
+		case OSC_ONOFF:
+			len = snprintf(text, size, "%s", index ? "ON" : "OFF");
+			break;
+		case OSC_ENUM:
+			if(index >= 0 && index < format->n_labels){
+				len = snprintf(text, size, "%s", format->labels[index]);
+			}else{
+				len = snprintf(text, size, "%i", index);
+			}
+			break;
+		case OSC_LIN:
+			len = snprintf(text, size, "%.2f", format->min + f * (format->max - format->min));
+			break;
+		case OSC_LOG:
+			len = snprintf(text, size, "%.4g", format->min * expf(f * logf(format->max / format->min)));
+			break;
+		case OSC_FADER:
+			len = f <= 0 ? snprintf(text, size, "-oo") : snprintf(text, size, "%.2f", faderDb(f));
+			break;
+		}
+	}
+	return len < size ? len : -1;
+}
+
+/**
+ * Converts one /node token to the value of a leaf, of the leaf's OSC type.
+ * Strings must be quoted.
+ *
+ * Returns 0 on success, -1 on a token that does not fit the leaf
+ */
+int oscNodeParse(int id, const char *token, int len, struct x32_value *value){
+	char number[32];
+	char type = oscIndexType(id);
+	const struct osc_format *format = oscIndexFormat(id);
+
+	value->type = type;
+	if(type == 's'){
+		if(len < 2 || token[0] != '"' || token[len - 1] != '"'){
+			return -1;
+		}
+		len -= 2;
+		if(len >= X32_STRING_MAX){
+			len = X32_STRING_MAX - 1;
+		}
+		memcpy(value->s, token + 1, len);
+		value->s[len] = '\0';
+		return 0;
+	}
+
+	if(format != NULL && format->scale == OSC_ONOFF){
+		if(len == 2 && memcmp(token, "ON", 2) == 0){
+			value->i = 1;
+			return 0;
+		}else if(len == 3 && memcmp(token, "OFF", 3) == 0){
+			value->i = 0;
+			return 0;
+		}
+	}
+	if(format != NULL && format->scale == OSC_ENUM){
+		for(int i = 0; i < format->n_labels; i++){
+			if(strncmp(format->labels[i], token, len) == 0 && format->labels[i][len] == '\0'){
+				value->i = i;
+				return 0;
+			}
+		}
+	}
+	if(format != NULL && format->scale == OSC_FADER && len == 3 && memcmp(token, "-oo", 3) == 0){
+		value->f = 0;
+		return 0;
+	}
+
+	if(len <= 0 || len >= (int)sizeof(number)){
+		return -1;
+	}
+	memcpy(number, token, len);
+	number[len] = '\0';
+	char *end;
+	float f = strtof(number, &end);
+	if(*end != '\0'){
+		return -1;
+	}
+
+	if(format != NULL){
+		if(format->scale == OSC_LIN){
+			f = (f - format->min) / (format->max - format->min);
+		}else if(format->scale == OSC_LOG){
+			f = logf(f / format->min) / logf(format->max / format->min);
+		}else if(format->scale == OSC_FADER){
+			f = faderPosition(f);
+		}
+		if(format->scale >= OSC_LIN){
+			f = f < 0 ? 0 : f > 1 ? 1 : f;
+		}
+	}
+	if(type == 'i'){
+		value->i = lrintf(f);
+	}else{
+		value->f = f;
+	}
+	return 0;
+}
+
+/**
+ * Splits the next token off a /node line: a quoted string or a run of
+ * non-blank characters.
+ *
+ * Returns the token length, 0 at the end of the line
+ */
+static int nodeToken(const char *text, int len, int *pos, const char **token){
+	int i = *pos;
+	while(i < len && (text[i] == ' ' || text[i] == '\t')){
+		i++;
+	}
+	*token = text + i;
+	int start = i;
+	if(i < len && text[i] == '"'){
+		for(i++; i < len && text[i] != '"'; i++);
+		if(i < len){
+			i++;
+		}
+	}else{
+		while(i < len && text[i] != ' ' && text[i] != '\t' && text[i] != '\n' && text[i] != '\0'){
+			i++;
+		}
+	}
+	*pos = i;
+	return i - start;
+}
+
+/**
+ * Decodes the text of a /node reply into leaf values.
+ * ids, values: receive up to max leaves; a token that does not fit its
+ *              leaf leaves the value with type 0
+ *
+ * Returns the number of leaves decoded, or -1 if the line does not start
+ * with a node of the tree
+ */
+int oscNodeDecode(const char *text, int len, int *ids, struct x32_value *values, int max){
+	const char *token;
+	int pos = 0;
+	int t_len = nodeToken(text, len, &pos, &token);
+	if(t_len == 0 || token[0] != '/'){
+		return -1;
+	}
+
+	int count = oscNodeLeaves(token, t_len, ids, max);
+	for(int i = 0; i < count; i++){
+		t_len = nodeToken(text, len, &pos, &token);
+		if(t_len == 0){
+			return i;
+		}
+		if(oscNodeParse(ids[i], token, t_len, values + i) < 0){
+			values[i].type = 0;
+		}
+	}
+	return count;
+}
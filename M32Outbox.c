@@ -0,0 +1,380 @@
+/*
+ * M32Outbox.c
+ *
+ * Coalescing send queue. A fader dragged in a UI produces a set-message
+ * per mouse event, far more than the console takes in; once the outbox of
+ * a session is started, X32Send queues set-messages for node index leaves
+ * instead of sending them, one entry per parameter: a newer value for a
+ * parameter still waiting replaces the queued one in place.
+ *
+ * The queue drains from a timer at a budget of packets per second (a token
+ * bucket), as bundles of all pending writes when the console takes
+ * bundles. A write to an idle outbox goes out at once, so a single change
+ * is not delayed; during a burst the console gets the latest value of
+ * every parameter at most OUTBOX_PERIOD ms late. The packets of one drain
+ * go out in a single batch (see X32BatchBegin).
+ *
+ * Queries, bundles and other messages are never queued; a query for a
+ * parameter with a pending write sends that write first, so the reply
+ * carries the new value. A bundle is handled element by element the same
+ * way, and the pending writes of the parameters it sets are dropped: its
+ * values are newer, which a later drain must not undo.
+ */
+#include "M32.h"
+
+#include <string.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+
+#define OUTBOX_MESSAGE_MAX 128 // longer set-messages are sent right away
+
+struct outbox_entry{
+	int id; // leaf id, -1 if it was sent ahead of its turn
+	int length;
+	char message[OUTBOX_MESSAGE_MAX];
+};
+
+struct x32_outbox{
+	pthread_mutex_t lock;
+	bool enabled;
+	int rate; // packets per second
+	double tokens; // packets that may be sent now
+	long long refilled; // monotonicMs() of the last refill
+	int timer;
+	struct outbox_entry entries[OUTBOX_SIZE]; // ring, in order of first write
+	int head, count;
+	int16_t position[]; // by leaf id: entry of its pending write, -1 if none
+};
+
+atomic_int OUTBOX_COALESCED = 0; // writes replaced by a newer value before being sent
+
+/**
+ * Adds the tokens earned since the last refill, up to two timer periods'
+ * worth (at least one packet) so a late tick does not lose budget.
+ * The lock must be held.
+ */
+static void outboxRefill(struct x32_outbox *outbox){
+	long long now = monotonicMs();
+	double burst = outbox->rate * 2 * OUTBOX_PERIOD / 1000.0;
+	if(burst < 1){
+		burst = 1;
+	}
+	outbox->tokens += (now - outbox->refilled) * outbox->rate / 1000.0;
+	if(outbox->tokens > burst){
+		outbox->tokens = burst;
+	}
+	outbox->refilled = now;
+}
+
+/**
+ * Sends the oldest pending writes as one packet: a bundle of as many as
+ * fit when the console takes bundles, a single message otherwise.
+ * The lock must be held.
+ *
+ * Returns response from X32Transmit, 0 if nothing was pending
+ */
+static int outboxPacket(struct x32_outbox *outbox){
+	struct osc_bundle bundle;
+	bool bundles = X32BundleMode() == BUNDLE_ON;
+
+	oscBundleInit(&bundle);
+	while(outbox->count > 0){
+		struct outbox_entry *entry = outbox->entries + outbox->head;
+		if(entry->id >= 0){
+			if(bundle.count > 0 && (!bundles || bundle.count == BUNDLE_MAX_MESSAGES || bundle.length + 4 + entry->length > BUNDLE_MTU)){
+				break;
+			}
+			oscBundleAdd(&bundle, entry->message, entry->length);
+			outbox->position[entry->id] = -1;
+		}
+		outbox->head = (outbox->head + 1) % OUTBOX_SIZE;
+		outbox->count--;
+	}
+
+	if(bundle.count == 0){
+		return 0;
+	}
+	if(bundle.count == 1){
+		return X32Transmit(bundle.buffer + bundle.offsets[0] + 4, bundle.length - bundle.offsets[0] - 4);
+	}
+	return X32Transmit(bundle.buffer, bundle.length);
+}
+
+/**
+ * Sends as many packets as the budget allows. The lock must be held.
+ *
+ * Returns the number of packets sent, or -1 on error
+ */
+static int outboxDrain(struct x32_outbox *outbox){
+	struct x32_batch batch;
+	int sent = 0;
+
+	outboxRefill(outbox);
+	X32BatchBegin(&batch);
+	while(outbox->count > 0 && outbox->tokens >= 1){
+		int res = outboxPacket(outbox);
+		if(res < 0){
+			sent = -1;
+			break;
+		}
+		if(res > 0){
+			outbox->tokens--;
+			sent++;
+		}
+	}
+	if(X32BatchEnd(&batch) < 0){
+		sent = -1;
+	}
+	return sent;
+}
+
+static void outboxTick(void *ctx){
+	struct x32_outbox *outbox = ctx;
+
+	pthread_mutex_lock(&outbox->lock);
+	if(outbox->enabled){
+		outboxDrain(outbox);
+	}
+	pthread_mutex_unlock(&outbox->lock);
+}
+
+/**
+ * Queues a set-message for a leaf, or sends it at once if nothing is
+ * pending and the budget allows. The lock must be held.
+ *
+ * Returns length, or -1 on error
+ */
+static int outboxPut(struct x32_outbox *outbox, int id, char *buffer, int length){
+	int p = outbox->position[id];
+	if(p >= 0){
+		memcpy(outbox->entries[p].message, buffer, length);
+		outbox->entries[p].length = length;
+		OUTBOX_COALESCED++;
+		return length;
+	}
+
+	outboxRefill(outbox);
+	if(outbox->count == 0 && outbox->tokens >= 1){
+		outbox->tokens--;
+		return X32Transmit(buffer, length);
+	}
+	if(outbox->count == OUTBOX_SIZE && outboxPacket(outbox) < 0){
+		return -1; // full: the oldest go out over budget
+	}
+
+	p = (outbox->head + outbox->count) % OUTBOX_SIZE;
+	outbox->entries[p].id = id;
+	outbox->entries[p].length = length;
+	memcpy(outbox->entries[p].message, buffer, length);
+	outbox->position[id] = p;
+	outbox->count++;
+	return length;
+}
+
+/**
+ * Takes the pending write of a leaf out of the queue, ahead of a message
+ * for the same leaf that is sent directly: a query has the write sent
+ * first, so the reply carries it, a set-message replaces it.
+ * The lock must be held.
+ * replaced: true for a set-message
+ *
+ * Returns response from X32Transmit, 0 if nothing was sent
+ */
+static int outboxAhead(struct x32_outbox *outbox, int id, bool replaced){
+	int p = outbox->position[id];
+	int res = 0;
+	if(p < 0){
+		return 0;
+	}
+	if(replaced){
+		OUTBOX_COALESCED++;
+	}else{
+		res = X32Transmit(outbox->entries[p].message, outbox->entries[p].length);
+	}
+	outbox->entries[p].id = -1;
+	outbox->position[id] = -1;
+	return res;
+}
+
+/**
+ * Sends a bundle directly, after taking the pending writes of the leaves
+ * of its elements out of the queue, see outboxAhead.
+ *
+ * Returns response from X32Transmit, -1 on error
+ */
+static int outboxBundle(struct x32_outbox *outbox, char *buffer, int length){
+	int res = 0;
+
+	pthread_mutex_lock(&outbox->lock);
+	// elements after the "#bundle" header and timetag
+	for(int offset = 16; offset + 4 <= length;){
+		struct osc_message msg;
+		uint32_t size;
+		memcpy(&size, buffer + offset, 4);
+		size = ntohl(size);
+		if(size > (uint32_t)(length - offset - 4)){
+			break;
+		}
+		if(oscDecode(buffer + offset + 4, size, &msg) >= 0){
+			int id = oscIndexLookup(msg.address.ptr, msg.address.len);
+			if(id >= 0 && outboxAhead(outbox, id, msg.argc > 0) < 0){
+				res = -1;
+			}
+		}
+		offset += 4 + size;
+	}
+	if(res >= 0){
+		res = X32Transmit(buffer, length);
+	}
+	pthread_mutex_unlock(&outbox->lock);
+	return res;
+}
+
+/**
+ * Starts coalescing the set-messages of the current session.
+ * rate: most packets per second, 0 for OUTBOX_RATE
+ *
+ * Returns 0 on success, -1 on error
+ */
+int X32OutboxStart(int rate){
+	struct x32_socket *x = X32Socket();
+	if(rate < 0 || oscIndexInit() < 0){
+		return -1;
+	}
+	if(rate == 0){
+		rate = OUTBOX_RATE;
+	}
+
+	struct x32_outbox *outbox = x->outbox;
+	if(outbox == NULL){
+		int leaves = oscIndexCount();
+		outbox = malloc(sizeof(struct x32_outbox) + leaves * sizeof(int16_t));
+		if(outbox == NULL){
+			return -1;
+		}
+		pthread_mutex_init(&outbox->lock, NULL);
+		outbox->enabled = false;
+		outbox->head = outbox->count = 0;
+		memset(outbox->position, 0xff, leaves * sizeof(int16_t));
+		x->outbox = outbox;
+	}
+
+	pthread_mutex_lock(&outbox->lock);
+	bool started = outbox->enabled;
+	outbox->rate = rate;
+	if(!started){
+		outbox->tokens = 1;
+		outbox->refilled = monotonicMs();
+		outbox->enabled = true;
+	}
+	pthread_mutex_unlock(&outbox->lock);
+
+	if(!started && (outbox->timer = X32Every(OUTBOX_PERIOD, outboxTick, outbox)) < 0){
+		X32OutboxStop();
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Sends every pending write of the current session now, over budget if
+ * need be, eg. when a fader is released.
+ *
+ * Returns the number of packets sent, or -1 on error
+ */
+int X32OutboxFlush(void){
+	struct x32_outbox *outbox = X32Socket()->outbox;
+	struct x32_batch batch;
+	int sent = 0;
+
+	if(outbox == NULL){
+		return 0;
+	}
+	pthread_mutex_lock(&outbox->lock);
+	X32BatchBegin(&batch);
+	while(outbox->count > 0){
+		int res = outboxPacket(outbox);
+		if(res < 0){
+			sent = -1;
+			break;
+		}
+		sent += res > 0;
+	}
+	if(X32BatchEnd(&batch) < 0){
+		sent = -1;
+	}
+	pthread_mutex_unlock(&outbox->lock);
+	return sent;
+}
+
+/**
+ * Flushes the outbox of the current session and sends directly again.
+ */
+void X32OutboxStop(void){
+	struct x32_outbox *outbox = X32Socket()->outbox;
+	if(outbox == NULL){
+		return;
+	}
+
+	pthread_mutex_lock(&outbox->lock);
+	bool started = outbox->enabled;
+	outbox->enabled = false;
+	pthread_mutex_unlock(&outbox->lock);
+
+	if(started){
+		X32CancelTimer(outbox->timer);
+	}
+	X32OutboxFlush();
+}
+
+/**
+ * Stops the outbox of the current session, as X32OutboxStop, and frees it.
+ * Nothing may dispatch to the session anymore, see X32SessionFree.
+ */
+void X32OutboxFree(void){
+	struct x32_socket *x = X32Socket();
+	struct x32_outbox *outbox = x->outbox;
+	if(outbox == NULL){
+		return;
+	}
+	X32OutboxStop();
+	x->outbox = NULL;
+	pthread_mutex_destroy(&outbox->lock);
+	free(outbox);
+}
+
+/**
+ * Sends a message through the outbox of the current session, see X32Send.
+ *
+ * Returns length or the response from X32Transmit, -1 on error
+ */
+int X32OutboxSend(char *buffer, int length){
+	struct x32_outbox *outbox = X32Socket()->outbox;
+	struct osc_message msg;
+	int id = -1;
+
+	if(length >= 16 && memcmp(buffer, "#bundle\0", 8) == 0){
+		return outboxBundle(outbox, buffer, length);
+	}
+	if(oscDecode(buffer, length, &msg) >= 0){
+		id = oscIndexLookup(msg.address.ptr, msg.address.len);
+	}
+	if(id < 0){
+		return X32Transmit(buffer, length);
+	}
+
+	pthread_mutex_lock(&outbox->lock);
+	int res;
+	if(outbox->enabled && msg.argc > 0 && length <= OUTBOX_MESSAGE_MAX){
+		res = outboxPut(outbox, id, buffer, length);
+	}else{
+		// a query or an oversized write: a pending write to the same leaf
+		// goes first
+		res = outboxAhead(outbox, id, false);
+		if(res >= 0){
+			res = X32Transmit(buffer, length);
+		}
+	}
+	pthread_mutex_unlock(&outbox->lock);
+	return res;
+}
@@ -0,0 +1,118 @@
+/*
+ * M32Packet.c
+ *
+ * Packet pool. Received datagrams land in fixed size packets of
+ * PACKET_SIZE bytes, large enough for any datagram the console sends, so
+ * /node text and meter blobs are never truncated. A packet is reference
+ * counted: the receive path hands it to X32DispatchPacket, and a reply
+ * callback or the subscriber queue keeps it by taking a reference instead
+ * of copying the datagram.
+ *
+ * PACKET_POOL_SIZE packets are preallocated in one slab. Free packets form
+ * a lock-free stack whose head carries a change count with the index, so a
+ * head popped and pushed back between a reader's load and its compare and
+ * swap is not mistaken for the one it read. Only when every pool packet is
+ * in use does a packet come from the heap (counted as METRIC_POOL_MISSES);
+ * steady traffic allocates nothing.
+ */
+#include "M32.h"
+
+#include <stddef.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+static struct x32_packet pool[PACKET_POOL_SIZE];
+static atomic_ullong pool_head; // change count << 32 | index + 1 of the top free packet, 0 if none
+static pthread_once_t pool_once = PTHREAD_ONCE_INIT;
+
+/**
+ * Links every pool packet into the free stack.
+ */
+static void poolInit(void){
+	for(int i = 0; i < PACKET_POOL_SIZE; i++){
+		atomic_store_explicit(&pool[i].next, i + 1 < PACKET_POOL_SIZE ? i + 2 : 0, memory_order_relaxed);
+	}
+	atomic_store_explicit(&pool_head, 1, memory_order_release);
+}
+
+static bool poolOwns(const struct x32_packet *packet){
+	return packet >= pool && packet < pool + PACKET_POOL_SIZE;
+}
+
+/**
+ * Takes a packet from the pool, or from the heap if the pool is empty.
+ *
+ * Returns the packet with one reference and no data, NULL if out of memory
+ */
+struct x32_packet *X32PacketAlloc(void){
+	pthread_once(&pool_once, poolInit);
+
+	unsigned long long head = atomic_load_explicit(&pool_head, memory_order_acquire);
+	struct x32_packet *packet = NULL;
+	for(;;){
+		uint32_t top = (uint32_t)head;
+		if(top == 0){
+			break;
+		}
+		// a stale link only makes the exchange fail: the count moved on
+		uint32_t next = atomic_load_explicit(&pool[top - 1].next, memory_order_relaxed);
+		unsigned long long swap = ((head >> 32) + 1) << 32 | next;
+		if(atomic_compare_exchange_weak_explicit(&pool_head, &head, swap, memory_order_acquire, memory_order_acquire)){
+			packet = pool + top - 1;
+			break;
+		}
+	}
+	if(packet == NULL){
+		metricCount(METRIC_POOL_MISSES, 1);
+		if((packet = malloc(sizeof(struct x32_packet))) == NULL){
+			return NULL;
+		}
+	}
+	atomic_store_explicit(&packet->refs, 1, memory_order_relaxed);
+	packet->length = 0;
+	return packet;
+}
+
+/**
+ * Takes another reference to a packet, eg. to keep a reply past its
+ * callback.
+ *
+ * Returns packet
+ */
+struct x32_packet *X32PacketRetain(struct x32_packet *packet){
+	atomic_fetch_add_explicit(&packet->refs, 1, memory_order_relaxed);
+	return packet;
+}
+
+/**
+ * Drops a reference to a packet; the last one returns it to the pool.
+ * packet: may be NULL
+ */
+void X32PacketRelease(struct x32_packet *packet){
+	if(packet == NULL || atomic_fetch_sub_explicit(&packet->refs, 1, memory_order_acq_rel) != 1){
+		return;
+	}
+	if(!poolOwns(packet)){
+		free(packet);
+		return;
+	}
+
+	uint32_t index = packet - pool + 1;
+	unsigned long long head = atomic_load_explicit(&pool_head, memory_order_relaxed);
+	unsigned long long swap;
+	do{
+		atomic_store_explicit(&packet->next, (uint32_t)head, memory_order_relaxed);
+		swap = ((head >> 32) + 1) << 32 | index;
+	}while(!atomic_compare_exchange_weak_explicit(&pool_head, &head, swap, memory_order_release, memory_order_relaxed));
+}
+
+/**
+ * Finds the packet holding a dispatched message, eg. the buffer handed to
+ * a reply callback, to retain it.
+ * data: the start of a packet's data
+ *
+ * Returns the packet
+ */
+struct x32_packet *X32PacketOf(const char *data){
+	return (struct x32_packet *)(data - offsetof(struct x32_packet, data));
+}
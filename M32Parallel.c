@@ -0,0 +1,253 @@
+/*
+ * M32Parallel.c
+ *
+ * Parallel snapshot of every parameter. The console paces the replies it
+ * sends to each client, so a single socket tops out however deep its
+ * pipeline is. X32ParallelNew opens K more sessions to the current
+ * session's console, each with its own socket and so its own source port,
+ * and X32ParallelFetch splits the node index into K runs of consecutive
+ * leaf ids (the config tree, channels, buses, ... in tree order), fetched
+ * at once by one thread per socket with X32Pipeline.
+ *
+ * A fetch goes in rounds. The first socket holds an /xremote subscription,
+ * renewed every XREMOTE_RENEW ms while the fetch runs, so the console
+ * reports every change made meanwhile by its surface or other clients;
+ * the thread pumping that socket flags the leaves changed, which the
+ * fetching thread reads and clears atomically. After a round, the leaves that could not be fetched and
+ * the leaves reported changed are fetched again, split over the sockets
+ * the same way, until a round ends with nothing missing and nothing
+ * changed or PARALLEL_ROUNDS have run.
+ *
+ * The shards write disjoint parts of one value array, which the caller
+ * only sees once the last round is done. Only a complete snapshot, that
+ * no change reported during its last round, is stamped with a generation
+ * number, which grows with every such snapshot taken in the process.
+ */
+#include "M32.h"
+
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <arpa/inet.h>
+
+struct parallel_shard{
+	struct x32_session *session;
+	pthread_t thread;
+	struct x32_query *queries; // this shard's run of x32_parallel.pending
+	int count;
+	int window;
+	int answered; // X32Pipeline result of the last round
+};
+
+struct x32_parallel{
+	int sockets;
+	struct x32_query *queries; // one per leaf, by leaf id
+	struct x32_query *pending; // queries of the current round
+	atomic_uchar *changed; // by leaf id, reported by /xremote this round
+	struct parallel_shard shards[];
+};
+
+static atomic_ullong generations; // complete snapshots taken so far
+
+/**
+ * Marks the leaf of a message pushed to the first socket as changed.
+ * Called by the thread pumping that socket, see X32Subscribe.
+ */
+static void parallelPush(const struct osc_message *msg, const char *buffer, int length, void *ctx){
+	struct x32_parallel *p = ctx;
+	int id = oscIndexLookup(msg->address.ptr, msg->address.len);
+	if(id >= 0){
+		atomic_store(p->changed + id, 1);
+	}
+}
+
+static void parallelRenew(void *ctx){
+	generateAndSendMessage("/xremote");
+}
+
+/**
+ * Opens `sockets` sessions to the console of the current session, which
+ * must be connected, for X32ParallelFetch.
+ * sockets: 1 to PARALLEL_MAX
+ *
+ * Returns the sessions, or NULL on error
+ */
+struct x32_parallel *X32ParallelNew(int sockets){
+	struct x32_socket *x = X32Socket();
+	char ip[INET_ADDRSTRLEN];
+	if(sockets < 1 || sockets > PARALLEL_MAX || x->fd < 0 || oscIndexInit() < 0
+			|| inet_ntop(AF_INET, &x->address.sin_addr, ip, sizeof(ip)) == NULL){
+		return NULL;
+	}
+	int port = ntohs(x->address.sin_port);
+
+	int count = oscIndexCount();
+	struct x32_parallel *p = calloc(1, sizeof(struct x32_parallel) + sockets * sizeof(struct parallel_shard));
+	if(p == NULL){
+		return NULL;
+	}
+	p->queries = malloc(count * sizeof(struct x32_query));
+	p->pending = malloc(count * sizeof(struct x32_query));
+	p->changed = calloc(count, sizeof(atomic_uchar));
+	if(p->queries == NULL || p->pending == NULL || p->changed == NULL){
+		X32ParallelFree(p);
+		return NULL;
+	}
+	for(int id = 0; id < count; id++){
+		strcpy(p->queries[id].address, oscIndexAddress(id));
+		p->queries[id].id = id;
+		p->queries[id].kind = FIELD_VALUE;
+		p->queries[id].size = sizeof(struct x32_value);
+	}
+
+	for(int i = 0; i < sockets; i++){
+		struct parallel_shard *shard = p->shards + i;
+		shard->session = X32SessionNew();
+		if(shard->session == NULL){
+			X32ParallelFree(p);
+			return NULL;
+		}
+		p->sockets++;
+		struct x32_session *previous = X32Use(shard->session);
+		int res = 0;
+		for(int tries = 0; tries <= X32_RETRIES && res == 0; tries++){
+			res = X32Connect(ip, port); // 0 when /info got no answer
+		}
+		if(res == 1 && i == 0 && X32Subscribe("/*", parallelPush, p) < 0){
+			res = -1;
+		}
+		X32Use(previous);
+		if(res != 1){
+			X32ParallelFree(p);
+			return NULL;
+		}
+	}
+	return p;
+}
+
+/**
+ * Closes the sessions of X32ParallelNew.
+ */
+void X32ParallelFree(struct x32_parallel *p){
+	if(p == NULL){
+		return;
+	}
+	for(int i = 0; i < p->sockets; i++){
+		X32SessionFree(p->shards[i].session);
+	}
+	free(p->queries);
+	free(p->pending);
+	free(p->changed);
+	free(p);
+}
+
+static void *shardFetch(void *arg){
+	struct parallel_shard *shard = arg;
+	X32Use(shard->session);
+	shard->answered = shard->count > 0 ? X32Pipeline(shard->queries, shard->count, shard->window) : 0;
+	return NULL;
+}
+
+/**
+ * Fetches the first n pending queries, split into one run per socket.
+ *
+ * Returns the number of queries answered, or -1 on error
+ */
+static int parallelRound(struct x32_parallel *p, int n, int window){
+	for(int i = 0; i < p->sockets; i++){
+		struct parallel_shard *shard = p->shards + i;
+		int first = (long)n * i / p->sockets;
+		shard->queries = p->pending + first;
+		shard->count = (long)n * (i + 1) / p->sockets - first;
+		shard->window = window;
+		if(pthread_create(&shard->thread, NULL, shardFetch, shard) != 0){
+			shard->thread = pthread_self();
+			struct x32_session *previous = X32Current();
+			shardFetch(shard);
+			X32Use(previous);
+		}
+	}
+
+	int answered = 0;
+	for(int i = 0; i < p->sockets; i++){
+		struct parallel_shard *shard = p->shards + i;
+		if(!pthread_equal(shard->thread, pthread_self())){
+			pthread_join(shard->thread, NULL);
+		}
+		if(shard->answered < 0){
+			answered = -1;
+		}else if(answered >= 0){
+			answered += shard->answered;
+		}
+	}
+	return answered;
+}
+
+/**
+ * Fetches every leaf of the node index, like X32ShowFetch, over all the
+ * sockets of p at once, fetching again the leaves that failed or that the
+ * console reported changed meanwhile, see the top of this file. Leaves that
+ * could not be fetched are left with type 0.
+ * values: oscIndexCount() entries, by leaf id
+ * window: in-flight query limit per socket, 0 for PIPELINE_WINDOW
+ * generation: receives the stamp of the snapshot, 0 if it is incomplete
+ *             or was still changing; may be NULL
+ *
+ * Returns the number of leaves missing or changed after the last round,
+ * 0 for a complete snapshot, or -1 on error
+ */
+int X32ParallelFetch(struct x32_parallel *p, struct x32_value *values, int window, unsigned long long *generation){
+	if(generation != NULL){
+		*generation = 0;
+	}
+	int count = oscIndexCount();
+	if(p == NULL || values == NULL || count < 1){
+		return -1;
+	}
+	for(int id = 0; id < count; id++){
+		values[id].type = 0;
+		p->queries[id].dest = values + id;
+	}
+	memcpy(p->pending, p->queries, count * sizeof(struct x32_query));
+	for(int id = 0; id < count; id++){
+		atomic_store_explicit(p->changed + id, 0, memory_order_relaxed);
+	}
+
+	struct x32_session *previous = X32Use(p->shards[0].session);
+	int renew = X32Every(XREMOTE_RENEW, parallelRenew, NULL);
+	int res = renew < 0 ? -1 : generateAndSendMessage("/xremote");
+	X32Use(previous);
+
+	int n = count;
+	for(int round = 0; round < PARALLEL_ROUNDS && n > 0 && res >= 0; round++){
+		if(parallelRound(p, n, window) < 0){
+			res = -1;
+			break;
+		}
+		// changes pushed after the first socket's run ended
+		unsigned dispatched = 0;
+		previous = X32Use(p->shards[0].session);
+		while(X32Wait(&dispatched, 0) > 0);
+		X32Use(previous);
+
+		n = 0;
+		for(int id = 0; id < count; id++){
+			bool changed = atomic_exchange(p->changed + id, 0);
+			if(values[id].type == 0 || changed){
+				values[id].type = 0;
+				p->pending[n++] = p->queries[id];
+			}
+		}
+	}
+
+	previous = X32Use(p->shards[0].session);
+	X32CancelTimer(renew);
+	X32Use(previous);
+	if(res < 0){
+		return -1;
+	}
+	if(n == 0 && generation != NULL){
+		*generation = atomic_fetch_add(&generations, 1) + 1;
+	}
+	return n;
+}
@@ -0,0 +1,547 @@
+/*
+ * M32Show.c
+ *
+ * Show files: any number of scenes, each the value of every leaf of the
+ * node index, in one packed little-endian file that is mmap()ed and read
+ * in place. Nothing is parsed when a show is opened besides the header
+ * (and the leaf table of a show written with another node tree); a scene,
+ * or one section of it (a channel strip, a bus, a config group), is
+ * located through the tables at the start of the file and its values are
+ * read straight from the mapping.
+ *
+ *     header         struct show_header
+ *     sections       struct show_section[section_count], leaf id ranges
+ *     scenes         struct show_scene[scene_count]
+ *     leaves         struct show_leaf[leaf_count], address and type of
+ *                    every leaf of the tree the file was written with
+ *     scene values   per scene: uint32_t[leaf_count] by leaf id (ints and
+ *                    float bits, or string offsets), then uint8_t[leaf_count]
+ *                    OSC types (0 for leaves not captured), padded to 4
+ *     strings        null terminated, referenced from the values and leaves
+ *
+ * Leaf ids are only meaningful for one node tree, so the header carries a
+ * hash of every leaf address and type. When it matches the running tree
+ * the file is read by leaf id as it is; otherwise X32ShowOpen maps every
+ * leaf of the file to the current leaf of the same address and type, and
+ * leaves that were removed or changed type are left out of recalls.
+ */
+#include "M32.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <endian.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define SHOW_MAGIC "M32SHOW"
+
+struct show_header{
+	char magic[8]; // SHOW_MAGIC, null terminated
+	uint16_t version;
+	uint16_t section_count;
+	uint16_t scene_count;
+	uint16_t reserved;
+	uint32_t leaf_count;
+	uint32_t tree_hash; // see showTreeHash
+	uint32_t strings_offset;
+	uint32_t strings_size;
+};
+
+struct show_section{
+	char name[24]; // eg. "/ch/01", "/config/routing"
+	uint32_t first; // leaf id
+	uint32_t count;
+};
+
+struct show_scene{
+	char name[SHOW_NAME_MAX];
+	uint32_t values_offset; // leaf_count values, then leaf_count types
+	uint32_t reserved;
+};
+
+struct show_leaf{
+	uint32_t address; // string offset
+	uint8_t type; // OSC type in the writer's tree
+	uint8_t reserved[3];
+};
+
+_Static_assert(sizeof(struct show_header) == 32, "show header must be packed");
+_Static_assert(sizeof(struct show_section) == 32, "show section must be packed");
+_Static_assert(sizeof(struct show_scene) == SHOW_NAME_MAX + 8, "show scene must be packed");
+_Static_assert(sizeof(struct show_leaf) == 8, "show leaf must be packed");
+
+static uint32_t tree_hash;
+static struct show_section *tree_sections; // of the running tree
+static int tree_section_count;
+static pthread_once_t tree_once = PTHREAD_ONCE_INIT;
+
+static int showSections(struct show_section *sections);
+
+static void treeInit(void){
+	uint32_t h = 2166136261u; // FNV-1a
+	for(int id = 0; id < oscIndexCount(); id++){
+		const char *address = oscIndexAddress(id);
+		for(int i = 0; address[i] != '\0'; i++){
+			h = (h ^ (uint8_t)address[i]) * 16777619u;
+		}
+		h = (h ^ (uint8_t)oscIndexType(id)) * 16777619u;
+	}
+	tree_hash = h;
+
+	int count = showSections(NULL);
+	tree_sections = malloc(count * sizeof(struct show_section));
+	if(tree_sections != NULL){
+		tree_section_count = showSections(tree_sections);
+	}
+}
+
+/**
+ * Returns the hash of every leaf address and type of the node index
+ */
+static uint32_t showTreeHash(void){
+	pthread_once(&tree_once, treeInit);
+	return tree_hash;
+}
+
+/**
+ * Length of the section name of a leaf address: its first two components,
+ * "/ch/01" of "/ch/01/gate/thr".
+ */
+static int sectionNameLength(const char *address){
+	const char *end = strchr(address + 1, '/');
+	if(end != NULL){
+		const char *next = strchr(end + 1, '/');
+		end = next != NULL ? next : end + strlen(end);
+	}else{
+		end = address + strlen(address);
+	}
+	return end - address;
+}
+
+/**
+ * Splits the node index into sections: runs of consecutive leaf ids with
+ * the same section name.
+ * sections: NULL to only count them
+ *
+ * Returns the number of sections
+ */
+static int showSections(struct show_section *sections){
+	int count = 0;
+	for(int id = 0; id < oscIndexCount();){
+		const char *address = oscIndexAddress(id);
+		int len = sectionNameLength(address);
+		int end = id + 1;
+		while(end < oscIndexCount() && strncmp(oscIndexAddress(end), address, len) == 0 && sectionNameLength(oscIndexAddress(end)) == len){
+			end++;
+		}
+		if(sections != NULL){
+			struct show_section *s = sections + count;
+			memset(s->name, 0, sizeof(s->name));
+			memcpy(s->name, address, len < (int)sizeof(s->name) - 1 ? len : (int)sizeof(s->name) - 1);
+			s->first = htole32(id);
+			s->count = htole32(end - id);
+		}
+		count++;
+		id = end;
+	}
+	return count;
+}
+
+/**
+ * Fetches every leaf of the node index with a pipelined query window, for
+ * X32ShowWrite. Leaves that could not be fetched are left with type 0.
+ * values: oscIndexCount() entries, by leaf id
+ * window: in-flight query limit, 0 for PIPELINE_WINDOW
+ *
+ * Returns the number of leaves that could not be fetched, or -1 on error
+ */
+int X32ShowFetch(struct x32_value *values, int window){
+	if(oscIndexInit() < 0){
+		return -1;
+	}
+	int count = oscIndexCount();
+	struct x32_query *queries = malloc(count * sizeof(struct x32_query));
+	if(queries == NULL){
+		return -1;
+	}
+
+	for(int id = 0; id < count; id++){
+		values[id].type = 0;
+		strcpy(queries[id].address, oscIndexAddress(id));
+		queries[id].id = id;
+		queries[id].dest = values + id;
+		queries[id].kind = FIELD_VALUE;
+		queries[id].size = sizeof(struct x32_value);
+	}
+
+	int res = X32Pipeline(queries, count, window);
+	free(queries);
+	if(res < 0){
+		return -1;
+	}
+	return count - res;
+}
+
+/**
+ * Writes a show file, replacing path only once it is complete.
+ * names: name of each scene, at most SHOW_NAME_MAX - 1 characters kept
+ * scenes: for each scene, oscIndexCount() values by leaf id; values with
+ *         type 0 are stored as not captured
+ * count: number of scenes
+ *
+ * Returns the file size, or -1 on error
+ */
+long X32ShowWrite(const char *path, const char *const *names, const struct x32_value *const *scenes, int count){
+	if(path == NULL || count < 0 || count > UINT16_MAX || oscIndexInit() < 0){
+		return -1;
+	}
+
+	int leaves = oscIndexCount();
+	int section_count = showSections(NULL);
+	size_t scene_size = leaves * 4 + round4(leaves);
+	size_t leaves_offset = sizeof(struct show_header) + section_count * sizeof(struct show_section) + count * sizeof(struct show_scene);
+	size_t values_offset = leaves_offset + leaves * sizeof(struct show_leaf);
+	size_t strings_offset = values_offset + count * scene_size;
+
+	size_t strings_size = 0;
+	for(int id = 0; id < leaves; id++){
+		strings_size += strlen(oscIndexAddress(id)) + 1;
+	}
+	for(int s = 0; s < count; s++){
+		for(int id = 0; id < leaves; id++){
+			if(scenes[s][id].type == 's'){
+				strings_size += strnlen(scenes[s][id].s, X32_STRING_MAX - 1) + 1;
+			}
+		}
+	}
+	if(strings_offset + strings_size > UINT32_MAX){
+		return -1;
+	}
+
+	size_t size = strings_offset + strings_size;
+	char *file = calloc(1, size);
+	if(file == NULL){
+		return -1;
+	}
+
+	struct show_header *header = (struct show_header *)file;
+	memcpy(header->magic, SHOW_MAGIC, sizeof(SHOW_MAGIC));
+	header->version = htole16(SHOW_VERSION);
+	header->section_count = htole16(section_count);
+	header->scene_count = htole16(count);
+	header->leaf_count = htole32(leaves);
+	header->tree_hash = htole32(showTreeHash());
+	header->strings_offset = htole32(strings_offset);
+	header->strings_size = htole32(strings_size);
+	showSections((struct show_section *)(header + 1));
+
+	struct show_leaf *leaf_table = (struct show_leaf *)(file + leaves_offset);
+	size_t string = 0;
+	for(int id = 0; id < leaves; id++){
+		const char *address = oscIndexAddress(id);
+		int len = strlen(address);
+		memcpy(file + strings_offset + string, address, len);
+		leaf_table[id].address = htole32(string);
+		leaf_table[id].type = oscIndexType(id);
+		string += len + 1;
+	}
+
+	struct show_scene *scene_table = (struct show_scene *)(file + leaves_offset - count * sizeof(struct show_scene));
+	for(int s = 0; s < count; s++){
+		size_t offset = values_offset + s * scene_size;
+		strncpy(scene_table[s].name, names != NULL && names[s] != NULL ? names[s] : "", SHOW_NAME_MAX - 1);
+		scene_table[s].values_offset = htole32(offset);
+
+		uint32_t *values = (uint32_t *)(file + offset);
+		uint8_t *types = (uint8_t *)(values + leaves);
+		for(int id = 0; id < leaves; id++){
+			const struct x32_value *value = scenes[s] + id;
+			uint32_t bits = 0;
+			if(value->type == 's'){
+				int len = strnlen(value->s, X32_STRING_MAX - 1);
+				memcpy(file + strings_offset + string, value->s, len);
+				bits = string;
+				string += len + 1;
+			}else if(value->type == 'i' || value->type == 'f'){
+				memcpy(&bits, &value->i, 4); // same bits for either member
+			}else{
+				continue;
+			}
+			values[id] = htole32(bits);
+			types[id] = value->type;
+		}
+	}
+
+	char tmp[4096];
+	if(snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int)sizeof(tmp)){
+		free(file);
+		return -1;
+	}
+	FILE *f = fopen(tmp, "wb");
+	int ok = f != NULL && fwrite(file, 1, size, f) == size;
+	if(f != NULL && fclose(f) != 0){
+		ok = 0;
+	}
+	free(file);
+	if(!ok || rename(tmp, path) != 0){
+		unlink(tmp);
+		return -1;
+	}
+	return size;
+}
+
+static const struct show_header *showHeader(const struct x32_show *show){
+	return (const struct show_header *)show->map;
+}
+
+static const struct show_leaf *showLeaves(const struct x32_show *show){
+	return (const struct show_leaf *)(show->map + sizeof(struct show_header) + show->sections * sizeof(struct show_section)
+			+ show->scenes * sizeof(struct show_scene));
+}
+
+/**
+ * Maps the leaves of a show written with another node tree to the leaves
+ * of the running one by address. Leaves whose address is gone or whose
+ * type changed are not mapped, leaves added since are not in the show.
+ *
+ * Returns 0 on success, -1 on error, -2 on a malformed leaf table
+ */
+static int showMapLeaves(struct x32_show *show){
+	const struct show_header *header = showHeader(show);
+	const struct show_leaf *leaves = showLeaves(show);
+	const char *strings = show->map + le32toh(header->strings_offset);
+	uint32_t strings_size = le32toh(header->strings_size);
+
+	int32_t *slots = malloc(oscIndexCount() * sizeof(int32_t));
+	if(slots == NULL){
+		return -1;
+	}
+	for(int id = 0; id < oscIndexCount(); id++){
+		slots[id] = -1;
+	}
+	for(int i = 0; i < show->leaves; i++){
+		uint32_t offset = le32toh(leaves[i].address);
+		int len = offset < strings_size ? strnlen(strings + offset, strings_size - offset) : 0;
+		if(offset >= strings_size || offset + len == strings_size){
+			free(slots);
+			return -2;
+		}
+		int id = oscIndexLookup(strings + offset, len);
+		if(id >= 0 && oscIndexType(id) == leaves[i].type){
+			slots[id] = i;
+		}
+	}
+	show->slots = slots;
+	return 0;
+}
+
+/**
+ * Maps a show file and checks its header and tables. The values are not
+ * read until a scene or section is accessed. A show written with another
+ * node tree has its leaves matched to the running tree by address first.
+ *
+ * Returns 0 on success, -1 if the file cannot be read, -2 if it is not a
+ * show file of this version
+ */
+int X32ShowOpen(const char *path, struct x32_show *show){
+	if(oscIndexInit() < 0){
+		return -1;
+	}
+	int fd = open(path, O_RDONLY);
+	if(fd < 0){
+		return -1;
+	}
+	struct stat st;
+	if(fstat(fd, &st) < 0){
+		close(fd);
+		return -1;
+	}
+	if(st.st_size < (off_t)sizeof(struct show_header) || st.st_size > UINT32_MAX){
+		close(fd);
+		return -2;
+	}
+	void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(map == MAP_FAILED){
+		return -1;
+	}
+
+	show->map = map;
+	show->size = st.st_size;
+	show->slots = NULL;
+	const struct show_header *header = map;
+	show->sections = le16toh(header->section_count);
+	show->scenes = le16toh(header->scene_count);
+	show->leaves = le32toh(header->leaf_count);
+
+	size_t leaves = show->leaves;
+	size_t tables = (const char *)showLeaves(show) - show->map + leaves * sizeof(struct show_leaf);
+	size_t strings_end = (size_t)le32toh(header->strings_offset) + le32toh(header->strings_size);
+	bool valid = memcmp(header->magic, SHOW_MAGIC, sizeof(SHOW_MAGIC)) == 0 && le16toh(header->version) == SHOW_VERSION
+			&& leaves <= INT32_MAX && tables <= show->size && strings_end <= show->size;
+
+	const struct show_scene *scenes = (const struct show_scene *)((const char *)showLeaves(show) - show->scenes * sizeof(struct show_scene));
+	for(int s = 0; valid && s < show->scenes; s++){
+		size_t offset = le32toh(scenes[s].values_offset);
+		valid = offset % 4 == 0 && offset + leaves * 4 + leaves <= show->size;
+	}
+	int res = valid ? 0 : -2;
+	if(valid && (leaves != (size_t)oscIndexCount() || le32toh(header->tree_hash) != showTreeHash())){
+		res = showMapLeaves(show);
+	}
+	if(res < 0){
+		X32ShowClose(show);
+	}
+	return res;
+}
+
+/**
+ * Unmaps a show opened with X32ShowOpen.
+ */
+void X32ShowClose(struct x32_show *show){
+	if(show->map != NULL){
+		munmap((void *)show->map, show->size);
+	}
+	free(show->slots);
+	show->map = NULL;
+	show->slots = NULL;
+	show->size = 0;
+	show->scenes = show->sections = show->leaves = 0;
+}
+
+static const struct show_scene *showScene(const struct x32_show *show, int scene){
+	const struct show_scene *scenes = (const struct show_scene *)(show->map + sizeof(struct show_header) + show->sections * sizeof(struct show_section));
+	return scenes + scene;
+}
+
+/**
+ * Looks up a scene by name.
+ *
+ * Returns the scene number, or -1 if there is none of that name
+ */
+int X32ShowFindScene(const struct x32_show *show, const char *name){
+	for(int s = 0; s < show->scenes; s++){
+		if(strncmp(showScene(show, s)->name, name, SHOW_NAME_MAX) == 0){
+			return s;
+		}
+	}
+	return -1;
+}
+
+/**
+ * Returns the name of a scene, or NULL if there is no such scene
+ */
+const char *X32ShowSceneName(const struct x32_show *show, int scene){
+	if(scene < 0 || scene >= show->scenes){
+		return NULL;
+	}
+	return showScene(show, scene)->name;
+}
+
+/**
+ * Looks up the leaves of a section, eg. "/ch/05" or "/config/routing".
+ * first, count: receive the range of leaf ids in the running tree
+ *
+ * Returns 0 on success, -1 if the show or the running tree has no such
+ * section
+ */
+int X32ShowFindSection(const struct x32_show *show, const char *name, int *first, int *count){
+	const struct show_section *sections = (const struct show_section *)(showHeader(show) + 1);
+	int i;
+	for(i = 0; i < show->sections && strncmp(sections[i].name, name, sizeof(sections[i].name)) != 0; i++);
+	if(i == show->sections){
+		return -1;
+	}
+	if(show->slots == NULL){
+		*first = le32toh(sections[i].first);
+		*count = le32toh(sections[i].count);
+		return *first + *count <= oscIndexCount() ? 0 : -1;
+	}
+
+	// written with another tree: the section as the running tree has it
+	showTreeHash();
+	for(i = 0; i < tree_section_count; i++){
+		if(strncmp(tree_sections[i].name, name, sizeof(tree_sections[i].name)) == 0){
+			*first = le32toh(tree_sections[i].first);
+			*count = le32toh(tree_sections[i].count);
+			return 0;
+		}
+	}
+	return -1;
+}
+
+/**
+ * Reads one value of a scene from the mapping.
+ * id: leaf id in the running tree
+ *
+ * Returns 0 on success, -1 if the scene holds no value for the leaf
+ */
+int X32ShowValue(const struct x32_show *show, int scene, int id, struct x32_value *value){
+	if(scene < 0 || scene >= show->scenes || id < 0 || id >= oscIndexCount()){
+		return -1;
+	}
+	int leaf = show->slots != NULL ? show->slots[id] : id;
+	if(leaf < 0){
+		return -1;
+	}
+	const uint32_t *values = (const uint32_t *)(show->map + le32toh(showScene(show, scene)->values_offset));
+	const uint8_t *types = (const uint8_t *)(values + show->leaves);
+
+	uint32_t bits = le32toh(values[leaf]);
+	value->type = types[leaf];
+	if(value->type == 'i' || value->type == 'f'){
+		memcpy(&value->i, &bits, 4);
+		return 0;
+	}
+	if(value->type != 's'){
+		return -1;
+	}
+
+	const struct show_header *header = showHeader(show);
+	uint32_t strings_size = le32toh(header->strings_size);
+	if(bits >= strings_size){
+		return -1;
+	}
+	const char *s = show->map + le32toh(header->strings_offset) + bits;
+	int len = strnlen(s, strings_size - bits);
+	if(len >= X32_STRING_MAX){
+		len = X32_STRING_MAX - 1;
+	}
+	memcpy(value->s, s, len);
+	value->s[len] = '\0';
+	return 0;
+}
+
+/**
+ * Recalls a scene, or one section of it, with X32Sync: only parameters
+ * that differ from the console are written.
+ * section: section name as for X32ShowFindSection, NULL for the whole scene
+ * rate: most messages per second, 0 for SYNC_RATE
+ *
+ * Returns the number of parameters written, or -1 on error
+ */
+int X32ShowApply(const struct x32_show *show, int scene, const char *section, int rate){
+	int first = 0, count = oscIndexCount();
+	if(scene < 0 || scene >= show->scenes || (section != NULL && X32ShowFindSection(show, section, &first, &count) < 0)){
+		return -1;
+	}
+
+	int *ids = malloc(count * sizeof(int));
+	struct x32_value *values = malloc(count * sizeof(struct x32_value));
+	int res = -1;
+	if(ids != NULL && values != NULL){
+		int n = 0;
+		for(int i = 0; i < count; i++){
+			if(X32ShowValue(show, scene, first + i, values + n) == 0){
+				ids[n++] = first + i;
+			}
+		}
+		res = X32Sync(ids, values, n, rate);
+	}
+	free(ids);
+	free(values);
+	return res;
+}
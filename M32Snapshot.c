@@ -0,0 +1,752 @@
+/*
+ * M32Snapshot.c
+ *
+ * Pipelined parameter fetch. Rather than sending one query and waiting up
+ * to TIMEOUT for its answer before sending the next one, a window of queries
+ * is kept on the wire at once. Replies are matched back to their request by
+ * OSC address (the console answers a get with the same address) in the
+ * multiplexer, so they may arrive in any order. Lost queries are
+ * retransmitted a bounded number of times before they are given up.
+ *
+ * Whole channels can also be fetched with /node queries, one per parameter
+ * group instead of one per parameter, see M32Node.c.
+ *
+ * Writing back goes the other way: every field is packed into OSC bundles
+ * so a whole channel strip costs a handful of datagrams.
+ */
+#include "M32.h"
+
+#include <stddef.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include <stdio.h>
+
+#define CH_FIELD(path, kind, member) \
+	{path, kind, sizeof(((struct channel *)0)->member), offsetof(struct channel, member)}
+
+#define CH_EQ_BAND(n, member) \
+	CH_FIELD("/eq/" #n "/type", FIELD_U8, member.type), \
+	CH_FIELD("/eq/" #n "/f", FIELD_FLOAT, member.f), \
+	CH_FIELD("/eq/" #n "/g", FIELD_FLOAT, member.g), \
+	CH_FIELD("/eq/" #n "/q", FIELD_FLOAT, member.q)
+
+// an odd send with the even one that follows its pan and tap point
+#define CH_SEND_PAIR(odd, even, n) \
+	CH_FIELD("/mix/" #odd "/on", FIELD_BOOL, mix.sends[n].on), \
+	CH_FIELD("/mix/" #odd "/level", FIELD_FLOAT, mix.sends[n].level), \
+	CH_FIELD("/mix/" #odd "/pan", FIELD_FLOAT, mix.sends[n].pan), \
+	CH_FIELD("/mix/" #odd "/type", FIELD_U8, mix.sends[n].type), \
+	CH_FIELD("/mix/" #odd "/panFollow", FIELD_BOOL, mix.sends[n].pan_follow), \
+	CH_FIELD("/mix/" #even "/on", FIELD_BOOL, mix.sends[n + 1].on), \
+	CH_FIELD("/mix/" #even "/level", FIELD_FLOAT, mix.sends[n + 1].level)
+
+// Every leaf of /ch/NN that has a home in struct channel
+const struct channel_field channel_fields[] = {
+	// Config
+	CH_FIELD("/config/name", FIELD_STRING, config.scribble.name),
+	CH_FIELD("/config/icon", FIELD_U8, config.scribble.icon),
+	CH_FIELD("/config/color", FIELD_U8, config.scribble.color),
+	CH_FIELD("/config/source", FIELD_U8, config.source),
+
+	// Delay
+	CH_FIELD("/delay/on", FIELD_BOOL, delay.on),
+	CH_FIELD("/delay/time", FIELD_FLOAT, delay.time),
+
+	// Preamp/HPF
+	CH_FIELD("/preamp/trim", FIELD_FLOAT, preamp.trim),
+	CH_FIELD("/preamp/invert", FIELD_BOOL, preamp.invert),
+	CH_FIELD("/preamp/hpon", FIELD_BOOL, preamp.hpon),
+	CH_FIELD("/preamp/hpslope", FIELD_U8, preamp.hpslope),
+	CH_FIELD("/preamp/hpf", FIELD_FLOAT, preamp.hpf),
+
+	// Gate
+	CH_FIELD("/gate/on", FIELD_BOOL, gate.on),
+	CH_FIELD("/gate/mode", FIELD_U8, gate.mode),
+	CH_FIELD("/gate/thr", FIELD_FLOAT, gate.thr),
+	CH_FIELD("/gate/range", FIELD_FLOAT, gate.range),
+	CH_FIELD("/gate/attack", FIELD_FLOAT, gate.attack),
+	CH_FIELD("/gate/hold", FIELD_FLOAT, gate.hold),
+	CH_FIELD("/gate/release", FIELD_FLOAT, gate.release),
+	CH_FIELD("/gate/keysrc", FIELD_U8, gate.keysrc),
+	CH_FIELD("/gate/filter/on", FIELD_BOOL, gate.filter_on),
+	CH_FIELD("/gate/filter/type", FIELD_U8, gate.filter_type),
+	CH_FIELD("/gate/filter/f", FIELD_FLOAT, gate.filter_f),
+
+	// Dynamics
+	CH_FIELD("/dyn/on", FIELD_BOOL, dyn.on),
+	CH_FIELD("/dyn/mode", FIELD_U8, dyn.mode),
+	CH_FIELD("/dyn/det", FIELD_U8, dyn.det),
+	CH_FIELD("/dyn/env", FIELD_U8, dyn.env),
+	CH_FIELD("/dyn/thr", FIELD_FLOAT, dyn.thr),
+	CH_FIELD("/dyn/ratio", FIELD_U8, dyn.ratio),
+	CH_FIELD("/dyn/knee", FIELD_FLOAT, dyn.knee),
+	CH_FIELD("/dyn/mgain", FIELD_FLOAT, dyn.mgain),
+	CH_FIELD("/dyn/attack", FIELD_FLOAT, dyn.attack),
+	CH_FIELD("/dyn/hold", FIELD_FLOAT, dyn.hold),
+	CH_FIELD("/dyn/release", FIELD_FLOAT, dyn.release),
+	CH_FIELD("/dyn/pos", FIELD_U8, dyn.pos),
+	CH_FIELD("/dyn/keysrc", FIELD_U8, dyn.keysrc),
+	CH_FIELD("/dyn/mix", FIELD_FLOAT, dyn.mix),
+	CH_FIELD("/dyn/auto", FIELD_BOOL, dyn._auto),
+	CH_FIELD("/dyn/filter/on", FIELD_BOOL, dyn.filter_on),
+	CH_FIELD("/dyn/filter/type", FIELD_U8, dyn.filter_type),
+	CH_FIELD("/dyn/filter/f", FIELD_FLOAT, dyn.filter_f),
+
+	// Insert
+	CH_FIELD("/insert/on", FIELD_BOOL, insert.on),
+	CH_FIELD("/insert/pos", FIELD_U8, insert.pos),
+	CH_FIELD("/insert/sel", FIELD_U8, insert.sel),
+
+	// EQ
+	CH_FIELD("/eq/on", FIELD_BOOL, eq_on),
+	CH_EQ_BAND(1, eq.band_1),
+	CH_EQ_BAND(2, eq.band_2),
+	CH_EQ_BAND(3, eq.band_3),
+	CH_EQ_BAND(4, eq.band_4),
+
+	// mix
+	CH_FIELD("/mix/on", FIELD_BOOL, mix.on),
+	CH_FIELD("/mix/fader", FIELD_FLOAT, mix.fader),
+	CH_FIELD("/mix/st", FIELD_BOOL, mix.st),
+	CH_FIELD("/mix/pan", FIELD_FLOAT, mix.pan),
+	CH_FIELD("/mix/mono", FIELD_BOOL, mix.mono),
+	CH_FIELD("/mix/mlevel", FIELD_FLOAT, mix.mlevel),
+	CH_SEND_PAIR(01, 02, 0),
+	CH_SEND_PAIR(03, 04, 2),
+	CH_SEND_PAIR(05, 06, 4),
+	CH_SEND_PAIR(07, 08, 6),
+	CH_SEND_PAIR(09, 10, 8),
+	CH_SEND_PAIR(11, 12, 10),
+	CH_SEND_PAIR(13, 14, 12),
+	CH_SEND_PAIR(15, 16, 14),
+
+	// grp
+	CH_FIELD("/grp/dca", FIELD_U8, grp.dca),
+	CH_FIELD("/grp/mute", FIELD_U8, grp.mute),
+
+	// automix
+	CH_FIELD("/automix/group", FIELD_U8, automix.group),
+	CH_FIELD("/automix/weight", FIELD_FLOAT, automix.weight)
+};
+
+const int channel_field_count = sizeof(channel_fields) / sizeof(channel_fields[0]);
+
+static int storeNodeReply(struct channel *channel, const struct osc_arg *arg);
+
+/**
+ * Stores the first argument of a decoded reply into the query destination.
+ *
+ * Returns 0 on success, -1 if the argument type does not fit the destination
+ */
+static int storeQueryResult(struct x32_query *q, const struct osc_arg *arg){
+	if(q->kind == FIELD_NODE){
+		return storeNodeReply(q->dest, arg);
+	}
+	if(q->kind == FIELD_VALUE){
+		return oscArgValue(arg, q->dest);
+	}
+	if(q->kind == FIELD_STRING){
+		if(arg->type != 's'){
+			return -1;
+		}
+		int len = arg->s.len < q->size - 1 ? arg->s.len : q->size - 1;
+		memcpy(q->dest, arg->s.ptr, len);
+		((char *)q->dest)[len] = '\0';
+		return 0;
+	}
+
+	float value;
+	if(arg->type == 'i'){
+		value = arg->i;
+	}else if(arg->type == 'f'){
+		value = arg->f;
+	}else{
+		return -1;
+	}
+
+	if(q->kind == FIELD_FLOAT){
+		*(float *)q->dest = value;
+	}else if(q->kind == FIELD_BOOL){
+		*(bool *)q->dest = value != 0;
+	}else{
+		*(uint8_t *)q->dest = value;
+	}
+	return 0;
+}
+
+/**
+ * Reply callback of a pipelined query, runs on the thread pumping the socket.
+ */
+static void queryReply(const struct osc_message *msg, const char *buffer, int length, void *ctx){
+	struct x32_query *q = ctx;
+	if(msg->argc < 1 || storeQueryResult(q, msg->args) < 0){
+		atomic_store_explicit(&q->state, QUERY_FAILED, memory_order_release);
+	}else{
+		atomic_store_explicit(&q->state, QUERY_DONE, memory_order_release);
+	}
+}
+
+static int queryTimeout(const struct x32_query *q, int timeout){
+	timeout <<= q->retries;
+	return timeout < RTO_MAX ? timeout : RTO_MAX;
+}
+
+/**
+ * Fetches a list of parameters, keeping up to `window` queries on the wire.
+ * queries: array of queries with address/dest/kind/size filled in
+ * count: number of queries
+ * window: maximum number of unanswered queries at any time
+ *
+ * Replies are matched to queries by the multiplexer (M32IO.c), so this
+ * works with or without the I/O thread and alongside other requests.
+ * Each query not answered within X32Timeout() ms is retransmitted up to
+ * PIPELINE_RETRIES times, with the timeout doubled every time. On return
+ * every query is QUERY_DONE or QUERY_FAILED.
+ *
+ * Returns the number of queries answered, or -1 on send/poll error
+ */
+int X32Pipeline(struct x32_query *queries, int count, int window){
+	if(queries == NULL || count <= 0){
+		return 0;
+	}
+	if(window <= 0){
+		window = PIPELINE_WINDOW;
+	}
+
+	int *inflight = malloc(window * sizeof(int));
+	if(inflight == NULL){
+		return -1;
+	}
+
+	unsigned generation = 0;
+	int n_inflight = 0;
+	int next = 0;
+	int answered = 0;
+	int ret = 0;
+
+	for(int i = 0; i < count; i++){
+		queries[i].state = QUERY_QUEUED;
+		queries[i].retries = 0;
+	}
+
+	while(next < count || n_inflight > 0){
+		// Fill the window, the queries going out in batches
+		struct x32_batch batch;
+		X32BatchBegin(&batch);
+		while(n_inflight < window && next < count){
+			struct x32_query *q = queries + next;
+			q->state = QUERY_INFLIGHT;
+			q->sent = monotonicMs();
+			if(q->kind == FIELD_NODE){
+				q->slot = X32SubmitNode(q->address, queryReply, q);
+			}else if(q->id >= 0){
+				q->slot = X32SubmitId(q->id, queryReply, q);
+			}else{
+				q->slot = X32Submit(q->address, queryReply, q);
+			}
+			if(q->slot < 0){
+				q->state = QUERY_FAILED;
+				ret = -1;
+				break;
+			}
+			inflight[n_inflight++] = next++;
+		}
+		if(X32BatchEnd(&batch) < 0 || ret < 0){
+			ret = -1;
+			goto done;
+		}
+
+		// Wait no longer than the oldest query has left; the timeout adapts
+		// to the measured round trip and doubles with every retransmission
+		int timeout = X32Timeout();
+		long long now = monotonicMs();
+		long long deadline = now + timeout;
+		for(int i = 0; i < n_inflight; i++){
+			long long d = queries[inflight[i]].sent + queryTimeout(queries + inflight[i], timeout);
+			if(d < deadline){
+				deadline = d;
+			}
+		}
+		if(X32Wait(&generation, deadline > now ? deadline - now : 0) < 0){
+			ret = -1;
+			goto done;
+		}
+
+		// Collect answers, retransmit or give up on expired queries
+		now = monotonicMs();
+		X32BatchBegin(&batch);
+		for(int i = 0; i < n_inflight; i++){
+			struct x32_query *q = queries + inflight[i];
+			uint8_t state = atomic_load_explicit(&q->state, memory_order_acquire);
+			if(state == QUERY_INFLIGHT && now - q->sent >= queryTimeout(q, timeout)){
+				if(q->retries < PIPELINE_RETRIES && X32Resend(q->slot) >= 0){
+					q->retries++;
+					q->sent = now;
+					continue;
+				}
+				if(X32Cancel(q->slot)){
+					q->state = QUERY_FAILED;
+				}
+				state = atomic_load_explicit(&q->state, memory_order_acquire);
+			}
+			if(state == QUERY_INFLIGHT){
+				continue;
+			}
+			if(state == QUERY_DONE){
+				answered++;
+			}
+			inflight[i--] = inflight[--n_inflight];
+		}
+		X32BatchEnd(&batch);
+	}
+	ret = answered;
+
+done:
+	for(int i = 0; i < n_inflight; i++){
+		struct x32_query *q = queries + inflight[i];
+		if(X32Cancel(q->slot)){
+			q->state = QUERY_FAILED;
+		}
+	}
+	free(inflight);
+	return ret;
+}
+
+#define FIELD_STRIDE_MAX 256 // most leaves per channel field_of can map
+#define NODE_SECTIONS_MAX 48 // /node groups of a channel, 32 in the current tree
+
+static int field_ids[sizeof(channel_fields) / sizeof(channel_fields[0])]; // leaf ids for channel 01
+static int field_stride = -1; // leaf id distance between two channels
+static int field_min; // lowest of field_ids
+static int16_t field_of[FIELD_STRIDE_MAX]; // leaf id - channel's field_min -> field, -1 if none
+static char node_sections[NODE_SECTIONS_MAX][16]; // parameter groups holding channel_fields, eg. "/gate/filter"
+static int node_section_count;
+static pthread_once_t field_once = PTHREAD_ONCE_INIT;
+
+/**
+ * Looks up the node index leaf of every channel_fields entry of channel 01
+ * and the id distance from one channel to the next, and lists the /node
+ * parameter groups the fields belong to.
+ */
+static void channelFieldIds(void){
+	char addr[X32_ADDRESS_MAX];
+	int stride = -1;
+
+	for(int i = 0; i < channel_field_count; i++){
+		int len = snprintf(addr, sizeof(addr), "/ch/01%s", channel_fields[i].path);
+		field_ids[i] = oscIndexLookup(addr, len);
+
+		addr[5] = '2';
+		int next = oscIndexLookup(addr, len);
+		if(field_ids[i] < 0 || next < 0 || (stride >= 0 && next - field_ids[i] != stride)){
+			return;
+		}
+		stride = next - field_ids[i];
+		if(i == 0 || field_ids[i] < field_min){
+			field_min = field_ids[i];
+		}
+
+		const char *path = channel_fields[i].path;
+		int p_len = strrchr(path, '/') - path;
+		int s;
+		for(s = 0; s < node_section_count && (strncmp(node_sections[s], path, p_len) != 0 || node_sections[s][p_len] != '\0'); s++);
+		if(s == node_section_count){
+			if(s == NODE_SECTIONS_MAX || p_len >= (int)sizeof(node_sections[s])){
+				return;
+			}
+			memcpy(node_sections[s], path, p_len);
+			node_sections[s][p_len] = '\0';
+			node_section_count++;
+		}
+	}
+	if(stride > FIELD_STRIDE_MAX){
+		return;
+	}
+
+	memset(field_of, -1, sizeof(field_of));
+	for(int i = 0; i < channel_field_count; i++){
+		field_of[field_ids[i] - field_min] = i;
+	}
+	field_stride = stride;
+}
+
+/**
+ * Returns the node index leaf id of channel_fields[field] on channel ch,
+ * or -1 if the field is not indexed
+ */
+static int channelFieldId(int ch, int field){
+	pthread_once(&field_once, channelFieldIds);
+	if(field_stride < 0){
+		return -1;
+	}
+	return field_ids[field] + (ch - 1) * field_stride;
+}
+
+/**
+ * Returns the channel_fields entry a leaf of any channel stores to, or -1
+ */
+static int channelField(int id){
+	pthread_once(&field_once, channelFieldIds);
+	if(field_stride < 0 || id < field_min || id >= field_min + 32 * field_stride){
+		return -1;
+	}
+	return field_of[(id - field_min) % field_stride];
+}
+
+/**
+ * Stores a value into a field of a channel.
+ *
+ * Returns 0 on success, -1 if the value type does not fit the field
+ */
+static int fieldStore(const struct channel_field *f, struct channel *channel, const struct x32_value *value){
+	char *dest = (char *)channel + f->offset;
+	if(f->kind == FIELD_STRING){
+		if(value->type != 's'){
+			return -1;
+		}
+		strncpy(dest, value->s, f->size - 1);
+		dest[f->size - 1] = '\0';
+		return 0;
+	}
+
+	float number;
+	if(value->type == 'i'){
+		number = value->i;
+	}else if(value->type == 'f'){
+		number = value->f;
+	}else{
+		return -1;
+	}
+
+	if(f->kind == FIELD_FLOAT){
+		*(float *)dest = number;
+	}else if(f->kind == FIELD_BOOL){
+		*(bool *)dest = number != 0;
+	}else{
+		*(uint8_t *)dest = number;
+	}
+	return 0;
+}
+
+/**
+ * Stores every value of a /node reply that has a field in struct channel.
+ * The multiplexer matched the reply to its query by node path, so the
+ * leaves belong to the channel the query was made for.
+ *
+ * Returns 0 on success, -1 on a reply that is not a node text
+ */
+static int storeNodeReply(struct channel *channel, const struct osc_arg *arg){
+	int ids[NODE_MAX_LEAVES];
+	struct x32_value values[NODE_MAX_LEAVES];
+
+	if(arg->type != 's'){
+		return -1;
+	}
+	int count = oscNodeDecode(arg->s.ptr, arg->s.len, ids, values, NODE_MAX_LEAVES);
+	if(count <= 0){
+		return -1;
+	}
+	for(int i = 0; i < count; i++){
+		int field = channelField(ids[i]);
+		if(field >= 0){
+			fieldStore(channel_fields + field, channel, values + i);
+		}
+	}
+	return 0;
+}
+
+/**
+ * Fetches all parameters of a range of channels with /node queries, one
+ * per parameter group (config, gate, gate/filter, ...) instead of one per
+ * parameter, pipelined like getChannelsInfo.
+ * The console answers /node with the leaves right below the node only,
+ * never with deeper levels, so every group needs a query of its own: the
+ * 16 sends under mix, the 4 EQ bands and the two filters make 32 queries
+ * for the 126 fields of a channel. Groups cannot be merged any further.
+ * channels: array of `count` channels, channels[0] receives channel `first`
+ * first: first channel number (1-32)
+ * window: in-flight query limit, 0 for PIPELINE_WINDOW
+ *
+ * Fields of groups that could not be fetched are left zeroed.
+ *
+ * Returns the number of groups that failed, or -1 on error
+ */
+int getChannelsInfoNode(struct channel *channels, int first, int count, int window){
+	if(channels == NULL || first < 1 || count < 1 || first + count - 1 > 32){
+		return -1;
+	}
+	pthread_once(&field_once, channelFieldIds);
+	if(field_stride < 0){
+		return -1;
+	}
+
+	int total = count * node_section_count;
+	struct x32_query *queries = malloc(total * sizeof(struct x32_query));
+	if(queries == NULL){
+		return -1;
+	}
+
+	memset(channels, 0, count * sizeof(struct channel));
+	for(int i = 0; i < count; i++){
+		for(int s = 0; s < node_section_count; s++){
+			struct x32_query *q = queries + i * node_section_count + s;
+			snprintf(q->address, sizeof(q->address), "ch/%02i%.15s", first + i, node_sections[s]);
+			q->id = -1;
+			q->dest = channels + i;
+			q->kind = FIELD_NODE;
+			q->size = sizeof(struct channel);
+		}
+	}
+
+	int res = X32Pipeline(queries, total, window);
+	free(queries);
+	if(res < 0){
+		return -1;
+	}
+	return total - res;
+}
+
+/**
+ * Fills queries for the first n channel_fields entries of one channel,
+ * addresses come pre-built from the node index.
+ * queries: array of at least n entries
+ *
+ * Returns the number of queries written, or -1 on error
+ */
+static int channelQueries(struct x32_query *queries, int n, int ch, struct channel *channel){
+	for(int i = 0; i < n; i++){
+		const struct channel_field *f = channel_fields + i;
+		queries[i].id = channelFieldId(ch, i);
+		if(queries[i].id < 0){
+			return -1;
+		}
+		strcpy(queries[i].address, oscIndexAddress(queries[i].id));
+		queries[i].dest = (char *)channel + f->offset;
+		queries[i].kind = f->kind;
+		queries[i].size = f->size;
+	}
+	return n;
+}
+
+/**
+ * Fetches all parameters of a range of channels with a pipelined query
+ * window.
+ * channels: array of `count` channels, channels[0] receives channel `first`
+ * first: first channel number (1-32)
+ * window: in-flight query limit, 0 for PIPELINE_WINDOW
+ *
+ * Fields that could not be fetched are left zeroed.
+ *
+ * Returns the number of parameters that failed, or -1 on error
+ */
+int getChannelsInfo(struct channel *channels, int first, int count, int window){
+	if(channels == NULL || first < 1 || count < 1 || first + count - 1 > 32){
+		return -1;
+	}
+
+	int total = count * channel_field_count;
+	struct x32_query *queries = malloc(total * sizeof(struct x32_query));
+	if(queries == NULL){
+		return -1;
+	}
+
+	memset(channels, 0, count * sizeof(struct channel));
+	for(int i = 0; i < count; i++){
+		if(channelQueries(queries + i * channel_field_count, channel_field_count, first + i, channels + i) < 0){
+			free(queries);
+			return -1;
+		}
+	}
+
+	int res = X32Pipeline(queries, total, window);
+	free(queries);
+	if(res < 0){
+		return -1;
+	}
+	return total - res;
+}
+
+/**
+ * Fetches all parameters of one channel, with /node queries.
+ *
+ * Returns a malloced struct channel, or NULL on failure
+ */
+struct channel* getChannelInfo(int ch){
+	struct channel* channel;
+
+	if(ch < 1 || ch > 32){
+		return NULL;
+	}
+
+	channel = malloc(sizeof(struct channel));
+	if(channel == NULL){
+		return NULL;
+	}
+
+	if(getChannelsInfoNode(channel, ch, 1, PIPELINE_WINDOW) < 0){
+		free(channel);
+		return NULL;
+	}
+	return channel;
+}
+
+/**
+ * Adds the set-message for one field of a channel to a bundle.
+ * field_value: pointer to the field inside struct channel
+ *
+ * Returns the number of messages in the bundle, or -1 on error
+ */
+static int bundleAddField(struct osc_bundle *bundle, const char *address, uint8_t kind, const void *field_value){
+	if(kind == FIELD_STRING){
+		return oscBundleAddString(bundle, address, field_value);
+	}else if(kind == FIELD_FLOAT){
+		return oscBundleAddFloat(bundle, address, *(const float *)field_value);
+	}else if(kind == FIELD_BOOL){
+		return oscBundleAddInt(bundle, address, *(const bool *)field_value);
+	}
+	return oscBundleAddInt(bundle, address, *(const uint8_t *)field_value);
+}
+
+/**
+ * Writes every parameter of a range of channels to the console, packed
+ * into as few bundles as fit under BUNDLE_MTU.
+ * channels: array of `count` channels, channels[0] is written to channel
+ *           `first`
+ * first: first channel number (1-32)
+ *
+ * Returns the number of datagrams sent, or -1 on error
+ */
+int setChannelsInfo(const struct channel *channels, int first, int count){
+	if(channels == NULL || first < 1 || count < 1 || first + count - 1 > 32){
+		return -1;
+	}
+
+	struct osc_bundle bundle;
+
+	oscBundleInit(&bundle);
+	for(int i = 0; i < count; i++){
+		for(int j = 0; j < channel_field_count; j++){
+			const struct channel_field *f = channel_fields + j;
+			const char *addr = oscIndexAddress(channelFieldId(first + i, j));
+			if(addr == NULL || bundleAddField(&bundle, addr, f->kind, (const char *)(channels + i) + f->offset) < 0){
+				return -1;
+			}
+		}
+	}
+
+	if(oscBundleFlush(&bundle) < 0){
+		return -1;
+	}
+	return bundle.datagrams;
+}
+
+/**
+ * Converts one field of a channel to the value type of its leaf.
+ * field_value: pointer to the field inside struct channel
+ *
+ * Returns 0 on success, -1 if the leaf type does not fit the field
+ */
+static int fieldValue(int id, uint8_t kind, const void *field_value, struct x32_value *value){
+	value->type = oscIndexType(id);
+	if(kind == FIELD_STRING){
+		if(value->type != 's'){
+			return -1;
+		}
+		strncpy(value->s, field_value, X32_STRING_MAX - 1);
+		value->s[X32_STRING_MAX - 1] = '\0';
+		return 0;
+	}
+
+	float number;
+	if(kind == FIELD_FLOAT){
+		number = *(const float *)field_value;
+	}else if(kind == FIELD_BOOL){
+		number = *(const bool *)field_value;
+	}else{
+		number = *(const uint8_t *)field_value;
+	}
+
+	if(value->type == 'f'){
+		value->f = number;
+	}else if(value->type == 'i'){
+		value->i = number;
+	}else{
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Brings a range of channels to a target state, writing only the
+ * parameters that differ from the console, see X32Sync.
+ * channels: array of `count` channels, channels[0] is the target of
+ *           channel `first`
+ * first: first channel number (1-32)
+ * rate: most messages per second, 0 for SYNC_RATE
+ *
+ * Returns the number of parameters written, or -1 on error
+ */
+int X32SyncChannels(const struct channel *channels, int first, int count, int rate){
+	if(channels == NULL || first < 1 || count < 1 || first + count - 1 > 32){
+		return -1;
+	}
+
+	int total = count * channel_field_count;
+	int *ids = malloc(total * sizeof(int));
+	struct x32_value *values = malloc(total * sizeof(struct x32_value));
+	int res = -1;
+	if(ids == NULL || values == NULL){
+		goto done;
+	}
+
+	for(int i = 0; i < count; i++){
+		for(int j = 0; j < channel_field_count; j++){
+			const struct channel_field *f = channel_fields + j;
+			int n = i * channel_field_count + j;
+			ids[n] = channelFieldId(first + i, j);
+			if(ids[n] < 0 || fieldValue(ids[n], f->kind, (const char *)(channels + i) + f->offset, values + n) < 0){
+				goto done;
+			}
+		}
+	}
+	res = X32Sync(ids, values, total, rate);
+
+done:
+	free(ids);
+	free(values);
+	return res;
+}
+
+/**
+ * Copies name, icon and color of channel chsrc to channel chdst. Only the
+ * ones that differ on chdst are written.
+ *
+ * Returns 0 on success, -1 on failure
+ */
+int copyChannelConfig(int chsrc, int chdst){
+	if(chsrc < 1 || chsrc > 32 || chdst < 1 || chdst > 32){
+		return -1;
+	}
+
+	// name, icon and color are the first entries of channel_fields
+	struct x32_query queries[3];
+	struct channel channel;
+	int ids[3];
+	struct x32_value values[3];
+
+	memset(&channel, 0, sizeof(channel));
+	if(channelQueries(queries, 3, chsrc, &channel) < 0 || X32Pipeline(queries, 3, 3) != 3){
+		return -1;
+	}
+
+	for(int i = 0; i < 3; i++){
+		const struct channel_field *f = channel_fields + i;
+		ids[i] = channelFieldId(chdst, i);
+		if(fieldValue(ids[i], f->kind, (char *)&channel + f->offset, values + i) < 0){
+			return -1;
+		}
+	}
+	return X32Sync(ids, values, 3, 0) < 0 ? -1 : 0;
+}
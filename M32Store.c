@@ -0,0 +1,322 @@
+/*
+ * M32Store.c
+ *
+ * Channel state as a structure of arrays. struct channel keeps every
+ * parameter of one strip together, which suits fetching and writing a
+ * strip; operations over many strips ("trim every channel by -3 dB", "which
+ * channels have their gate on", "what differs between two scenes") touch
+ * one parameter of every strip instead. The store keeps each parameter of
+ * channel_fields in its own column: 32 contiguous floats or bytes, or one
+ * 32 bit word of flags for switches, so those operations are linear scans
+ * of a few cache lines, four channels at a time with SSE2 where available.
+ *
+ * Results and selections are channel masks: bit n stands for channel n + 1.
+ */
+#include "M32.h"
+
+#include <string.h>
+#include <pthread.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define STORE_FIELDS_MAX 128
+
+static int8_t field_column[STORE_FIELDS_MAX]; // channel_fields index -> column of its kind
+static int store_status = -1;
+static pthread_once_t store_once = PTHREAD_ONCE_INIT;
+
+/**
+ * Assigns every channel_fields entry a column of the array for its kind.
+ */
+static void storeLayout(void){
+	int used[FIELD_STRING + 1] = {0};
+	const int limit[FIELD_STRING + 1] = {
+		[FIELD_BOOL] = STORE_BOOLS,
+		[FIELD_U8] = STORE_BYTES,
+		[FIELD_FLOAT] = STORE_FLOATS,
+		[FIELD_STRING] = STORE_STRINGS,
+	};
+
+	if(channel_field_count > STORE_FIELDS_MAX){
+		return;
+	}
+	for(int i = 0; i < channel_field_count; i++){
+		uint8_t kind = channel_fields[i].kind;
+		if(kind > FIELD_STRING || used[kind] == limit[kind]){
+			return;
+		}
+		field_column[i] = used[kind]++;
+	}
+	store_status = 0;
+}
+
+static int storeColumn(int field, uint8_t kind){
+	pthread_once(&store_once, storeLayout);
+	if(store_status < 0 || field < 0 || field >= channel_field_count || channel_fields[field].kind != kind){
+		return -1;
+	}
+	return field_column[field];
+}
+
+/**
+ * Looks up a parameter by its path below /ch/NN, eg. "/gate/thr".
+ *
+ * Returns the channel_fields index, or -1 if there is none
+ */
+int channelFieldIndex(const char *path){
+	for(int i = 0; i < channel_field_count; i++){
+		if(strcmp(channel_fields[i].path, path) == 0){
+			return i;
+		}
+	}
+	return -1;
+}
+
+/**
+ * Returns the column of a float parameter, STORE_CHANNELS values, or NULL
+ * if the field is not a float
+ */
+float *channelStoreFloats(struct channel_store *store, int field){
+	int column = storeColumn(field, FIELD_FLOAT);
+	return column < 0 ? NULL : store->floats[column];
+}
+
+/**
+ * Returns the column of a byte parameter, STORE_CHANNELS values, or NULL
+ * if the field is not a byte
+ */
+uint8_t *channelStoreBytes(struct channel_store *store, int field){
+	int column = storeColumn(field, FIELD_U8);
+	return column < 0 ? NULL : store->bytes[column];
+}
+
+/**
+ * Returns the channel mask of a switch, or NULL if the field is not one
+ */
+uint32_t *channelStoreBits(struct channel_store *store, int field){
+	int column = storeColumn(field, FIELD_BOOL);
+	return column < 0 ? NULL : store->bits + column;
+}
+
+/**
+ * Fills a store from an array of channels; channels past count are zeroed.
+ * count: at most STORE_CHANNELS
+ *
+ * Returns 0 on success, -1 on error
+ */
+int channelStoreLoad(struct channel_store *store, const struct channel *channels, int count){
+	pthread_once(&store_once, storeLayout);
+	if(store_status < 0 || count < 0 || count > STORE_CHANNELS){
+		return -1;
+	}
+
+	memset(store, 0, sizeof(struct channel_store));
+	store->count = count;
+	for(int i = 0; i < channel_field_count; i++){
+		const struct channel_field *f = channel_fields + i;
+		int column = field_column[i];
+		for(int ch = 0; ch < count; ch++){
+			const char *src = (const char *)(channels + ch) + f->offset;
+			switch(f->kind){
+			case FIELD_BOOL:
+				store->bits[column] |= (uint32_t)*(const bool *)src << ch;
+				break;
+			case FIELD_U8:
+				store->bytes[column][ch] = *(const uint8_t *)src;
+				break;
+			case FIELD_FLOAT:
+				store->floats[column][ch] = *(const float *)src;
+				break;
+			case FIELD_STRING:
+				strncpy(store->strings[column][ch], src, STORE_STRING_MAX - 1);
+				break;
+			}
+		}
+	}
+	return 0;
+}
+
+/**
+ * Writes the first count channels of a store back to an array of channels.
+ *
+ * Returns 0 on success, -1 on error
+ */
+int channelStoreSave(const struct channel_store *store, struct channel *channels, int count){
+	pthread_once(&store_once, storeLayout);
+	if(store_status < 0 || count < 0 || count > STORE_CHANNELS){
+		return -1;
+	}
+
+	for(int i = 0; i < channel_field_count; i++){
+		const struct channel_field *f = channel_fields + i;
+		int column = field_column[i];
+		for(int ch = 0; ch < count; ch++){
+			char *dest = (char *)(channels + ch) + f->offset;
+			switch(f->kind){
+			case FIELD_BOOL:
+				*(bool *)dest = store->bits[column] >> ch & 1;
+				break;
+			case FIELD_U8:
+				*(uint8_t *)dest = store->bytes[column][ch];
+				break;
+			case FIELD_FLOAT:
+				*(float *)dest = store->floats[column][ch];
+				break;
+			case FIELD_STRING:
+				strncpy(dest, store->strings[column][ch], f->size - 1);
+				dest[f->size - 1] = '\0';
+				break;
+			}
+		}
+	}
+	return 0;
+}
+
+#ifdef __SSE2__
+// lane masks for 4 bits of a channel mask, lowest bit in the first lane
+static __m128 laneMask(uint32_t bits){
+	return _mm_castsi128_ps(_mm_set_epi32(-(int)(bits >> 3 & 1), -(int)(bits >> 2 & 1), -(int)(bits >> 1 & 1), -(int)(bits & 1)));
+}
+#endif
+
+/**
+ * Selects the channels whose value of a parameter lies in [min, max].
+ * Switches read as 0 or 1.
+ *
+ * Returns the channel mask, 0 for an unknown field
+ */
+uint32_t channelStoreMatch(const struct channel_store *store, int field, float min, float max){
+	uint32_t mask = 0;
+	int column;
+
+	if((column = storeColumn(field, FIELD_FLOAT)) >= 0){
+		const float *values = store->floats[column];
+		int ch = 0;
+#ifdef __SSE2__
+		const __m128 lo = _mm_set1_ps(min), hi = _mm_set1_ps(max);
+		for(; ch + 4 <= STORE_CHANNELS; ch += 4){
+			__m128 v = _mm_loadu_ps(values + ch);
+			__m128 in = _mm_and_ps(_mm_cmpge_ps(v, lo), _mm_cmple_ps(v, hi));
+			mask |= (uint32_t)_mm_movemask_ps(in) << ch;
+		}
+#endif
+		for(; ch < STORE_CHANNELS; ch++){
+			mask |= (uint32_t)(values[ch] >= min && values[ch] <= max) << ch;
+		}
+	}else if((column = storeColumn(field, FIELD_U8)) >= 0){
+		for(int ch = 0; ch < STORE_CHANNELS; ch++){
+			mask |= (uint32_t)(store->bytes[column][ch] >= min && store->bytes[column][ch] <= max) << ch;
+		}
+	}else if((column = storeColumn(field, FIELD_BOOL)) >= 0){
+		uint32_t bits = store->bits[column];
+		mask = (min <= 1 && max >= 1 ? bits : 0) | (min <= 0 && max >= 0 ? ~bits : 0);
+	}
+
+	if(store->count < STORE_CHANNELS){
+		mask &= (1u << store->count) - 1;
+	}
+	return mask;
+}
+
+/**
+ * Adds delta to a float parameter of the selected channels, clamped to the
+ * normalized 0.0 to 1.0 range. Levels are normalized: on the preamp trim
+ * (-18 to +18 dB), -3 dB is a delta of -3.0f / 36.
+ * channels: channel mask
+ *
+ * Returns 0 on success, -1 if the field is not a float
+ */
+int channelStoreAdd(struct channel_store *store, int field, float delta, uint32_t channels){
+	int column = storeColumn(field, FIELD_FLOAT);
+	if(column < 0){
+		return -1;
+	}
+
+	float *values = store->floats[column];
+	int ch = 0;
+#ifdef __SSE2__
+	const __m128 d = _mm_set1_ps(delta), zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f);
+	for(; ch + 4 <= STORE_CHANNELS; ch += 4){
+		__m128 v = _mm_loadu_ps(values + ch);
+		__m128 sum = _mm_min_ps(_mm_max_ps(_mm_add_ps(v, d), zero), one);
+		__m128 sel = laneMask(channels >> ch);
+		_mm_storeu_ps(values + ch, _mm_or_ps(_mm_and_ps(sel, sum), _mm_andnot_ps(sel, v)));
+	}
+#endif
+	for(; ch < STORE_CHANNELS; ch++){
+		if(channels >> ch & 1){
+			float v = values[ch] + delta;
+			values[ch] = v < 0 ? 0 : v > 1 ? 1 : v;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Compares one parameter of two stores; floats closer than SYNC_EPSILON
+ * are equal.
+ *
+ * Returns the mask of the channels that differ
+ */
+uint32_t channelStoreDiff(const struct channel_store *a, const struct channel_store *b, int field){
+	pthread_once(&store_once, storeLayout);
+	if(store_status < 0 || field < 0 || field >= channel_field_count){
+		return 0;
+	}
+
+	int column = field_column[field];
+	uint32_t mask = 0;
+	switch(channel_fields[field].kind){
+	case FIELD_BOOL:
+		mask = a->bits[column] ^ b->bits[column];
+		break;
+	case FIELD_U8:
+		for(int ch = 0; ch < STORE_CHANNELS; ch++){
+			mask |= (uint32_t)(a->bytes[column][ch] != b->bytes[column][ch]) << ch;
+		}
+		break;
+	case FIELD_FLOAT:{
+		const float *x = a->floats[column], *y = b->floats[column];
+		int ch = 0;
+#ifdef __SSE2__
+		const __m128 eps = _mm_set1_ps(SYNC_EPSILON), sign = _mm_set1_ps(-0.0f);
+		for(; ch + 4 <= STORE_CHANNELS; ch += 4){
+			__m128 d = _mm_andnot_ps(sign, _mm_sub_ps(_mm_loadu_ps(x + ch), _mm_loadu_ps(y + ch)));
+			mask |= (uint32_t)_mm_movemask_ps(_mm_cmpnlt_ps(d, eps)) << ch;
+		}
+#endif
+		for(; ch < STORE_CHANNELS; ch++){
+			float d = x[ch] - y[ch];
+			mask |= (uint32_t)!(d < SYNC_EPSILON && d > -SYNC_EPSILON) << ch;
+		}
+		break;
+	}
+	case FIELD_STRING:
+		for(int ch = 0; ch < STORE_CHANNELS; ch++){
+			mask |= (uint32_t)(strncmp(a->strings[column][ch], b->strings[column][ch], STORE_STRING_MAX) != 0) << ch;
+		}
+		break;
+	}
+
+	int count = a->count > b->count ? a->count : b->count;
+	if(count < STORE_CHANNELS){
+		mask &= (1u << count) - 1;
+	}
+	return mask;
+}
+
+/**
+ * Compares every parameter of two stores, eg. two scenes.
+ * masks: receives channel_field_count channel masks, one per field
+ *
+ * Returns the number of parameters that differ over all channels
+ */
+int channelStoreDiffAll(const struct channel_store *a, const struct channel_store *b, uint32_t *masks){
+	int total = 0;
+	for(int i = 0; i < channel_field_count; i++){
+		masks[i] = channelStoreDiff(a, b, i);
+		total += __builtin_popcount(masks[i]);
+	}
+	return total;
+}
@@ -0,0 +1,367 @@
+/*
+ * M32Subscribe.c
+ *
+ * Subscriptions to pushed parameter changes. With /xremote on, the console
+ * sends every change made on its surface; X32Subscribe registers a callback
+ * for the messages matching an address pattern, which then receives them
+ * as they are dispatched instead of the subscriber queue.
+ *
+ * A pattern is an address whose components may hold wildcards as in shell
+ * globs (*, ? and [...]); it also matches everything below the nodes it
+ * names, so "/ch/[0-3][0-9]/mix/fader" is every channel fader,
+ * "/config/mute/[1-6]" the six mute groups and "/bus/01" every parameter
+ * of bus 1.
+ *
+ * Patterns are compiled once, by walking the osc_node_t tree with them and
+ * pruning the subtrees they cannot match, into the ids of the node index
+ * leaves they cover; each leaf keeps a chain of its subscriptions. A
+ * dispatched message already carries its leaf id, so finding its callbacks
+ * is one array access whatever the number of subscriptions. Patterns that
+ * cover no leaf (eg. "/-stat/solosw") are matched against the address of
+ * every message outside the index instead.
+ *
+ * The table of a session is created by its first subscription, installed
+ * with a compare and swap so that concurrent first subscriptions share
+ * one, and taken out with the multiplexer locked (X32SubscriptionsTake),
+ * so that it is only freed once no dispatch uses it.
+ */
+#include "M32.h"
+
+#include <string.h>
+#include <fnmatch.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+struct subscription{
+	x32_reply_cb callback; // NULL when the entry is free
+	void *ctx;
+	bool indexed; // covers node index leaves, otherwise matched by address
+	char pattern[X32_ADDRESS_MAX];
+};
+
+// subscription of one leaf, or of an unindexed pattern
+struct subscription_link{
+	int sub;
+	int next; // next link of the chain, -1 at the end
+};
+
+struct x32_subscriptions{
+	pthread_mutex_t lock;
+	struct subscription *subs;
+	int n_subs, size_subs;
+	struct subscription_link *links;
+	int n_links, size_links;
+	int free_link; // chain of unused links
+	int others; // chain of the unindexed patterns
+	bool failed; // a link could not be allocated
+	int first[]; // by leaf id: chain of its subscriptions
+};
+
+/**
+ * Matches one pattern component against a label.
+ * len: length of label, which need not be null terminated
+ */
+static bool componentMatch(const char *pattern, int plen, const char *label, int len){
+	char p[X32_ADDRESS_MAX], l[X32_ADDRESS_MAX];
+	memcpy(p, pattern, plen);
+	p[plen] = '\0';
+	memcpy(l, label, len);
+	l[len] = '\0';
+	return fnmatch(p, l, 0) == 0;
+}
+
+/**
+ * Returns the length of the address component starting at s, up to the
+ * next '/' or the end
+ */
+static int componentLength(const char *s, int len){
+	int n = 0;
+	while(n < len && s[n] != '/'){
+		n++;
+	}
+	return n;
+}
+
+/**
+ * Matches an address outside the node index against a pattern, which may
+ * stop at any of its components.
+ */
+static bool addressMatch(const char *pattern, const char *address, int len){
+	int p = 0, a = 0;
+	int plen = strlen(pattern);
+
+	while(p < plen){
+		if(pattern[p] != '/' || a >= len || address[a] != '/'){
+			return false;
+		}
+		p++;
+		a++;
+		int pn = componentLength(pattern + p, plen - p);
+		int an = componentLength(address + a, len - a);
+		if(!componentMatch(pattern + p, pn, address + a, an)){
+			return false;
+		}
+		p += pn;
+		a += an;
+	}
+	return true;
+}
+
+typedef void (*leaf_visit)(struct x32_subscriptions *table, int id, int sub);
+
+/**
+ * Walks the tree below node with the rest of a pattern, calling visit for
+ * every leaf it covers.
+ * address: the address of node's parent, offset bytes long
+ *
+ * Returns the number of leaves visited
+ */
+static int patternWalk(struct x32_subscriptions *table, int sub, const char *pattern, char *address, int offset, const osc_node_t *node, leaf_visit visit){
+	int add = strlen(node->label) + 1;
+	if(offset + add >= X32_ADDRESS_MAX){
+		return 0;
+	}
+	if(*pattern != '\0'){
+		int n = componentLength(pattern + 1, strlen(pattern + 1));
+		if(!componentMatch(pattern + 1, n, node->label, add - 1)){
+			return 0;
+		}
+		pattern += n + 1;
+	}
+	address[offset] = '/';
+	memcpy(address + offset + 1, node->label, add);
+
+	if(node->no_children == 0){
+		if(*pattern != '\0'){
+			return 0;
+		}
+		int id = oscIndexLookup(address, offset + add);
+		if(id >= 0){
+			visit(table, id, sub);
+		}
+		return id >= 0;
+	}
+	int count = 0;
+	for(int i = 0; i < node->no_children; i++){
+		count += patternWalk(table, sub, pattern, address, offset + add, node->children + i, visit);
+	}
+	return count;
+}
+
+/**
+ * Calls visit for every leaf a subscription's pattern covers.
+ *
+ * Returns the number of leaves
+ */
+static int patternLeaves(struct x32_subscriptions *table, int sub, leaf_visit visit){
+	char address[X32_ADDRESS_MAX];
+	int count = 0;
+	for(int i = 0; i < osc_root_count; i++){
+		count += patternWalk(table, sub, table->subs[sub].pattern, address, 0, osc_roots[i], visit);
+	}
+	return count;
+}
+
+static int linkPush(struct x32_subscriptions *table, int *chain, int sub){
+	int l = table->free_link;
+	if(l >= 0){
+		table->free_link = table->links[l].next;
+	}else{
+		if(table->n_links == table->size_links){
+			int size = table->size_links ? table->size_links * 2 : 256;
+			struct subscription_link *links = realloc(table->links, size * sizeof(struct subscription_link));
+			if(links == NULL){
+				return -1;
+			}
+			table->links = links;
+			table->size_links = size;
+		}
+		l = table->n_links++;
+	}
+	table->links[l].sub = sub;
+	table->links[l].next = *chain;
+	*chain = l;
+	return 0;
+}
+
+static void linkRemove(struct x32_subscriptions *table, int *chain, int sub){
+	for(int *l = chain; *l >= 0; l = &table->links[*l].next){
+		if(table->links[*l].sub == sub){
+			int found = *l;
+			*l = table->links[found].next;
+			table->links[found].next = table->free_link;
+			table->free_link = found;
+			return;
+		}
+	}
+}
+
+// only counts the leaves
+static void leafCount(struct x32_subscriptions *table, int id, int sub){
+	(void)table, (void)id, (void)sub;
+}
+
+static void leafLink(struct x32_subscriptions *table, int id, int sub){
+	if(linkPush(table, table->first + id, sub) < 0){
+		table->failed = true;
+	}
+}
+
+static void leafUnlink(struct x32_subscriptions *table, int id, int sub){
+	linkRemove(table, table->first + id, sub);
+}
+
+static void tableFree(struct x32_subscriptions *table){
+	pthread_mutex_destroy(&table->lock);
+	free(table->subs);
+	free(table->links);
+	free(table);
+}
+
+/**
+ * Returns the subscription table of the current session, created on first
+ * use, or NULL on error
+ */
+static struct x32_subscriptions *subscriptionTable(void){
+	struct x32_socket *x = X32Socket();
+	struct x32_subscriptions *current = x->subscriptions;
+	if(current != NULL || oscIndexInit() < 0){
+		return current;
+	}
+
+	int leaves = oscIndexCount();
+	struct x32_subscriptions *table = calloc(1, sizeof(struct x32_subscriptions) + leaves * sizeof(int));
+	if(table == NULL){
+		return NULL;
+	}
+	pthread_mutex_init(&table->lock, NULL);
+	table->free_link = table->others = -1;
+	memset(table->first, 0xff, leaves * sizeof(int));
+	if(!atomic_compare_exchange_strong(&x->subscriptions, &current, table)){
+		tableFree(table); // another thread installed one first
+		return current;
+	}
+	return table;
+}
+
+/**
+ * Calls callback with every message of the current session's console that
+ * no request waits for and whose address matches pattern, see the top of
+ * this file. Such messages no longer go to the subscriber queue.
+ * callback: called from the thread that pumps the socket with the
+ *           multiplexer locked, as for X32Expect; it must not subscribe or
+ *           unsubscribe either
+ *
+ * Returns the subscription id, or -1 on error
+ */
+int X32Subscribe(const char *pattern, x32_reply_cb callback, void *ctx){
+	struct x32_subscriptions *table = subscriptionTable();
+	if(table == NULL || callback == NULL || pattern[0] != '/' || strlen(pattern) >= X32_ADDRESS_MAX){
+		return -1;
+	}
+
+	pthread_mutex_lock(&table->lock);
+	int sub = 0;
+	while(sub < table->n_subs && table->subs[sub].callback != NULL){
+		sub++;
+	}
+	if(sub == table->size_subs){
+		int size = table->size_subs ? table->size_subs * 2 : 16;
+		struct subscription *subs = realloc(table->subs, size * sizeof(struct subscription));
+		if(subs == NULL){
+			pthread_mutex_unlock(&table->lock);
+			return -1;
+		}
+		table->subs = subs;
+		table->size_subs = size;
+	}
+	if(sub == table->n_subs){
+		table->n_subs++;
+	}
+
+	struct subscription *s = table->subs + sub;
+	strcpy(s->pattern, pattern);
+	s->callback = callback;
+	s->ctx = ctx;
+	s->indexed = patternLeaves(table, sub, leafCount) > 0;
+	table->failed = false;
+	if(s->indexed){
+		patternLeaves(table, sub, leafLink);
+	}else if(linkPush(table, &table->others, sub) < 0){
+		table->failed = true;
+	}
+	int res = table->failed ? -1 : 0;
+	pthread_mutex_unlock(&table->lock);
+	if(res < 0){
+		X32Unsubscribe(sub);
+		return -1;
+	}
+	return sub;
+}
+
+/**
+ * Removes a subscription of the current session.
+ *
+ * Returns 0 on success, -1 if there is no such subscription
+ */
+int X32Unsubscribe(int sub){
+	struct x32_subscriptions *table = X32Socket()->subscriptions;
+	if(table == NULL){
+		return -1;
+	}
+
+	pthread_mutex_lock(&table->lock);
+	int res = -1;
+	if(sub >= 0 && sub < table->n_subs && table->subs[sub].callback != NULL){
+		if(table->subs[sub].indexed){
+			patternLeaves(table, sub, leafUnlink);
+		}else{
+			linkRemove(table, &table->others, sub);
+		}
+		table->subs[sub].callback = NULL;
+		res = 0;
+	}
+	pthread_mutex_unlock(&table->lock);
+	return res;
+}
+
+/**
+ * Removes every subscription of the current session and frees its table.
+ * Safe while the I/O thread or an event loop pumps the session: it waits
+ * for a callback running to return. It must not run alongside
+ * X32Subscribe or X32Unsubscribe for the same session, nor from a
+ * callback.
+ */
+void X32UnsubscribeAll(void){
+	struct x32_subscriptions *table = X32SubscriptionsTake();
+	if(table != NULL){
+		tableFree(table);
+	}
+}
+
+/**
+ * Hands an unsolicited message to the subscriptions matching it. Called
+ * by X32Dispatch with the multiplexer locked.
+ * id: leaf id of its address, -1 if it is not in the node index
+ *
+ * Returns the number of callbacks called
+ */
+int X32SubscriptionsApply(int id, const struct osc_message *msg, const char *buffer, int length){
+	struct x32_subscriptions *table = X32Socket()->subscriptions;
+	if(table == NULL){
+		return 0;
+	}
+
+	pthread_mutex_lock(&table->lock);
+	int called = 0;
+	for(int l = id >= 0 ? table->first[id] : table->others; l >= 0; l = table->links[l].next){
+		struct subscription *s = table->subs + table->links[l].sub;
+		if(id < 0 && !addressMatch(s->pattern, msg->address.ptr, msg->address.len)){
+			continue;
+		}
+		s->callback(msg, buffer, length, s->ctx);
+		called++;
+	}
+	pthread_mutex_unlock(&table->lock);
+	return called;
+}
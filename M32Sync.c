@@ -0,0 +1,179 @@
+/*
+ * M32Sync.c
+ *
+ * Diff-based recall. The target state of a list of parameters is compared
+ * against what the console holds, taken from the state mirror when the
+ * console reported the value (see M32Cache.c) and fetched with a pipelined
+ * query otherwise, and only the parameters that differ are written. The
+ * writes go out in bundles of at most SYNC_BURST messages, paced to a
+ * message rate so a large recall does not flood the console's input queue.
+ *
+ * Recall traffic thus scales with what changed, not with the size of the
+ * mixer: recalling the state the console is already in sends nothing.
+ */
+#include "M32.h"
+
+#include <string.h>
+
+/**
+ * Returns true if the console value a needs no rewrite to become b
+ */
+static bool syncEqual(const struct x32_value *a, const struct x32_value *b){
+	if(a->type == 's' || b->type == 's'){
+		return a->type == b->type && strcmp(a->s, b->s) == 0;
+	}
+	if(a->type == 0 || b->type == 0){
+		return false;
+	}
+
+	float x = a->type == 'i' ? a->i : a->f;
+	float y = b->type == 'i' ? b->i : b->f;
+	float d = x - y;
+	return d < SYNC_EPSILON && d > -SYNC_EPSILON;
+}
+
+/**
+ * Encodes the set-message for one leaf.
+ *
+ * Returns the message length, or -1 on error
+ */
+static int syncEncode(char *buffer, int size, int id, const struct x32_value *value){
+	switch(value->type){
+	case 'i':
+		return oscEncodeIdInt(buffer, size, id, value->i);
+	case 'f':
+		return oscEncodeIdFloat(buffer, size, id, value->f);
+	case 's':
+		return oscEncodeIdString(buffer, size, id, value->s);
+	}
+	return -1;
+}
+
+/**
+ * Sends the bundle once the messages sent before it are due at the given
+ * rate, handling replies while waiting.
+ * sent: messages sent so far since start
+ *
+ * Returns 0 on success, -1 on error
+ */
+static int syncFlush(struct osc_bundle *bundle, long long start, int sent, int rate){
+	long long due = start + (long long)(sent - bundle->count) * 1000 / rate;
+	unsigned generation = 0;
+
+	for(;;){
+		long long left = due - monotonicMs();
+		if(left <= 0){
+			break;
+		}
+		if(X32Wait(&generation, left) < 0){
+			return -1;
+		}
+	}
+	return oscBundleFlush(bundle) < 0 ? -1 : 0;
+}
+
+/**
+ * Reads the current console value of every leaf, from the mirror where the
+ * console reported it and with one pipelined fetch for the rest, including
+ * leaves we wrote since: the write may not have taken. Leaves that could
+ * not be fetched are left with type 0, so they always count as changed.
+ * current: receives count values
+ *
+ * Returns 0 on success, -1 on error
+ */
+static int syncCurrent(const int *ids, struct x32_value *current, int count){
+	int missing = 0;
+	for(int i = 0; i < count; i++){
+		current[i].type = 0;
+		if(X32CacheConfirmedId(ids[i], current + i) < 0){
+			missing++;
+		}
+	}
+	if(missing == 0){
+		return 0;
+	}
+
+	struct x32_query *queries = malloc(missing * sizeof(struct x32_query));
+	if(queries == NULL){
+		return -1;
+	}
+
+	int n = 0;
+	for(int i = 0; i < count; i++){
+		if(current[i].type != 0){
+			continue;
+		}
+		strcpy(queries[n].address, oscIndexAddress(ids[i]));
+		queries[n].id = ids[i];
+		queries[n].dest = current + i;
+		queries[n].kind = FIELD_VALUE;
+		queries[n].size = sizeof(struct x32_value);
+		n++;
+	}
+
+	int res = X32Pipeline(queries, n, 0);
+	free(queries);
+	return res < 0 ? -1 : 0;
+}
+
+/**
+ * Brings a list of parameters to their target values, writing only the
+ * ones whose console value differs. Written values are stored in the
+ * mirror when it is enabled, as X32Send does for every write.
+ * ids: node index leaf ids
+ * values: target value of each leaf
+ * rate: most messages per second, 0 for SYNC_RATE
+ *
+ * Returns the number of parameters written, or -1 on error
+ */
+int X32Sync(const int *ids, const struct x32_value *values, int count, int rate){
+	if(ids == NULL || values == NULL || count < 0 || rate < 0){
+		return -1;
+	}
+	if(count == 0){
+		return 0;
+	}
+	if(rate == 0){
+		rate = SYNC_RATE;
+	}
+	for(int i = 0; i < count; i++){
+		if(oscIndexAddress(ids[i]) == NULL){
+			return -1;
+		}
+	}
+
+	struct x32_value *current = malloc(count * sizeof(struct x32_value));
+	if(current == NULL || syncCurrent(ids, current, count) < 0){
+		free(current);
+		return -1;
+	}
+
+	struct osc_bundle bundle;
+	char message[BSIZE];
+	long long start = monotonicMs();
+	int sent = 0;
+	int res = 0;
+
+	oscBundleInit(&bundle);
+	for(int i = 0; i < count; i++){
+		if(syncEqual(current + i, values + i)){
+			continue;
+		}
+		if(bundle.count == SYNC_BURST && syncFlush(&bundle, start, sent, rate) < 0){
+			res = -1;
+			break;
+		}
+		int len = syncEncode(message, BSIZE, ids[i], values + i);
+		if(len < 0 || oscBundleAdd(&bundle, message, len) < 0){
+			res = -1;
+			break;
+		}
+		sent++;
+	}
+	if(res == 0 && bundle.count > 0 && syncFlush(&bundle, start, sent, rate) < 0){
+		res = -1;
+	}
+
+	free(current);
+	return res == 0 ? sent : -1;
+}
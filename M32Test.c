@@ -0,0 +1,835 @@
+/*
+ * M32Test.c
+ *
+ * Functional tests against M32Emu, built and run by "make test". Each test
+ * starts its own emulator on a free loopback port, with packet loss where
+ * the code under test has to cope with it, drives it through the library
+ * and checks what comes back field by field. The emulator drops datagrams
+ * from a fixed random sequence, so a run is repeatable.
+ *
+ * Library logging goes to stdout, so it is sent to /dev/null and the
+ * results are printed on the original stdout. Exits with 1 if any check
+ * failed.
+ */
+#include "M32.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <spawn.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <arpa/inet.h>
+
+#define TEST_CHANNELS 32
+
+static FILE *out; // stdout before the library logging was silenced
+static int failures; // checks failed by the current test
+
+#define CHECK(cond) check((cond), #cond, __LINE__)
+
+static bool check(bool ok, const char *what, int line){
+	if(!ok){
+		fprintf(out, "    line %d: %s\n", line, what);
+		failures++;
+	}
+	return ok;
+}
+
+// An emulator process and the session connected to it
+struct emu{
+	pid_t pid;
+	int port;
+	struct x32_session *session;
+	struct x32_session *previous;
+};
+
+/**
+ * Finds a free loopback UDP port.
+ *
+ * Returns the port, or -1 on error
+ */
+static int freePort(void){
+	struct sockaddr_in addr;
+	socklen_t addr_len = sizeof(addr);
+
+	int fd = socket(PF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	int res = fd < 0 || bind(fd, (struct sockaddr *)&addr, addr_len) < 0
+			|| getsockname(fd, (struct sockaddr *)&addr, &addr_len) < 0 ? -1 : ntohs(addr.sin_port);
+	if(fd >= 0){
+		close(fd);
+	}
+	return res;
+}
+
+/**
+ * Starts ./M32Emu with the given options and connects a new session to it,
+ * made current.
+ * options: NULL terminated M32Emu arguments, after the port
+ *
+ * Returns true if the emulator answered
+ */
+static bool emuStart(struct emu *emu, char *const options[]){
+	extern char **environ;
+	char port_arg[8];
+	char *argv[16] = {"./M32Emu", "-p", port_arg, "-s", "0"};
+	int argc = 5;
+
+	memset(emu, 0, sizeof(struct emu));
+	emu->port = freePort();
+	snprintf(port_arg, sizeof(port_arg), "%d", emu->port);
+	while(*options != NULL && argc < 15){
+		argv[argc++] = *options++;
+	}
+	argv[argc] = NULL;
+
+	posix_spawn_file_actions_t actions;
+	posix_spawn_file_actions_init(&actions);
+	posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+	int res = emu->port < 0 ? -1 : posix_spawn(&emu->pid, argv[0], &actions, NULL, argv, environ);
+	posix_spawn_file_actions_destroy(&actions);
+	if(res != 0){
+		emu->pid = 0;
+		fprintf(out, "    %s not found\n", argv[0]);
+		return false;
+	}
+
+	emu->session = X32SessionNew();
+	if(emu->session == NULL){
+		return false;
+	}
+	emu->previous = X32Use(emu->session);
+	int connected = 0;
+	for(int i = 0; i < 50 && connected != 1; i++){
+		usleep(20000);
+		connected = X32Connect("127.0.0.1", emu->port);
+	}
+	if(connected != 1){
+		fprintf(out, "    cannot connect to %s\n", argv[0]);
+	}
+	return connected == 1;
+}
+
+static void emuStop(struct emu *emu){
+	if(emu->session != NULL){
+		X32Use(emu->previous);
+		X32SessionFree(emu->session);
+	}
+	if(emu->pid > 0){
+		kill(emu->pid, SIGTERM);
+		waitpid(emu->pid, NULL, 0);
+	}
+}
+
+/**
+ * Fills every field of channel_fields with a value of its kind.
+ */
+static void randomChannels(struct channel *channels, int count){
+	memset(channels, 0, count * sizeof(struct channel));
+	for(int c = 0; c < count; c++){
+		for(int i = 0; i < channel_field_count; i++){
+			const struct channel_field *f = channel_fields + i;
+			char *member = (char *)(channels + c) + f->offset;
+			switch(f->kind){
+				case FIELD_BOOL:
+					*(bool *)member = rand() & 1;
+					break;
+				case FIELD_U8:
+					*(uint8_t *)member = rand() % 8;
+					break;
+				case FIELD_FLOAT:
+					*(float *)member = (float)rand() / RAND_MAX;
+					break;
+				case FIELD_STRING:
+					snprintf(member, f->size, "T%d.%d", c + 1, rand() % 1000);
+					break;
+			}
+		}
+	}
+}
+
+/**
+ * Compares every field of two channel arrays, printing the first
+ * differences.
+ *
+ * Returns the number of fields that differ
+ */
+static int compareChannels(const struct channel *expected, const struct channel *actual, int first, int count){
+	int differ = 0;
+	for(int c = 0; c < count; c++){
+		for(int i = 0; i < channel_field_count; i++){
+			const struct channel_field *f = channel_fields + i;
+			const char *a = (const char *)(expected + c) + f->offset;
+			const char *b = (const char *)(actual + c) + f->offset;
+			bool same = f->kind == FIELD_STRING ? strncmp(a, b, f->size) == 0 : memcmp(a, b, f->size) == 0;
+			if(!same && differ++ < 4){
+				fprintf(out, "    /ch/%02d%s differs\n", first + c, f->path);
+			}
+		}
+	}
+	return differ;
+}
+
+/**
+ * getChannelsInfo fetches every field of every channel although replies
+ * and queries are dropped, by retransmitting them.
+ */
+static void testChannelsLoss(void){
+	static struct channel written[TEST_CHANNELS], read[TEST_CHANNELS];
+	struct x32_metrics metrics;
+	struct emu emu;
+
+	if(CHECK(emuStart(&emu, (char *[]){"-d", "0.02", NULL}))){
+		randomChannels(written, TEST_CHANNELS);
+		// sets are not answered, so they are repeated until losing one
+		// every time is out of the question
+		for(int i = 0; i < 4; i++){
+			CHECK(setChannelsInfo(written, 1, TEST_CHANNELS) > 0);
+		}
+		X32MetricsReset();
+		CHECK(getChannelsInfo(read, 1, TEST_CHANNELS, 0) == 0);
+		X32MetricsSnapshot(&metrics);
+		CHECK(compareChannels(written, read, 1, TEST_CHANNELS) == 0);
+		CHECK(metrics.counters[METRIC_RETRANSMITS] > 0);
+		fprintf(out, "    %d fields with 2%% loss: %llu retransmissions\n",
+				TEST_CHANNELS * channel_field_count, metrics.counters[METRIC_RETRANSMITS]);
+
+		// a range that does not start at channel 1
+		memset(read, 0, sizeof(read));
+		CHECK(getChannelsInfo(read, 9, 8, 0) == 0);
+		CHECK(compareChannels(written + 8, read, 9, 8) == 0);
+	}
+	emuStop(&emu);
+}
+
+/**
+ * setChannelsInfo packs whole channel strips into bundles once the probe
+ * found the console takes them, one datagram per field otherwise, and
+ * getChannelsInfo reads every field back.
+ */
+static void testBundles(void){
+	static struct channel written[TEST_CHANNELS], read[TEST_CHANNELS];
+	int fields = TEST_CHANNELS * channel_field_count;
+	struct emu emu;
+
+	if(CHECK(emuStart(&emu, (char *[]){NULL}))){
+		BUNDLE_MODE = BUNDLE_AUTO;
+		CHECK(X32BundleMode() == BUNDLE_AUTO);
+		randomChannels(written, TEST_CHANNELS);
+		int datagrams = setChannelsInfo(written, 1, TEST_CHANNELS);
+		CHECK(X32BundleMode() == BUNDLE_ON);
+		// set-messages take 20 to 40 bytes, so at least 36 fit in a datagram
+		CHECK(datagrams > 0 && datagrams <= fields / 36 + 1);
+		CHECK(getChannelsInfo(read, 1, TEST_CHANNELS, 0) == 0);
+		CHECK(compareChannels(written, read, 1, TEST_CHANNELS) == 0);
+		fprintf(out, "    %d channels, %d fields: %d datagrams bundled\n", TEST_CHANNELS, fields, datagrams);
+
+		BUNDLE_MODE = BUNDLE_OFF;
+		randomChannels(written, TEST_CHANNELS);
+		CHECK(setChannelsInfo(written, 1, TEST_CHANNELS) == fields);
+		CHECK(getChannelsInfo(read, 1, TEST_CHANNELS, 0) == 0);
+		CHECK(compareChannels(written, read, 1, TEST_CHANNELS) == 0);
+		BUNDLE_MODE = BUNDLE_AUTO;
+	}
+	emuStop(&emu);
+}
+
+/**
+ * The bundle probe retries lost datagrams, and what it finds stays with
+ * the session that probed.
+ */
+static void testProbeLoss(void){
+	struct emu emu;
+
+	if(CHECK(emuStart(&emu, (char *[]){"-d", "0.1", NULL}))){
+		for(int i = 0; i < 20; i++){
+			CHECK(X32ProbeBundles() == 1);
+			CHECK(X32BundleMode() == BUNDLE_ON);
+		}
+		struct x32_session *other = X32SessionNew();
+		X32Use(other);
+		CHECK(X32BundleMode() == BUNDLE_AUTO);
+		X32Use(emu.session);
+		X32SessionFree(other);
+	}
+	emuStop(&emu);
+}
+
+/**
+ * Writes show up in the cache at once, whichever way they are sent: the
+ * set-message helpers, bundles and the outbox.
+ */
+static void testCacheWrites(void){
+	static struct channel written[2];
+	struct emu emu;
+
+	if(CHECK(emuStart(&emu, (char *[]){NULL}))){
+		CHECK(X32CacheStart(0) == 0);
+		CHECK(sendFloatValue("/ch/01/mix/fader", 0.25f) >= 0);
+		CHECK(getFloatValueCached("/ch/01/mix/fader", false) == 0.25f);
+		CHECK(sendIntValue("/ch/01/mix/on", 1) >= 0);
+		CHECK(getIntValueCached("/ch/01/mix/on", false) == 1);
+		CHECK(sendStringValue("/ch/01/config/name", "Vox") >= 0);
+		char *name = getStringValueCached("/ch/01/config/name", false);
+		CHECK(name != NULL && strcmp(name, "Vox") == 0);
+		free(name);
+
+		// bundles
+		randomChannels(written, 2);
+		CHECK(setChannelsInfo(written, 3, 2) > 0);
+		CHECK(getFloatValueCached("/ch/04/eq/2/g", false) == written[1].eq.band_2.g);
+		CHECK(getIntValueCached("/ch/03/mix/05/type", false) == written[0].mix.sends[4].type);
+
+		CHECK(X32OutboxStart(0) == 0);
+		for(int i = 1; i <= 8; i++){
+			CHECK(sendFloatValue("/ch/02/mix/fader", i / 8.0f) >= 0);
+		}
+		CHECK(getFloatValueCached("/ch/02/mix/fader", false) == 1.0f);
+		X32OutboxStop();
+		CHECK(getFloatValueCached("/ch/02/mix/fader", true) == 1.0f);
+		X32CacheStop();
+	}
+	emuStop(&emu);
+}
+
+/**
+ * A bundle written while the outbox holds older writes of the same leaves
+ * wins: the queued values are dropped rather than sent after it.
+ */
+static void testOutboxBundle(void){
+	static struct channel target;
+	struct emu emu;
+
+	randomChannels(&target, 1);
+	target.mix.fader = 0.875f;
+	if(CHECK(emuStart(&emu, (char *[]){NULL}))){
+		CHECK(X32OutboxStart(1) == 0); // a packet per second: the second write waits
+		CHECK(sendFloatValue("/ch/07/mix/fader", 0.125f) >= 0);
+		CHECK(sendFloatValue("/ch/07/mix/fader", 0.25f) >= 0);
+		CHECK(sendStringValue("/ch/07/config/name", "Old") >= 0);
+		CHECK(setChannelsInfo(&target, 7, 1) > 0);
+		usleep(3 * OUTBOX_PERIOD * 1000);
+		X32Service();
+		X32OutboxStop();
+
+		CHECK(getFloatValue("/ch/07/mix/fader") == target.mix.fader);
+		char *name = getStringValue("/ch/07/config/name");
+		CHECK(name != NULL && strcmp(name, target.config.scribble.name) == 0);
+		free(name);
+	}
+	emuStop(&emu);
+}
+
+static void countRuns(void *ctx){
+	(*(int *)ctx)++;
+}
+
+/**
+ * Starting the cache on a second console moves it there: the /xremote
+ * renewal on the first stops, and stopping the cache leaves the timers of
+ * the second alone.
+ */
+static void testCacheMove(void){
+	struct emu first, second;
+	int runs = 0;
+
+	bool started = CHECK(emuStart(&first, (char *[]){NULL}));
+	if(started){
+		CHECK(X32CacheStart(0) == 0);
+		CHECK(sendFloatValue("/ch/01/mix/fader", 0.25f) >= 0);
+	}
+	if(started && CHECK(emuStart(&second, (char *[]){NULL}))){
+		int timer = X32Every(1, countRuns, &runs);
+		CHECK(X32CacheStart(0) == 0);
+		CHECK(getFloatValueCached("/ch/01/mix/fader", false) != 0.25f);
+		CHECK(sendFloatValue("/ch/01/mix/fader", 0.5f) >= 0);
+		CHECK(getFloatValueCached("/ch/01/mix/fader", false) == 0.5f);
+		X32CacheStop();
+
+		usleep(5000);
+		X32Service();
+		CHECK(runs > 0);
+		X32CancelTimer(timer);
+
+		struct x32_session *previous = X32Use(first.session);
+		timer = X32Every(1, countRuns, &runs);
+		CHECK(timer == 0); // the renewal's slot is free again
+		X32CancelTimer(timer);
+		X32Use(previous);
+	}
+	if(started){
+		emuStop(&second);
+	}
+	emuStop(&first);
+}
+
+// values of the /meters/N banks, as M32Emu sends them
+static const int meter_sizes[METER_BANKS] = {70, 96, 49, 22, 82, 27, 4, 16, 6, 32, 32, 5, 4, 48, 80, 50, 48};
+
+#define METER_TEST_VALUES 64
+
+/**
+ * Meter blobs of the subscribed banks arrive whole in the ring, and
+ * meterToDb agrees with 20 log10 on both its vector and scalar paths.
+ */
+static void testMeters(void){
+	static struct meter_frame frame;
+	struct emu emu, other;
+
+	if(CHECK(emuStart(&emu, (char *[]){NULL}))){
+		CHECK(X32MetersStart(1, -1, 1) == 0);
+		CHECK(X32MetersStart(6, 3, 2) == 0);
+		int frames[METER_BANKS] = {0}, wrong = 0;
+		unsigned dispatched = 0;
+		long long end = monotonicMs() + 500;
+		while(monotonicMs() < end){
+			X32Wait(&dispatched, 50);
+			while(X32MetersNext(&frame)){
+				if(frame.bank < 0 || frame.bank >= METER_BANKS || frame.count != meter_sizes[frame.bank]){
+					wrong++;
+				}else{
+					frames[frame.bank]++;
+				}
+			}
+		}
+		CHECK(frames[1] >= 5 && frames[6] >= 2 && frames[1] > frames[6]);
+		CHECK(wrong == 0);
+
+		if(CHECK(emuStart(&other, (char *[]){NULL}))){
+			CHECK(X32MetersStart(0, -1, 1) == -1); // streaming from the first
+		}
+		emuStop(&other);
+		X32MetersStop();
+		X32MetersStop();
+	}
+	emuStop(&emu);
+
+	float linear[METER_TEST_VALUES], db[METER_TEST_VALUES];
+	for(int i = 0; i < METER_TEST_VALUES; i++){
+		linear[i] = powf(10.0f, -7.0f * i / (METER_TEST_VALUES - 1)) * (1.0f + 0.37f * (i % 3));
+	}
+	linear[5] = 0.0f;
+	linear[9] = NAN;
+	meterToDb(linear, db, METER_TEST_VALUES);
+	float worst = 0;
+	for(int i = 0; i < METER_TEST_VALUES; i++){
+		float scalar; // a single value takes the scalar path
+		meterToDb(linear + i, &scalar, 1);
+		float expected = linear[i] > 1e-6f ? 20.0f * log10f(linear[i]) : METER_DB_FLOOR;
+		worst = fmaxf(worst, fmaxf(fabsf(db[i] - expected), fabsf(scalar - expected)));
+	}
+	CHECK(worst < 1e-3f);
+}
+
+/**
+ * Set-messages longer than the stack buffers of the send helpers still go
+ * out whole, from the heap.
+ */
+static void testLongMessages(void){
+	char address[BSIZE + 64], value[2 * BSIZE];
+	struct emu emu;
+
+	memset(value, 'a', sizeof(value) - 1);
+	value[sizeof(value) - 1] = '\0';
+	snprintf(address, sizeof(address), "/ch/01/config/name/%0*d", BSIZE, 0);
+	if(CHECK(emuStart(&emu, (char *[]){NULL}))){
+		CHECK(sendStringValue("/ch/01/config/name", value) > BSIZE);
+		CHECK(sendIntValue(address, 1) > BSIZE);
+		CHECK(sendFloatValue(address, 0.5f) > BSIZE);
+		CHECK(sendIntValue("/ch/01/mix/on", 0) >= 0 && getIntValue("/ch/01/mix/on") == 0);
+	}
+	emuStop(&emu);
+}
+
+/**
+ * X32Recv refuses a datagram longer than its BSIZE buffer instead of
+ * returning it cut short, and goes on with the next one.
+ */
+static void testRecvOversized(void){
+	char datagram[2 * BSIZE], buffer[BSIZE];
+	struct sockaddr_in addr;
+	socklen_t addr_len = sizeof(addr);
+	struct emu emu;
+
+	memset(datagram, 'x', sizeof(datagram));
+	if(CHECK(emuStart(&emu, (char *[]){NULL}))){
+		int fd = socket(PF_INET, SOCK_DGRAM, IPPROTO_UDP);
+		if(CHECK(fd >= 0 && getsockname(X32Socket()->fd, (struct sockaddr *)&addr, &addr_len) == 0)){
+			addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+			sendto(fd, datagram, sizeof(datagram), 0, (struct sockaddr *)&addr, addr_len);
+			sendto(fd, datagram, 64, 0, (struct sockaddr *)&addr, addr_len);
+			CHECK(X32Recv(buffer, 100) == -1);
+			CHECK(X32Recv(buffer, 100) == 64);
+		}
+		if(fd >= 0){
+			close(fd);
+		}
+	}
+	emuStop(&emu);
+}
+
+/**
+ * X32Sync only skips leaves whose value the console reported: after a write
+ * that was lost, syncing to the value written still sends it.
+ */
+static void testSyncLostWrite(void){
+	struct x32_value a = {.type = 'f', .f = 0.5f}, b = {.type = 'f', .f = 0.75f};
+	struct emu emu;
+
+	if(CHECK(emuStart(&emu, (char *[]){NULL}))){
+		int id = oscIndexLookup("/ch/05/mix/fader", strlen("/ch/05/mix/fader"));
+		CHECK(X32CacheStart(0) == 0);
+		CHECK(X32Sync(&id, &a, 1, 0) == 1);
+		CHECK(X32Sync(&id, &a, 1, 0) == 0); // read again, the write took
+
+		// a write of b that never reached the console
+		X32CacheSet(id, &b);
+		CHECK(X32Sync(&id, &b, 1, 0) == 1);
+		CHECK(getFloatValue("/ch/05/mix/fader") == 0.75f);
+		X32CacheStop();
+	}
+	emuStop(&emu);
+}
+
+static void countPush(const struct osc_message *msg, const char *buffer, int length, void *ctx){
+	atomic_fetch_add((atomic_int *)ctx, 1);
+}
+
+struct first_subscriber{
+	struct x32_session *session;
+	atomic_int *calls;
+	int sub;
+};
+
+static void *firstSubscriber(void *arg){
+	struct first_subscriber *f = arg;
+	X32Use(f->session);
+	f->sub = X32Subscribe("/ch/01/mix/fader", countPush, f->calls);
+	return NULL;
+}
+
+/**
+ * Changes another client makes reach the callbacks whose patterns match
+ * them through /xremote; concurrent first subscriptions share one table,
+ * and the table can go while the I/O thread dispatches.
+ */
+static void testSubscriptions(void){
+	static atomic_int faders, strip, buses, racers[2];
+	struct emu emu;
+
+	if(CHECK(emuStart(&emu, (char *[]){NULL}))){
+		struct first_subscriber first[2];
+		for(int i = 0; i < 2; i++){
+			first[i] = (struct first_subscriber){emu.session, racers + i, -1};
+		}
+		pthread_t threads[2];
+		for(int i = 0; i < 2; i++){
+			pthread_create(threads + i, NULL, firstSubscriber, first + i);
+		}
+		for(int i = 0; i < 2; i++){
+			pthread_join(threads[i], NULL);
+		}
+		CHECK(first[0].sub >= 0 && first[1].sub >= 0 && first[0].sub != first[1].sub);
+		CHECK(X32Subscribe("/ch/0[1-2]/mix/fader", countPush, &faders) >= 0);
+		CHECK(X32Subscribe("/ch/01", countPush, &strip) >= 0);
+		CHECK(X32Subscribe("/bus/*/mix/on", countPush, &buses) >= 0);
+		CHECK(generateAndSendMessage("/xremote") >= 0);
+
+		struct x32_session *writer = X32SessionNew();
+		if(CHECK(writer != NULL)){
+			X32Use(writer);
+			CHECK(X32Connect("127.0.0.1", emu.port) == 1);
+			sendFloatValue("/ch/01/mix/fader", 0.5f);
+			sendFloatValue("/ch/02/mix/fader", 0.5f);
+			sendFloatValue("/ch/03/mix/fader", 0.5f);
+			sendIntValue("/ch/01/mix/on", 0);
+			sendIntValue("/bus/05/mix/on", 0);
+			sendIntValue("/ch/04/mix/on", 0);
+			X32Use(emu.session);
+		}
+
+		unsigned dispatched = 0;
+		long long end = monotonicMs() + 200;
+		while(monotonicMs() < end){
+			X32Wait(&dispatched, 20);
+		}
+		CHECK(faders == 2 && strip == 2 && buses == 1);
+		CHECK(racers[0] == 1 && racers[1] == 1);
+
+		// pushes keep coming while the table goes away
+		CHECK(X32StartIO() == 0);
+		if(writer != NULL){
+			X32Use(writer);
+			for(int i = 0; i < 200; i++){
+				sendFloatValue("/ch/01/mix/fader", i / 200.0f);
+			}
+			X32Use(emu.session);
+		}
+		X32UnsubscribeAll();
+		CHECK(X32Unsubscribe(first[0].sub) == -1);
+		X32StopIO();
+		X32SessionFree(writer);
+	}
+	emuStop(&emu);
+}
+
+/**
+ * Replaces the first occurrence of a null terminated string in a file.
+ *
+ * Returns true if it was found
+ */
+static bool patchString(char *file, long size, const char *from, const char *to){
+	int len = strlen(from) + 1;
+	for(long i = 0; i + len <= size; i++){
+		if(memcmp(file + i, from, len) == 0){
+			memcpy(file + i, to, len);
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * A show written with another node tree is matched to the running tree by
+ * leaf address: leaves that moved are found at their new id, leaves that
+ * are gone are left out of the recall.
+ */
+static void testShowTree(void){
+	char path[] = "/tmp/M32TestXXXXXX";
+	int leaves = oscIndexCount();
+	struct x32_value *scene = calloc(leaves, sizeof(struct x32_value));
+	struct x32_show show;
+	struct x32_value value;
+	struct emu emu;
+
+	int fd = mkstemp(path);
+	if(!CHECK(fd >= 0 && scene != NULL)){
+		free(scene);
+		return;
+	}
+	close(fd);
+	for(int id = 0; id < leaves; id++){
+		scene[id].type = oscIndexType(id) != 0 ? oscIndexType(id) : 'i';
+		if(scene[id].type == 'f'){
+			scene[id].f = (float)id / leaves;
+		}else if(scene[id].type == 'i'){
+			scene[id].i = id % 4;
+		}else{
+			snprintf(scene[id].s, X32_STRING_MAX, "L%d", id);
+		}
+	}
+	const char *name = "A";
+	long size = X32ShowWrite(path, &name, (const struct x32_value *const *)&scene, 1);
+	CHECK(size > 0);
+
+	int fader_1 = oscIndexLookup("/ch/01/mix/fader", 16);
+	int fader_2 = oscIndexLookup("/ch/02/mix/fader", 16);
+	int fader_3 = oscIndexLookup("/ch/03/mix/fader", 16);
+	CHECK(X32ShowOpen(path, &show) == 0 && show.slots == NULL);
+	CHECK(X32ShowValue(&show, 0, fader_1, &value) == 0 && value.f == scene[fader_1].f);
+	X32ShowClose(&show);
+
+	// as written by a tree where the faders of ch 01 and 02 are swapped and
+	// the one of ch 03 does not exist: addresses and the tree hash differ
+	char *file = malloc(size);
+	FILE *f = fopen(path, "r+b");
+	if(CHECK(f != NULL && file != NULL && fread(file, 1, size, f) == (size_t)size)){
+		CHECK(patchString(file, size, "/ch/01/mix/fader", "/ch/0X/mix/fader"));
+		CHECK(patchString(file, size, "/ch/02/mix/fader", "/ch/01/mix/fader"));
+		CHECK(patchString(file, size, "/ch/0X/mix/fader", "/ch/02/mix/fader"));
+		CHECK(patchString(file, size, "/ch/03/mix/fader", "/ch/03/mix/fadex"));
+		file[20] ^= 1; // show_header.tree_hash
+		rewind(f);
+		CHECK(fwrite(file, 1, size, f) == (size_t)size);
+	}
+	if(f != NULL){
+		fclose(f);
+	}
+	free(file);
+
+	int first, count;
+	CHECK(X32ShowOpen(path, &show) == 0 && show.slots != NULL);
+	CHECK(X32ShowValue(&show, 0, fader_1, &value) == 0 && value.f == scene[fader_2].f);
+	CHECK(X32ShowValue(&show, 0, fader_2, &value) == 0 && value.f == scene[fader_1].f);
+	CHECK(X32ShowValue(&show, 0, fader_3, &value) < 0);
+	CHECK(X32ShowValue(&show, 0, fader_3 + 1, &value) == 0 && value.type == scene[fader_3 + 1].type && value.i == scene[fader_3 + 1].i);
+	CHECK(X32ShowFindSection(&show, "/ch/03", &first, &count) == 0 && first <= fader_3 && fader_3 < first + count);
+
+	if(CHECK(emuStart(&emu, (char *[]){NULL}))){
+		CHECK(X32ShowApply(&show, 0, "/ch/03", 0) > 0);
+		CHECK(getFloatValue("/ch/03/mix/fader") == 0.0f);
+		CHECK(X32ShowApply(&show, 0, "/ch/01", 0) > 0);
+		CHECK(getFloatValue("/ch/01/mix/fader") == scene[fader_2].f);
+	}
+	emuStop(&emu);
+	X32ShowClose(&show);
+	unlink(path);
+	free(scene);
+}
+
+#define TRACE_WRITERS 4
+#define TRACE_EVENTS 200000 // per writer, many times around the ring
+
+static atomic_int trace_writers_done;
+
+static void *traceWriter(void *arg){
+	char address[16];
+	for(int i = 0; i < TRACE_EVENTS; i++){
+		// the size is made to tell the address, to find torn events
+		int len = snprintf(address, sizeof(address), "/w%ld/%d", (long)arg, i % 1000);
+		traceRecord(TRACE_SEND, address, len + (i % 1000) * 16, -1);
+	}
+	trace_writers_done++;
+	return NULL;
+}
+
+/**
+ * Writers lapping each other around the trace ring never leave an event
+ * made of two of theirs.
+ */
+static void testTraceRing(void){
+	static struct trace_event events[TRACE_RING_SIZE];
+	pthread_t threads[TRACE_WRITERS];
+	int torn = 0, read = 0;
+
+	X32TraceClear();
+	int level = TRACE_LEVEL;
+	TRACE_LEVEL = TRACE_RECORD;
+	trace_writers_done = 0;
+	for(long i = 0; i < TRACE_WRITERS; i++){
+		CHECK(pthread_create(threads + i, NULL, traceWriter, (void *)i) == 0);
+	}
+	while(trace_writers_done < TRACE_WRITERS){
+		int count = X32TraceRead(events, TRACE_RING_SIZE);
+		for(int i = 0; i < count; i++){
+			long writer;
+			int n;
+			if(sscanf(events[i].address, "/w%ld/%d", &writer, &n) != 2
+					|| events[i].size != (int)strlen(events[i].address) + n * 16){
+				torn++;
+			}
+		}
+		read += count;
+	}
+	for(int i = 0; i < TRACE_WRITERS; i++){
+		pthread_join(threads[i], NULL);
+	}
+	TRACE_LEVEL = level;
+	CHECK(torn == 0);
+	CHECK(X32TraceRead(events, TRACE_RING_SIZE) > TRACE_RING_SIZE / 2);
+	fprintf(out, "    %d events read while written, %d torn\n", read, torn);
+	X32TraceClear();
+}
+
+struct push_writer{
+	struct x32_session *session;
+	int id;
+};
+
+static void *pushWriter(void *arg){
+	struct push_writer *w = arg;
+	char *address = (char *)oscIndexAddress(w->id);
+	usleep(5000);
+	X32Use(w->session);
+	if(oscIndexType(w->id) == 'f'){
+		sendFloatValue(address, 0.875f);
+	}else if(oscIndexType(w->id) == 's'){
+		sendStringValue(address, "pushed");
+	}else{
+		sendIntValue(address, 3);
+	}
+	return NULL;
+}
+
+/**
+ * X32ParallelFetch fetches again the leaves it lost and the leaves another
+ * client changed while it ran, and only stamps complete snapshots.
+ */
+static void testParallel(void){
+	int leaves = oscIndexCount();
+	struct x32_value *values = malloc(leaves * sizeof(struct x32_value));
+	unsigned long long generation = 0;
+	struct emu emu;
+
+	// 5% loss: some leaves fail all their retransmissions in a round
+	if(CHECK(values != NULL && emuStart(&emu, (char *[]){"-d", "0.05", NULL}))){
+		struct x32_parallel *p = X32ParallelNew(4);
+		if(CHECK(p != NULL)){
+			CHECK(X32ParallelFetch(p, values, 0, &generation) == 0);
+			CHECK(generation > 0);
+			int missing = 0;
+			for(int id = 0; id < leaves; id++){
+				missing += values[id].type == 0;
+			}
+			CHECK(missing == 0);
+		}
+		X32ParallelFree(p);
+	}
+	emuStop(&emu);
+
+	// the first leaf is answered before another client changes it
+	if(CHECK(values != NULL && emuStart(&emu, (char *[]){"-l", "20", NULL}))){
+		struct x32_parallel *p = X32ParallelNew(4);
+		struct push_writer writer = {emu.session, 0};
+		pthread_t thread;
+		if(CHECK(p != NULL && pthread_create(&thread, NULL, pushWriter, &writer) == 0)){
+			unsigned long long previous = generation;
+			CHECK(X32ParallelFetch(p, values, 0, &generation) == 0);
+			pthread_join(thread, NULL);
+			CHECK(generation > previous);
+			CHECK(values[0].type == 'f' ? values[0].f == 0.875f : values[0].type == 's' ? strcmp(values[0].s, "pushed") == 0 : values[0].i == 3);
+		}
+		X32ParallelFree(p);
+	}
+	emuStop(&emu);
+	free(values);
+}
+
+static const struct{
+	const char *name;
+	void (*run)(void);
+} tests[] = {
+	{"channels-loss", testChannelsLoss},
+	{"bundles", testBundles},
+	{"probe-loss", testProbeLoss},
+	{"cache-writes", testCacheWrites},
+	{"cache-move", testCacheMove},
+	{"outbox-bundle", testOutboxBundle},
+	{"long-messages", testLongMessages},
+	{"recv-oversized", testRecvOversized},
+	{"meters", testMeters},
+	{"sync-lost-write", testSyncLostWrite},
+	{"subscriptions", testSubscriptions},
+	{"show-tree", testShowTree},
+	{"trace-ring", testTraceRing},
+	{"parallel", testParallel},
+};
+
+int main(){
+	int failed = 0;
+
+	out = fdopen(dup(STDOUT_FILENO), "w");
+	if(out == NULL || freopen("/dev/null", "w", stdout) == NULL || oscIndexInit() < 0){
+		return 1;
+	}
+	setvbuf(out, NULL, _IOLBF, 0);
+	srand(32);
+
+	for(int i = 0; i < (int)(sizeof(tests) / sizeof(tests[0])); i++){
+		fprintf(out, "%-5s %s\n", "run", tests[i].name);
+		failures = 0;
+		tests[i].run();
+		fprintf(out, "%-5s %s\n", failures == 0 ? "ok" : "FAIL", tests[i].name);
+		failed += failures != 0;
+	}
+	fprintf(out, "%d of %d tests failed\n", failed, (int)(sizeof(tests) / sizeof(tests[0])));
+	return failed != 0;
+}
@@ -0,0 +1,190 @@
+/*
+ * M32Trace.c
+ *
+ * Packet trace. With TRACE_LEVEL above TRACE_OFF every datagram sent with
+ * X32Transmit and every message handed to X32Dispatch is recorded as a
+ * fixed size event (time, direction, size, address, and for replies the
+ * round trip time of their request) in a ring of the last TRACE_RING_SIZE
+ * events. Recording takes no lock: a writer claims an event with one
+ * atomic increment, takes its slot with a compare-and-swap and stamps it
+ * with its sequence number once written, so readers skip events that are
+ * being overwritten. A writer finding its slot taken by another one, a
+ * whole ring apart, drops its event rather than write over it.
+ *
+ * The ring is read on demand (X32TraceRead), printed, or saved to a
+ * binary file. TRACE_PRINT additionally prints every event as it happens,
+ * for debugging. Building with -DM32_NO_TRACE removes the calls entirely;
+ * otherwise a disabled trace costs one test per packet.
+ *
+ * Trace files are a struct trace_file_header followed by the events, in
+ * host byte order.
+ */
+#include "M32.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <stdatomic.h>
+#include <limits.h>
+
+#define TRACE_RING_MASK (TRACE_RING_SIZE - 1)
+#define TRACE_WRITING ULLONG_MAX // trace_slot.seq while a writer owns the slot
+
+struct trace_slot{
+	atomic_ullong seq; // sequence number + 1 once written, 0 if never, or TRACE_WRITING
+	struct trace_event event;
+};
+
+struct trace_file_header{
+	char magic[8]; // "M32TRACE"
+	uint32_t version;
+	uint32_t count;
+	uint32_t event_size; // sizeof(struct trace_event)
+	uint32_t reserved;
+};
+
+int TRACE_LEVEL = TRACE_OFF;
+
+static struct trace_slot ring[TRACE_RING_SIZE];
+static atomic_ullong trace_next; // sequence number of the next event
+
+static const char *traceKind(int kind){
+	return kind == TRACE_SEND ? "SEND" : "RECV";
+}
+
+static void tracePrint(const struct trace_event *event, const char *buffer, int length){
+	printf("%lld.%06lld %s %d", event->time / 1000000, event->time % 1000000, traceKind(event->kind), event->size);
+	if(event->latency >= 0){
+		printf(" (%d us)", event->latency);
+	}
+	printf(": ");
+	if(buffer != NULL){
+		printBuffer((char *)buffer, length);
+	}else{
+		printf("%s\n", event->address);
+	}
+}
+
+/**
+ * Records one packet, see X32_TRACE.
+ * kind: TRACE_SEND or TRACE_RECV
+ * latency: us since the request of a reply, -1 for other packets
+ */
+void traceRecord(int kind, const char *buffer, int length, int latency){
+	struct timespec ts;
+	struct trace_event event;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	event.time = (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+	event.latency = latency;
+	event.size = length > UINT16_MAX ? UINT16_MAX : length;
+	event.kind = kind;
+	int len = 0;
+	while(len < length && len < TRACE_ADDRESS_MAX - 1 && buffer[len] != '\0'){
+		len++;
+	}
+	memcpy(event.address, buffer, len);
+	event.address[len] = '\0';
+
+	unsigned long long seq = atomic_fetch_add_explicit(&trace_next, 1, memory_order_relaxed);
+	struct trace_slot *slot = ring + (seq & TRACE_RING_MASK);
+	unsigned long long old = atomic_load_explicit(&slot->seq, memory_order_relaxed);
+	bool owned = false;
+	// a slot being written, or already holding a later event, is left alone
+	while(old != TRACE_WRITING && old <= seq && !owned){
+		owned = atomic_compare_exchange_weak_explicit(&slot->seq, &old, TRACE_WRITING, memory_order_relaxed, memory_order_relaxed);
+	}
+	if(owned){
+		atomic_thread_fence(memory_order_release);
+		slot->event = event;
+		atomic_store_explicit(&slot->seq, seq + 1, memory_order_release);
+	}
+
+	if(TRACE_LEVEL == TRACE_PRINT){
+		tracePrint(&event, buffer, length);
+	}
+}
+
+/**
+ * Copies the recorded events still in the ring, oldest first. Events being
+ * written meanwhile are left out.
+ * events: room for max events
+ *
+ * Returns the number of events copied
+ */
+int X32TraceRead(struct trace_event *events, int max){
+	unsigned long long end = atomic_load_explicit(&trace_next, memory_order_acquire);
+	unsigned long long start = end > TRACE_RING_SIZE ? end - TRACE_RING_SIZE : 0;
+	if(end - start > (unsigned)max){
+		start = end - max;
+	}
+
+	int count = 0;
+	for(unsigned long long seq = start; seq < end; seq++){
+		struct trace_slot *slot = ring + (seq & TRACE_RING_MASK);
+		if(atomic_load_explicit(&slot->seq, memory_order_acquire) != seq + 1){
+			continue;
+		}
+		events[count] = slot->event;
+		atomic_thread_fence(memory_order_acquire);
+		if(atomic_load_explicit(&slot->seq, memory_order_relaxed) != seq + 1){
+			continue; // overwritten while copying
+		}
+		count++;
+	}
+	return count;
+}
+
+/**
+ * Empties the ring.
+ */
+void X32TraceClear(void){
+	for(int i = 0; i < TRACE_RING_SIZE; i++){
+		atomic_store_explicit(&ring[i].seq, 0, memory_order_relaxed);
+	}
+}
+
+/**
+ * Prints the recorded events to stdout, oldest first.
+ *
+ * Returns the number of events printed, or -1 on error
+ */
+int X32TracePrint(void){
+	struct trace_event *events = malloc(TRACE_RING_SIZE * sizeof(struct trace_event));
+	if(events == NULL){
+		return -1;
+	}
+	int count = X32TraceRead(events, TRACE_RING_SIZE);
+	for(int i = 0; i < count; i++){
+		tracePrint(events + i, NULL, 0);
+	}
+	free(events);
+	return count;
+}
+
+/**
+ * Writes the recorded events to a binary trace file.
+ *
+ * Returns the number of events written, or -1 on error
+ */
+int X32TraceSave(const char *path){
+	struct trace_event *events = malloc(TRACE_RING_SIZE * sizeof(struct trace_event));
+	if(events == NULL){
+		return -1;
+	}
+	struct trace_file_header header = {"M32TRACE", TRACE_VERSION, 0, sizeof(struct trace_event), 0};
+	header.count = X32TraceRead(events, TRACE_RING_SIZE);
+
+	FILE *file = fopen(path, "wb");
+	int res = file == NULL ? -1 : (int)header.count;
+	if(file != NULL){
+		if(fwrite(&header, sizeof(header), 1, file) != 1 || fwrite(events, sizeof(struct trace_event), header.count, file) != header.count){
+			res = -1;
+		}
+		if(fclose(file) != 0){
+			res = -1;
+		}
+	}
+	free(events);
+	return res;
+}
@@ -0,0 +1,577 @@
+/*
+ * M32Tree.c
+ *
+ * The console's OSC address tree, as static osc_node_t tables: /config,
+ * the 32 input channels, 16 mix buses, 6 matrices, the main stereo and
+ * mono buses, the 8 DCAs and the 8 effects. Every leaf carries the OSC
+ * type of its value and, unless it is a plain number or string, its
+ * format: the range and scale of the value or the labels of an
+ * enumeration, as the console displays them (see M32Node.c).
+ *
+ * The node index (M32Index.c) numbers the leaves in the order of these
+ * tables, so everything that works on all parameters (the cache, show
+ * files, snapshots, subscriptions) iterates this model rather than
+ * building addresses by hand.
+ *
+ * Tables are shared where the console repeats a group, and a node may use
+ * only the first entries of a table: bus and matrix strips take the first
+ * 3 entries of ch_config, the even sends the first 2 of the odd ones.
+ */
+
+/*
+
+I want to associate a number with each node, to make selection of what to sync easier.
+Probably best to index on each part of the slash, since some are explicitly numbered
+0	config
+	0	chlink
+		[1-2, ..., 31-32]
+	1	auxlink
+		[1-2, ..., 7-8]
+	2	fxlink
+		[1-2, ..., 7-8]
+	3	buslink
+		[1-2, ..., 15-16]
+	4	mtxlink
+		[1-2, 3-4, 5-6]
+	5	mute
+		[1, ..., 6]
+	6	linkcfg
+		[hadly, eq, dyn, fdrmute]
+	7	mono
+		[mode, link]
+	8	solo
+	9	talk
+	10	osc
+	11	routing
+		IN
+			[1-8, ..., 25-32, AUX]
+		AES50A
+			[1-8, ..., 41-48]
+		AES50B
+			[1-8, ..., 41-48]
+		CARD
+			[1-8, ..., 25-32]
+		OUT
+			[1-4,...13-16]
+	12	userctrl
+		[A, B, C]
+			color
+			enc
+				[1, ..., 4]
+			btn
+				[5, ..., 12]
+	13	tape
+		[gainL, gainR, autoplay]
+
+1	ch
+	[01, ..., 32]
+		[config, delay, preamp, gate, dyn, insert, eq, mix, grp, automix]
+		mix
+			[on, fader, st, pan, mono, mlevel, 01, ..., 16]
+2	bus
+	[01, ..., 16]
+		[config, dyn, insert, eq, mix, grp]
+		mix
+			[on, fader, st, pan, mono, mlevel, 01, ..., 06]
+3	mtx
+	[01, ..., 06]
+		[config, dyn, insert, eq, mix]
+4	main
+	[st, m]
+		[config, dyn, insert, eq, mix]
+5	dca
+	[1, ..., 8]
+		[on, fader, config]
+6	fx
+	[1, ..., 8]
+		[type, par, source]
+		par
+			[01, ..., 64]
+		source (1-4 only)
+			[l, r]
+*/
+#include "M32.h"
+
+static const char *const colors[] = {"OFF", "RD", "GN", "YE", "BL", "MG", "CY", "WH", "OFFi", "RDi", "GNi", "YEi", "BLi", "MGi", "CYi", "WHi"};
+static const char *const hpslopes[] = {"12", "18", "24"};
+static const char *const gate_modes[] = {"EXP2", "EXP3", "EXP4", "GATE", "DUCK"};
+static const char *const filter_types[] = {"LC6", "LC12", "HC6", "HC12", "1.0", "2.0", "3.0", "5.0", "10.0"};
+static const char *const dyn_modes[] = {"COMP", "EXP"};
+static const char *const dyn_dets[] = {"PEAK", "RMS"};
+static const char *const dyn_envs[] = {"LIN", "LOG"};
+static const char *const ratios[] = {"1.1", "1.3", "1.5", "2.0", "2.5", "3.0", "4.0", "5.0", "7.0", "10", "20", "100"};
+static const char *const positions[] = {"PRE", "POST"};
+static const char *const inserts[] = {"OFF", "FX1L", "FX1R", "FX2L", "FX2R", "FX3L", "FX3R", "FX4L", "FX4R", "FX5L", "FX5R",
+		"FX6L", "FX6R", "FX7L", "FX7R", "FX8L", "FX8R", "AUX1", "AUX2", "AUX3", "AUX4", "AUX5", "AUX6"};
+static const char *const eq_types[] = {"LCut", "LShv", "PEQ", "VEQ", "HShv", "HCut"};
+static const char *const send_types[] = {"IN/LC", "<-EQ", "EQ->", "PRE", "POST", "GRP"};
+static const char *const automix_groups[] = {"OFF", "X", "Y"};
+static const char *const mono_modes[] = {"LR+M", "LCR"};
+static const char *const solo_sources[] = {"OFF", "LR", "LR+C", "LRPFL", "LRAFL", "AUX56", "AUX78"};
+static const char *const solo_modes[] = {"PFL", "AFL"};
+static const char *const talk_sources[] = {"INT", "EXT"};
+static const char *const osc_selects[] = {"F1", "F2"};
+static const char *const osc_types[] = {"SINE", "PINK", "WHITE"};
+static const char *const fx_sources[] = {"INS", "MIX1", "MIX2", "MIX3", "MIX4", "MIX5", "MIX6", "MIX7", "MIX8",
+		"MIX9", "MIX10", "MIX11", "MIX12", "MIX13", "MIX14", "MIX15", "MIX16", "M/C"};
+static const char *const fx_types[] = {"HALL", "AMBI", "RPLT", "ROOM", "CHAM", "PLAT", "VREV", "VRM", "GATE", "RVRS",
+		"DLY", "3TAP", "4TAP", "CRS", "FLNG", "PHAS", "DIMC", "FILT", "ROTA", "PAN", "SUB", "D/RV", "CR/R", "FL/R",
+		"D/CR", "D/FL", "MODD", "GEQ2", "GEQ", "TEQ2", "TEQ", "DES2", "DES", "P1A", "P1A2", "PQ5", "PQ5S", "WAVD",
+		"LIM", "CMB", "CMB2", "FAC", "FAC1M", "FAC2", "LEC", "LEC2", "ULC", "ULC2", "ENH2", "ENH", "EXC2", "EXC",
+		"IMG", "EDI", "SON", "AMP2", "AMP", "DRV2", "DRV", "PIT2", "PIT"};
+
+#define FORMAT(scale, min, max) {scale, min, max, NULL, 0}
+#define FORMAT_ENUM(labels) {OSC_ENUM, 0, 0, labels, sizeof(labels) / sizeof(labels[0])}
+
+static const struct osc_format onoff = FORMAT(OSC_ONOFF, 0, 0);
+static const struct osc_format fader = FORMAT(OSC_FADER, 0, 0);
+static const struct osc_format pan = FORMAT(OSC_LIN, -100, 100);
+static const struct osc_format freq = FORMAT(OSC_LOG, 20, 20000);
+static const struct osc_format attack = FORMAT(OSC_LIN, 0, 120);
+static const struct osc_format hold = FORMAT(OSC_LOG, 0.02, 2000);
+static const struct osc_format release = FORMAT(OSC_LOG, 5, 4000);
+static const struct osc_format delay_time = FORMAT(OSC_LIN, 0.3, 500);
+static const struct osc_format trim = FORMAT(OSC_LIN, -18, 18);
+static const struct osc_format hpf = FORMAT(OSC_LOG, 20, 400);
+static const struct osc_format gate_thr = FORMAT(OSC_LIN, -80, 0);
+static const struct osc_format gate_range = FORMAT(OSC_LIN, 3, 60);
+static const struct osc_format dyn_thr = FORMAT(OSC_LIN, -60, 0);
+static const struct osc_format knee = FORMAT(OSC_LIN, 0, 5);
+static const struct osc_format mgain = FORMAT(OSC_LIN, 0, 24);
+static const struct osc_format percent = FORMAT(OSC_LIN, 0, 100);
+static const struct osc_format eq_gain = FORMAT(OSC_LIN, -15, 15);
+static const struct osc_format eq_q = FORMAT(OSC_LOG, 10, 0.3);
+static const struct osc_format icon = FORMAT(OSC_INT, 1, 74);
+static const struct osc_format source = FORMAT(OSC_INT, 0, 64);
+static const struct osc_format dca_mask = FORMAT(OSC_INT, 0, 255);
+static const struct osc_format mute_mask = FORMAT(OSC_INT, 0, 63);
+static const struct osc_format weight = FORMAT(OSC_LIN, -12, 12);
+static const struct osc_format dim = FORMAT(OSC_LIN, -40, 0);
+static const struct osc_format tape_gain = FORMAT(OSC_LIN, -6, 24);
+static const struct osc_format talk_dest = FORMAT(OSC_INT, 0, 262143);
+static const struct osc_format osc_dest = FORMAT(OSC_INT, 0, 25);
+
+static const struct osc_format color = FORMAT_ENUM(colors);
+static const struct osc_format hpslope = FORMAT_ENUM(hpslopes);
+static const struct osc_format gate_mode = FORMAT_ENUM(gate_modes);
+static const struct osc_format filter_type = FORMAT_ENUM(filter_types);
+static const struct osc_format dyn_mode = FORMAT_ENUM(dyn_modes);
+static const struct osc_format dyn_det = FORMAT_ENUM(dyn_dets);
+static const struct osc_format dyn_env = FORMAT_ENUM(dyn_envs);
+static const struct osc_format ratio = FORMAT_ENUM(ratios);
+static const struct osc_format position = FORMAT_ENUM(positions);
+static const struct osc_format insert = FORMAT_ENUM(inserts);
+static const struct osc_format eq_type = FORMAT_ENUM(eq_types);
+static const struct osc_format send_type = FORMAT_ENUM(send_types);
+static const struct osc_format automix_group = FORMAT_ENUM(automix_groups);
+static const struct osc_format mono_mode = FORMAT_ENUM(mono_modes);
+static const struct osc_format solo_source = FORMAT_ENUM(solo_sources);
+static const struct osc_format solo_mode = FORMAT_ENUM(solo_modes);
+static const struct osc_format talk_source = FORMAT_ENUM(talk_sources);
+static const struct osc_format osc_select = FORMAT_ENUM(osc_selects);
+static const struct osc_format osc_type = FORMAT_ENUM(osc_types);
+static const struct osc_format fx_source = FORMAT_ENUM(fx_sources);
+static const struct osc_format fx_type = FORMAT_ENUM(fx_types);
+
+// Array of leafs which are sets of 8 numbers (1-8,9-16,etc)
+// used in routing config
+//      !!!!!!!!!!!! TODO NOT USED FOR IN cause it needs AUX
+const osc_node_t eight_nums[] =
+    {
+        {"1-8",0,NULL,'i'},{"9-16",0,NULL,'i'},{"17-24",0,NULL,'i'},{"25-32",0,NULL,'i'},{"33-40",0,NULL,'i'},{"41-48",0,NULL,'i'}
+    };
+
+// Array of leafs which are sets of 4 numbers (1-4,5-8,etc)
+// used in OUT config
+const osc_node_t four_nums[] =
+    {
+        {"1-4",0,NULL,'i'},{"5-8",0,NULL,'i'},{"9-12",0,NULL,'i'},{"13-16",0,NULL,'i'}
+    };
+
+// Array of leafs which are 'linked' numbers (odd-even pairs up to 31-32)
+// used in chlink, auxlink,buslink,mtxlink
+const osc_node_t linked_nums[] =
+    {
+        {"1-2",0,NULL,'i',&onoff},{"3-4",0,NULL,'i',&onoff},{"5-6",0,NULL,'i',&onoff},{"7-8",0,NULL,'i',&onoff},
+		{"9-10",0,NULL,'i',&onoff},{"11-12",0,NULL,'i',&onoff},{"13-14",0,NULL,'i',&onoff},{"15-16",0,NULL,'i',&onoff},
+		{"17-18",0,NULL,'i',&onoff},{"19-20",0,NULL,'i',&onoff},{"21-22",0,NULL,'i',&onoff},{"23-24",0,NULL,'i',&onoff},
+		{"25-26",0,NULL,'i',&onoff},{"27-28",0,NULL,'i',&onoff},{"29-30",0,NULL,'i',&onoff},{"31-32",0,NULL,'i',&onoff}
+    };
+
+// Array of leafs which are single numbers
+// used in userctrl encoder/buttons
+const osc_node_t single_nums[] =
+    {
+        {"1",0,NULL,'i'},{"2",0,NULL,'i'},{"3",0,NULL,'i'},{"4",0,NULL,'i'},{"5",0,NULL,'i'},{"6",0,NULL,'i'},
+		{"7",0,NULL,'i'},{"8",0,NULL,'i'},{"9",0,NULL,'i'},{"10",0,NULL,'i'},{"11",0,NULL,'i'},{"12",0,NULL,'i'}
+    };
+
+// Array of leafs for config/mute, the mute groups
+const osc_node_t mute_nums[] =
+    {
+        {"1",0,NULL,'i',&onoff},{"2",0,NULL,'i',&onoff},{"3",0,NULL,'i',&onoff},{"4",0,NULL,'i',&onoff},{"5",0,NULL,'i',&onoff},{"6",0,NULL,'i',&onoff}
+    };
+
+// Array of leafs for config/linkcfg
+const osc_node_t config_linkcfg[] =
+    {
+		{"hadly",0,NULL,'i',&onoff}, {"eq",0,NULL,'i',&onoff}, {"dyn",0,NULL,'i',&onoff}, {"fdrmute",0,NULL,'i',&onoff}
+	};
+
+// Array of leafs for config/mono
+const osc_node_t config_mono[] =
+    {
+		{"mode",0,NULL,'i',&mono_mode}, {"link",0,NULL,'i',&onoff}
+	};
+
+// Array of leafs for config/solo
+const osc_node_t config_solo[] =
+    {
+		{"level",0,NULL,'f',&fader}, {"source",0,NULL,'i',&solo_source}, {"sourcetrim",0,NULL,'f',&trim}, {"chmode",0,NULL,'i',&solo_mode},
+		{"busmode",0,NULL,'i',&solo_mode}, {"dcamode",0,NULL,'i',&solo_mode}, {"exclusive",0,NULL,'i',&onoff}, {"followsel",0,NULL,'i',&onoff},
+		{"followsolo",0,NULL,'i',&onoff}, {"dimatt",0,NULL,'f',&dim}, {"dim",0,NULL,'i',&onoff}, {"mono",0,NULL,'i',&onoff},
+		{"delay",0,NULL,'i',&onoff}, {"delaytime",0,NULL,'f',&delay_time}, {"masterctrl",0,NULL,'i',&onoff}, {"mute",0,NULL,'i',&onoff},
+		{"dimpfl",0,NULL,'i',&onoff}
+	};
+
+// Array of leafs for config/talk/{A/B}
+const osc_node_t config_talk_AB[] =
+    {
+		{"level",0,NULL,'f',&fader}, {"dim",0,NULL,'i',&onoff}, {"latch",0,NULL,'i',&onoff}, {"destmap",0,NULL,'i',&talk_dest}
+	};
+
+// Array of leafs for config/talk
+const osc_node_t config_talk[] =
+    {
+		{"enable",0,NULL,'i',&onoff}, {"source",0,NULL,'i',&talk_source}, {"A",4,config_talk_AB},{"B",4,config_talk_AB}
+	};
+
+// Array of leafs for config/osc
+const osc_node_t config_osc[] =
+    {
+		{"level",0,NULL,'f',&fader}, {"f1",0,NULL,'f',&freq}, {"f2",0,NULL,'f',&freq}, {"fsel",0,NULL,'i',&osc_select},
+		{"type",0,NULL,'i',&osc_type}, {"dest",0,NULL,'i',&osc_dest}
+	};
+
+// Array of leafs for config/routing/IN
+const osc_node_t config_routing_IN[] =
+    {
+		{"1-8",0,NULL,'i'},{"9-16",0,NULL,'i'},{"17-24",0,NULL,'i'},{"25-32",0,NULL,'i'},{"AUX",0,NULL,'i'}
+	};
+
+// Array of leafs for config/routing
+const osc_node_t config_routing[] =
+    {
+		{"IN",5,config_routing_IN}, {"AES50A",6,eight_nums}, {"AES50B",6,eight_nums}, {"CARD",4,eight_nums}, {"OUT",4,four_nums}
+	};
+
+// Array of leafs for config/usrctrl{A/B/C}
+const osc_node_t config_userctrl_ABC[] =
+    {
+		{"color",0,NULL,'i',&color},{"enc",4,single_nums},{"btn",8,single_nums+4}
+	};
+
+// Array of leafs for config/userctrl
+const osc_node_t config_userctrl[] =
+    {
+		{"A",3,config_userctrl_ABC},{"B",3,config_userctrl_ABC},{"C",3,config_userctrl_ABC}
+	};
+
+// Array of leafs for config/tape
+const osc_node_t config_tape[] =
+    {
+		{"gainL",0,NULL,'f',&tape_gain},{"gainR",0,NULL,'f',&tape_gain},{"autoplay",0,NULL,'i',&onoff}
+	};
+
+const osc_node_t config[] =
+	{
+		{"chlink", 16, linked_nums},
+		{"auxlink", 4, linked_nums},
+		{"fxlink", 4, linked_nums},
+		{"buslink", 8, linked_nums},
+		{"mtxlink", 3, linked_nums},
+		{"mute", 6, mute_nums},
+		{"linkcfg", 4, config_linkcfg},
+		{"mono", 2, config_mono},
+		{"solo", 17, config_solo},
+		{"talk", 4, config_talk},
+		{"osc", 6, config_osc},
+		{"routing", 5, config_routing},
+		{"usrctrl", 3, config_userctrl},
+		{"tape", 3, config_tape}
+	};
+
+const osc_node_t top = {
+	"config",
+	14,
+	config
+};
+
+// Array of leafs for ch/NN/config, bus, matrix, main and dca strips use the first 3
+const osc_node_t ch_config[] =
+	{
+		{"name",0,NULL,'s'}, {"icon",0,NULL,'i',&icon}, {"color",0,NULL,'i',&color}, {"source",0,NULL,'i',&source}
+	};
+
+// Array of leafs for ch/NN/delay
+const osc_node_t ch_delay[] =
+	{
+		{"on",0,NULL,'i',&onoff}, {"time",0,NULL,'f',&delay_time}
+	};
+
+// Array of leafs for ch/NN/preamp
+const osc_node_t ch_preamp[] =
+	{
+		{"trim",0,NULL,'f',&trim}, {"invert",0,NULL,'i',&onoff}, {"hpon",0,NULL,'i',&onoff}, {"hpslope",0,NULL,'i',&hpslope},
+		{"hpf",0,NULL,'f',&hpf}
+	};
+
+// Array of leafs for the sidechain filter of gate and dyn
+const osc_node_t dyn_filter[] =
+	{
+		{"on",0,NULL,'i',&onoff}, {"type",0,NULL,'i',&filter_type}, {"f",0,NULL,'f',&freq}
+	};
+
+// Array of leafs for ch/NN/gate
+const osc_node_t ch_gate[] =
+	{
+		{"on",0,NULL,'i',&onoff}, {"mode",0,NULL,'i',&gate_mode}, {"thr",0,NULL,'f',&gate_thr}, {"range",0,NULL,'f',&gate_range},
+		{"attack",0,NULL,'f',&attack}, {"hold",0,NULL,'f',&hold}, {"release",0,NULL,'f',&release}, {"keysrc",0,NULL,'i',&source},
+		{"filter",3,dyn_filter}
+	};
+
+// Array of leafs for the dyn of every strip
+const osc_node_t ch_dyn[] =
+	{
+		{"on",0,NULL,'i',&onoff}, {"mode",0,NULL,'i',&dyn_mode}, {"det",0,NULL,'i',&dyn_det}, {"env",0,NULL,'i',&dyn_env},
+		{"thr",0,NULL,'f',&dyn_thr}, {"ratio",0,NULL,'i',&ratio}, {"knee",0,NULL,'f',&knee}, {"mgain",0,NULL,'f',&mgain},
+		{"attack",0,NULL,'f',&attack}, {"hold",0,NULL,'f',&hold}, {"release",0,NULL,'f',&release}, {"pos",0,NULL,'i',&position},
+		{"keysrc",0,NULL,'i',&source}, {"mix",0,NULL,'f',&percent}, {"auto",0,NULL,'i',&onoff}, {"filter",3,dyn_filter}
+	};
+
+// Array of leafs for the insert of every strip
+const osc_node_t ch_insert[] =
+	{
+		{"on",0,NULL,'i',&onoff}, {"pos",0,NULL,'i',&position}, {"sel",0,NULL,'i',&insert}
+	};
+
+// Array of leafs for one eq band
+const osc_node_t eq_band[] =
+	{
+		{"type",0,NULL,'i',&eq_type}, {"f",0,NULL,'f',&freq}, {"g",0,NULL,'f',&eq_gain}, {"q",0,NULL,'f',&eq_q}
+	};
+
+// Array of leafs for the eq of every strip, channels have 4 bands, the others 6
+const osc_node_t ch_eq[] =
+	{
+		{"on",0,NULL,'i',&onoff}, {"1",4,eq_band}, {"2",4,eq_band}, {"3",4,eq_band}, {"4",4,eq_band}, {"5",4,eq_band}, {"6",4,eq_band}
+	};
+
+// Array of leafs for one send to a bus or matrix. Odd sends set the pan
+// and tap point of their pair, even sends have on and level only
+const osc_node_t mix_send[] =
+	{
+		{"on",0,NULL,'i',&onoff}, {"level",0,NULL,'f',&fader}, {"pan",0,NULL,'f',&pan}, {"type",0,NULL,'i',&send_type},
+		{"panFollow",0,NULL,'i',&onoff}
+	};
+
+// Array of leafs for ch/NN/mix, with the sends to the 16 mix buses; bus/NN/mix
+// has the first 12, the sends to the 6 matrices, and mtx/NN/mix the first 2
+const osc_node_t ch_mix[] =
+	{
+		{"on",0,NULL,'i',&onoff}, {"fader",0,NULL,'f',&fader}, {"st",0,NULL,'i',&onoff}, {"pan",0,NULL,'f',&pan},
+		{"mono",0,NULL,'i',&onoff}, {"mlevel",0,NULL,'f',&fader},
+		{"01",5,mix_send}, {"02",2,mix_send}, {"03",5,mix_send}, {"04",2,mix_send}, {"05",5,mix_send}, {"06",2,mix_send},
+		{"07",5,mix_send}, {"08",2,mix_send}, {"09",5,mix_send}, {"10",2,mix_send}, {"11",5,mix_send}, {"12",2,mix_send},
+		{"13",5,mix_send}, {"14",2,mix_send}, {"15",5,mix_send}, {"16",2,mix_send}
+	};
+
+// Array of leafs for ch/NN/grp and bus/NN/grp, DCA and mute groups as bit masks
+const osc_node_t ch_grp[] =
+	{
+		{"dca",0,NULL,'i',&dca_mask}, {"mute",0,NULL,'i',&mute_mask}
+	};
+
+// Array of leafs for ch/NN/automix
+const osc_node_t ch_automix[] =
+	{
+		{"group",0,NULL,'i',&automix_group}, {"weight",0,NULL,'f',&weight}
+	};
+
+const osc_node_t ch_children[] =
+	{
+		{"config",4,ch_config},
+		{"delay",2,ch_delay},
+		{"preamp",5,ch_preamp},
+		{"gate",9,ch_gate},
+		{"dyn",16,ch_dyn},
+		{"insert",3,ch_insert},
+		{"eq",5,ch_eq},
+		{"mix",22,ch_mix},
+		{"grp",2,ch_grp},
+		{"automix",2,ch_automix}
+	};
+
+const osc_node_t ch_nums[] =
+	{
+		{"01",10,ch_children},{"02",10,ch_children},{"03",10,ch_children},{"04",10,ch_children},{"05",10,ch_children},{"06",10,ch_children},
+		{"07",10,ch_children},{"08",10,ch_children},{"09",10,ch_children},{"10",10,ch_children},{"11",10,ch_children},{"12",10,ch_children},
+		{"13",10,ch_children},{"14",10,ch_children},{"15",10,ch_children},{"16",10,ch_children},{"17",10,ch_children},{"18",10,ch_children},
+		{"19",10,ch_children},{"20",10,ch_children},{"21",10,ch_children},{"22",10,ch_children},{"23",10,ch_children},{"24",10,ch_children},
+		{"25",10,ch_children},{"26",10,ch_children},{"27",10,ch_children},{"28",10,ch_children},{"29",10,ch_children},{"30",10,ch_children},
+		{"31",10,ch_children},{"32",10,ch_children}
+	};
+
+const osc_node_t ch_root = {
+	"ch",
+	32,
+	ch_nums
+};
+
+const osc_node_t bus_children[] =
+	{
+		{"config",3,ch_config},
+		{"dyn",16,ch_dyn},
+		{"insert",3,ch_insert},
+		{"eq",7,ch_eq},
+		{"mix",12,ch_mix},
+		{"grp",2,ch_grp}
+	};
+
+const osc_node_t bus_nums[] =
+	{
+		{"01",6,bus_children},{"02",6,bus_children},{"03",6,bus_children},{"04",6,bus_children},{"05",6,bus_children},{"06",6,bus_children},{"07",6,bus_children},{"08",6,bus_children},
+		{"09",6,bus_children},{"10",6,bus_children},{"11",6,bus_children},{"12",6,bus_children},{"13",6,bus_children},{"14",6,bus_children},{"15",6,bus_children},{"16",6,bus_children}
+	};
+
+const osc_node_t bus_root = {
+	"bus",
+	16,
+	bus_nums
+};
+
+// matrix mix has on and fader only
+const osc_node_t mtx_children[] =
+	{
+		{"config",3,ch_config},
+		{"dyn",16,ch_dyn},
+		{"insert",3,ch_insert},
+		{"eq",7,ch_eq},
+		{"mix",2,ch_mix}
+	};
+
+const osc_node_t mtx_nums[] =
+	{
+		{"01",5,mtx_children},{"02",5,mtx_children},{"03",5,mtx_children},{"04",5,mtx_children},{"05",5,mtx_children},{"06",5,mtx_children}
+	};
+
+const osc_node_t mtx_root = {
+	"mtx",
+	6,
+	mtx_nums
+};
+
+// Array of leafs for main/st/mix, the main bus pans and sends to the matrices
+const osc_node_t main_st_mix[] =
+	{
+		{"on",0,NULL,'i',&onoff}, {"fader",0,NULL,'f',&fader}, {"pan",0,NULL,'f',&pan},
+		{"01",5,mix_send}, {"02",2,mix_send}, {"03",5,mix_send}, {"04",2,mix_send}, {"05",5,mix_send}, {"06",2,mix_send}
+	};
+
+// Array of leafs for main/m/mix, the mono bus has no pan
+const osc_node_t main_m_mix[] =
+	{
+		{"on",0,NULL,'i',&onoff}, {"fader",0,NULL,'f',&fader},
+		{"01",5,mix_send}, {"02",2,mix_send}, {"03",5,mix_send}, {"04",2,mix_send}, {"05",5,mix_send}, {"06",2,mix_send}
+	};
+
+const osc_node_t main_st_children[] =
+	{
+		{"config",3,ch_config},
+		{"dyn",16,ch_dyn},
+		{"insert",3,ch_insert},
+		{"eq",7,ch_eq},
+		{"mix",9,main_st_mix}
+	};
+
+const osc_node_t main_m_children[] =
+	{
+		{"config",3,ch_config},
+		{"dyn",16,ch_dyn},
+		{"insert",3,ch_insert},
+		{"eq",7,ch_eq},
+		{"mix",8,main_m_mix}
+	};
+
+const osc_node_t main_nums[] =
+	{
+		{"st",5,main_st_children},{"m",5,main_m_children}
+	};
+
+const osc_node_t main_root = {
+	"main",
+	2,
+	main_nums
+};
+
+const osc_node_t dca_children[] =
+	{
+		{"on",0,NULL,'i',&onoff},
+		{"fader",0,NULL,'f',&fader},
+		{"config",3,ch_config}
+	};
+
+const osc_node_t dca_nums[] =
+	{
+		{"1",3,dca_children},{"2",3,dca_children},{"3",3,dca_children},{"4",3,dca_children},
+		{"5",3,dca_children},{"6",3,dca_children},{"7",3,dca_children},{"8",3,dca_children}
+	};
+
+const osc_node_t dca_root = {
+	"dca",
+	8,
+	dca_nums
+};
+
+// Array of leafs for fx/N/par, the meaning and scale of the parameters depend on the effect type
+const osc_node_t fx_par[] =
+	{
+		{"01",0,NULL,'f'},{"02",0,NULL,'f'},{"03",0,NULL,'f'},{"04",0,NULL,'f'},{"05",0,NULL,'f'},{"06",0,NULL,'f'},{"07",0,NULL,'f'},{"08",0,NULL,'f'},
+		{"09",0,NULL,'f'},{"10",0,NULL,'f'},{"11",0,NULL,'f'},{"12",0,NULL,'f'},{"13",0,NULL,'f'},{"14",0,NULL,'f'},{"15",0,NULL,'f'},{"16",0,NULL,'f'},
+		{"17",0,NULL,'f'},{"18",0,NULL,'f'},{"19",0,NULL,'f'},{"20",0,NULL,'f'},{"21",0,NULL,'f'},{"22",0,NULL,'f'},{"23",0,NULL,'f'},{"24",0,NULL,'f'},
+		{"25",0,NULL,'f'},{"26",0,NULL,'f'},{"27",0,NULL,'f'},{"28",0,NULL,'f'},{"29",0,NULL,'f'},{"30",0,NULL,'f'},{"31",0,NULL,'f'},{"32",0,NULL,'f'},
+		{"33",0,NULL,'f'},{"34",0,NULL,'f'},{"35",0,NULL,'f'},{"36",0,NULL,'f'},{"37",0,NULL,'f'},{"38",0,NULL,'f'},{"39",0,NULL,'f'},{"40",0,NULL,'f'},
+		{"41",0,NULL,'f'},{"42",0,NULL,'f'},{"43",0,NULL,'f'},{"44",0,NULL,'f'},{"45",0,NULL,'f'},{"46",0,NULL,'f'},{"47",0,NULL,'f'},{"48",0,NULL,'f'},
+		{"49",0,NULL,'f'},{"50",0,NULL,'f'},{"51",0,NULL,'f'},{"52",0,NULL,'f'},{"53",0,NULL,'f'},{"54",0,NULL,'f'},{"55",0,NULL,'f'},{"56",0,NULL,'f'},
+		{"57",0,NULL,'f'},{"58",0,NULL,'f'},{"59",0,NULL,'f'},{"60",0,NULL,'f'},{"61",0,NULL,'f'},{"62",0,NULL,'f'},{"63",0,NULL,'f'},{"64",0,NULL,'f'}
+	};
+
+// Array of leafs for fx/N/source
+const osc_node_t fx_source_lr[] =
+	{
+		{"l",0,NULL,'i',&fx_source}, {"r",0,NULL,'i',&fx_source}
+	};
+
+// fx 5-8 are insert only and have no source
+const osc_node_t fx_children[] =
+	{
+		{"type",0,NULL,'i',&fx_type},
+		{"par",64,fx_par},
+		{"source",2,fx_source_lr}
+	};
+
+const osc_node_t fx_nums[] =
+	{
+		{"1",3,fx_children},{"2",3,fx_children},{"3",3,fx_children},{"4",3,fx_children},
+		{"5",2,fx_children},{"6",2,fx_children},{"7",2,fx_children},{"8",2,fx_children}
+	};
+
+const osc_node_t fx_root = {
+	"fx",
+	8,
+	fx_nums
+};
+
+// Subtrees of the node index, in id order
+const osc_node_t *const osc_roots[] = { &top, &ch_root, &bus_root, &mtx_root, &main_root, &dca_root, &fx_root };
+const int osc_root_count = sizeof(osc_roots) / sizeof(osc_roots[0]);
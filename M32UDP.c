@@ -12,215 +12,25 @@
  * The receive mode is non-blocking, i.e. a timeout enables returning from
  * the call even if no response is obtained by the server.
  *
- * Send and Receive buffers are provided by the caller. No provision is
- * made in this package to keep or buffer data for deferred action or
- * transfers.
+ * X32Send and X32Recv work on buffers provided by the caller, X32Recv
+ * taking at most BSIZE bytes of a datagram. The multiplexer receives
+ * with X32RecvMany instead, into pooled packets that hold any datagram
+ * whole (M32Packet.c), and X32Send may defer set-messages to the outbox
+ * of the session (M32Outbox.c).
  */
+#define _GNU_SOURCE // sendmmsg, recvmmsg
 #include "M32.h"
 
 #include <string.h>
 #include <time.h>
+#include <errno.h>
+#include <unistd.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include <poll.h>
 
 #include <stdio.h>
 
-#define BSIZE 512 // MAX receive buffer size
-#define TIMEOUT 50 // default timeout
-
-#define round4(x) ((x) + 3) & ~0x3
-
-int X32Send(char *buffer, int length);
-int X32Recv(char *buffer, int timeout);
-
-int CONNECTION_STATE = 0;
-
-
-struct sockaddr_in Xip;
-struct sockaddr* Xip_addr = (struct sockaddr *)&Xip;
-socklen_t Xip_len = sizeof(Xip); // length of addresses
-int Xfd; // X32 socket
-struct pollfd ufds;
-int r_len, p_status; // length and status for receiving
-
-
-/*
-
-I want to associate a number with each node, to make selection of what to sync easier.
-Probably best to index on each part of the slash, since some are explicitly numbered
-0	config
-	0	chlink
-		[1-2, ..., 31-32]
-	1	auxlink
-		[1-2, ..., 7-8]
-	2	fxlink
-		[1-2, ..., 7-8]
-	3	buslink
-		[1-2, ..., 15-16]
-	4	mtxlink
-		[1-2, 3-4, 5-6]
-	5	mute
-		[1, ..., 6]
-	6	linkcfg
-		[hadly, eq, dyn, fdrmute]
-	7	mono
-		[mode, link]
-	8	solo
-	9	talk
-	10	osc
-	11	routing
-		IN
-			[1-8, ..., 25-32, AUX]
-		AES50A
-			[1-8, ..., 41-48]
-		AES50B
-			[1-8, ..., 41-48]
-		CARD
-			[1-8, ..., 25-32]
-		OUT
-			[1-4,...13-16]
-	12	userctrl
-		[A, B, C]
-			color
-			enc
-				[1, ..., 4]
-			btn
-				[5, ..., 12]
-	13	tape
-		[gainL, gainR, autoplay]
-
-0	ch
-*/
-
-typedef struct osc_node{
-	char *label;
-	int no_children;
-	const struct osc_node *children;
-} osc_node_t;
-
-
-// Array of leafs which are sets of 8 numbers (1-8,9-16,etc)
-// used in routing config
-//      !!!!!!!!!!!! TODO NOT USED FOR IN cause it needs AUX
-const osc_node_t eight_nums[] =
-    {
-        {"1-8",0,NULL},{"9-16",0,NULL},{"17-24",0,NULL},{"25-32",0,NULL},{"33-40",0,NULL},{"41-48",0,NULL}
-    };
-
-// Array of leafs which are sets of 4 numbers (1-4,5-8,etc)
-// used in OUT config
-const osc_node_t four_nums[] =
-    {
-        {"1-4",0,NULL},{"5-8",0,NULL},{"9-12",0,NULL},{"13-16",0,NULL}
-    };
-
-// Array of leafs which are 'linked' numbers (odd-even pairs up to 31-32)
-// used in chlink, auxlink,buslink,mtxlink
-const osc_node_t linked_nums[] =
-    {
-        {"1-2",0,NULL},{"3-4",0,NULL},{"5-6",0,NULL},{"7-8",0,NULL},{"9-10",0,NULL},{"11-12",0,NULL},{"13-14",0,NULL},{"15-16",0,NULL},
-		{"17-18",0,NULL},{"19-20",0,NULL},{"21-22",0,NULL},{"23-24",0,NULL},{"25-26",0,NULL},{"27-28",0,NULL},{"29-30",0,NULL},{"31-32",0,NULL}
-    };
-
-// Array of leafs which are single numbers
-// used in mutegroups,selection of channl/bus/aux/fx/etc.., and userctrl encoder/buttons
-const osc_node_t single_nums[] =
-    {
-        {"1",0,NULL},{"2",0,NULL},{"3",0,NULL},{"4",0,NULL},{"5",0,NULL},{"6",0,NULL},
-		{"7",0,NULL},{"8",0,NULL},{"9",0,NULL},{"10",0,NULL},{"11",0,NULL},{"12",0,NULL}
-    };
-
-// Array of leafs for config/linkcfg
-const osc_node_t config_linkcfg[] =
-    {
-		{"hadly",0,NULL}, {"eq",0,NULL}, {"dyn",0,NULL}, {"fdrmute",0,NULL}
-	};
-
-// Array of leafs for config/mono
-const osc_node_t config_mono[] =
-    {
-		{"mode",0,NULL}, {"link",0,NULL}
-	};
-
-// Array of leafs for config/solo
-const osc_node_t config_solo[] =
-    {
-		{"level",0,NULL}, {"source",0,NULL}, {"sourcetrim",0,NULL}, {"chmode",0,NULL}, {"busmode",0,NULL}, {"dcamode",0,NULL}, {"exclusive",0,NULL}, {"followsel",0,NULL}, {"followsolo",0,NULL},
-		{"dimatt",0,NULL}, {"dim",0,NULL}, {"mono",0,NULL}, {"delay",0,NULL}, {"delaytime",0,NULL}, {"masterctrl",0,NULL}, {"mute",0,NULL}, {"dimpfl",0,NULL}
-	};
-
-// Array of leafs for config/talk/{A/B}
-const osc_node_t config_talk_AB[] =
-    {
-		{"level",0,NULL}, {"dim",0,NULL}, {"latch",0,NULL}, {"destmap",0,NULL}
-	};
-
-// Array of leafs for config/talk
-const osc_node_t config_talk[] =
-    {
-		{"enable",0,NULL}, {"source",0,NULL}, {"A",4,config_talk_AB},{"B",4,config_talk_AB}
-	};
-
-// Array of leafs for config/osc
-const osc_node_t config_osc[] =
-    {
-		{"level",0,NULL}, {"f1",0,NULL}, {"f2",0,NULL}, {"fsel",0,NULL}, {"type",0,NULL}, {"dest",0,NULL}
-	};
-
-// Array of leafs for config/routing/IN
-const osc_node_t config_routing_IN[] =
-    {
-		{"1-8",0,NULL},{"9-16",0,NULL},{"17-24",0,NULL},{"25-32",0,NULL},{"AUX",0,NULL}
-	};
-
-// Array of leafs for config/routing
-const osc_node_t config_routing[] =
-    {
-		{"IN",5,config_routing_IN}, {"AES50A",6,eight_nums}, {"AES50B",6,eight_nums}, {"CARD",4,eight_nums}, {"OUT",4,four_nums}
-	};
-
-// Array of leafs for config/usrctrl{A/B/C}
-const osc_node_t config_userctrl_ABC[] =
-    {
-		{"color",0,NULL},{"enc",4,single_nums},{"btn",8,single_nums+4}
-	};
-
-// Array of leafs for config/userctrl
-const osc_node_t config_userctrl[] =
-    {
-		{"A",3,config_userctrl_ABC},{"B",3,config_userctrl_ABC},{"C",3,config_userctrl_ABC}
-	};
-
-// Array of leafs for config/tape
-const osc_node_t config_tape[] =
-    {
-		{"gainL",0,NULL},{"gainR",0,NULL},{"autoplay",0,NULL}
-	};
-
-const osc_node_t config[] =
-	{
-		{"chlink", 16, linked_nums},
-		{"auxlink", 4, linked_nums},
-		{"fxlink", 4, linked_nums},
-		{"buslink", 8, linked_nums},
-		{"mtxlink", 3, linked_nums},
-		{"mute", 6, single_nums},
-		{"linkcfg", 4, config_linkcfg},
-		{"mono", 2, config_mono},
-		{"solo", 17, config_solo},
-		{"talk", 4, config_talk},
-		{"osc", 6, config_osc},
-		{"routing", 5, config_routing},
-		{"usrctrl", 3, config_userctrl},
-		{"tape", 3, config_tape}
-	};
-
-const osc_node_t top = {
-	"config",
-	14,
-	config
-};
 
 void walkTree(char *string, int offset, const osc_node_t *node){
 	int add = strlen(node->label) + 1;
@@ -250,148 +60,358 @@ void printBuffer(char* buffer, int length){
 }
 
 /**
- * Parses the arguments out of a OSC response
- * Returns a malloced char** with the arguments in order.
- * Returns null if there are no arguments or on malloc failure
-*/
-char** parseArgs(char* buffer, int length){
+ * Reads a null terminated, 4 byte padded OSC string at offset.
+ * view: set to the string (len excludes the null)
+ *
+ * Returns the offset following the padding, or -1 if the string or its
+ * padding runs past length
+ */
+static int viewPadded(const char *buffer, int length, int offset, struct osc_view *view){
+	if(offset >= length){
+		return -1;
+	}
+	const char *end = memchr(buffer + offset, '\0', length - offset);
+	if(end == NULL){
+		return -1;
+	}
+	view->ptr = buffer + offset;
+	view->len = end - view->ptr;
+
+	int next = offset + round4(view->len + 1);
+	return next <= length ? next : -1;
+}
+
+/**
+ * Reads a big endian 32 bit value at offset.
+ */
+static uint32_t getInt32(const char *buffer, int offset){
+	uint32_t value;
+	memcpy(&value, buffer + offset, 4);
+	return ntohl(value);
+}
+
+/**
+ * Decodes an OSC message in place. No allocation is made and nothing is
+ * copied: strings and blobs in msg point into buffer, so they are only
+ * valid as long as buffer is. Every read is bounds checked against length.
+ * buffer: received message, eg. from X32Recv
+ * length: number of valid bytes in buffer
+ * msg: filled with the address, type tags and up to OSC_MAX_ARGS arguments
+ *
+ * Returns the number of arguments, or -1 if the message is malformed
+ */
+int oscDecode(const char *buffer, int length, struct osc_message *msg){
 	if(buffer == NULL || length <= 0){
-		return NULL;
+		return -1;
 	}
 
-	printf("\t%s\n", buffer);
-	// have to look through manually cause string has nulls. ew.
-	char* comma = NULL;
-	for(int i = 0; i < length; i++){
-		if(buffer[i] == ','){
-			comma = buffer + i;
-			break;
+	int offset = viewPadded(buffer, length, 0, &msg->address);
+	if(offset < 0){
+		return -1;
+	}
+
+	msg->argc = 0;
+	msg->types.ptr = buffer + offset;
+	msg->types.len = 0;
+	if(offset == length){
+		return 0; // no type tag string, eg. a bare "/info" reply
+	}
+	if(buffer[offset] != ','){
+		return -1;
+	}
+
+	offset = viewPadded(buffer, length, offset, &msg->types);
+	if(offset < 0){
+		return -1;
+	}
+	// drop the leading ','
+	msg->types.ptr++;
+	msg->types.len--;
+	if(msg->types.len > OSC_MAX_ARGS){
+		return -1;
+	}
+
+	for(int i = 0; i < msg->types.len; i++){
+		struct osc_arg *arg = msg->args + i;
+		arg->type = msg->types.ptr[i];
+
+		if(arg->type == 'i' || arg->type == 'f'){
+			if(offset + 4 > length){
+				return -1;
+			}
+			uint32_t value = getInt32(buffer, offset);
+			if(arg->type == 'i'){
+				arg->i = value;
+			}else{
+				memcpy(&arg->f, &value, 4);
+			}
+			offset += 4;
+		}else if(arg->type == 's'){
+			offset = viewPadded(buffer, length, offset, &arg->s);
+			if(offset < 0){
+				return -1;
+			}
+		}else if(arg->type == 'b'){
+			if(offset + 4 > length){
+				return -1;
+			}
+			uint32_t size = getInt32(buffer, offset);
+			if(size > (uint32_t)(length - offset - 4)){
+				return -1;
+			}
+			arg->b.ptr = buffer + offset + 4;
+			arg->b.len = size;
+			offset += 4 + round4(size);
+			if(offset > length){
+				return -1;
+			}
+		}else if(arg->type != 'T' && arg->type != 'F' && arg->type != 'N' && arg->type != 'I'){
+			return -1; // unknown size, cannot go on
 		}
+		msg->argc++;
 	}
+	return msg->argc;
+}
 
-	if(comma == NULL){
-		return NULL;
+/**
+ * Copies a decoded argument into a value that outlives the receive buffer.
+ * Strings longer than X32_STRING_MAX - 1 are truncated.
+ *
+ * Returns 0 on success, -1 for argument types without a value
+ */
+int oscArgValue(const struct osc_arg *arg, struct x32_value *value){
+	if(arg->type == 'i'){
+		value->i = arg->i;
+	}else if(arg->type == 'f'){
+		value->f = arg->f;
+	}else if(arg->type == 's'){
+		int len = arg->s.len < X32_STRING_MAX - 1 ? arg->s.len : X32_STRING_MAX - 1;
+		memcpy(value->s, arg->s.ptr, len);
+		value->s[len] = '\0';
+	}else{
+		return -1;
 	}
+	value->type = arg->type;
+	return 0;
+}
 
-	int argnum = strlen(comma) - 1;
-	int offset = round4(strlen(comma) + 1);
+/**
+ * Parses the arguments out of a OSC response
+ * Returns a malloced char** with the arguments in order.
+ * ints and floats are 4 byte blocks in host order, strings are null terminated.
+ * Returns null if there are no arguments, on a malformed message or on malloc failure
+*/
+char** parseArgs(char* buffer, int length){
+	struct osc_message msg;
+	if(oscDecode(buffer, length, &msg) <= 0){
+		return NULL;
+	}
 
-	char** args = malloc(argnum * sizeof(char *));
+	char** args = calloc(msg.argc, sizeof(char *));
 	if(args == NULL){
 		return NULL;
 	}
 
-	for(int i = 0; i < argnum; i++){
-		printf("\targ %d: ", i);
-		char type = comma[i + 1];
-		if(type == 'i'){
+	for(int i = 0; i < msg.argc; i++){
+		struct osc_arg *arg = msg.args + i;
+		if(arg->type == 'i' || arg->type == 'f'){
 			args[i] = malloc(4 * sizeof(char));
-			if(args[i] == NULL){
-				return NULL;
+			if(args[i] != NULL){
+				memcpy(args[i], &arg->i, 4);
 			}
-			((int *)args[i])[0] = ntohl(*(int *)(comma + offset));
-			offset += 4;
-
-			printf("%i\n", ((int *)args[i])[0]);
-
-		}else if(type == 'f'){
-			args[i] = malloc(4 * sizeof(char));
-			if(args[i] == NULL){
-				return NULL;
+		}else if(arg->type == 's'){
+			args[i] = malloc(arg->s.len + 1);
+			if(args[i] != NULL){
+				memcpy(args[i], arg->s.ptr, arg->s.len);
+				args[i][arg->s.len] = '\0';
 			}
-			((float *)args[i])[0] = *(float *)(comma + offset);
-			offset += 4;
-
-			printf("%f\n", ((float *)args[i])[0]);
+		}else{
+			continue; // blobs and flags have no char* form, left NULL
+		}
 
-		}else if(type == 's'){
-			int str_len = strlen(comma + offset) + 1; // count ending null
-			
-			args[i] = malloc(str_len * sizeof(char));
-			if(args[i] == NULL){
-				return NULL;
+		if(args[i] == NULL){
+			for(int j = 0; j < i; j++){
+				free(args[j]);
 			}
-			strcpy(args[i], comma + offset);
-			printf("%s\n", args[i]);
-
-			offset += round4(str_len);
-		}/*else if(type == 'b'){
-
-		}*/
+			free(args);
+			return NULL;
+		}
 	}
-	
+
 	return args;
 }
 
 /**
- * Generates a message to send to the M32 given:
- * address: string representing the node to send the command to
- * argtypes: string with with the arg types in order (eg. "s", "ifff", "ss")
- * args: string array with the arguments to be used. Length of array must be equal to strlen(argtypes)
- * Args must be 4 bytes each
- * 
- * Returns response from X32Send
-*/
-int generateAndSendMessageWithArgs(char* address, char* argtypes, char** args){
-	// Pad out address length
-	int add_len = round4(strlen(address)+1); // add ending null then round
-
-	// determine number of args and length of arg string
-	int argnum = strlen(argtypes);
-	int type_len = round4(2 + argnum); // add comma and ending null
+ * Copies a string into an OSC message with its null terminator and zero
+ * padding up to the next 4 byte boundary.
+ * len: strlen(string)
+ *
+ * Returns the offset following the padded string
+ */
+static int putPadded(char *buffer, int offset, const char *string, int len){
+	int padded = round4(len + 1);
+	memcpy(buffer + offset, string, len);
+	memset(buffer + offset + len, 0, padded - len);
+	return offset + padded;
+}
 
+/**
+ * Writes a 32 bit value to an OSC message in network order.
+ */
+static int putInt32(char *buffer, int offset, uint32_t value){
+	value = htonl(value);
+	memcpy(buffer + offset, &value, 4);
+	return offset + 4;
+}
 
-	int args_len = 0;
+/**
+ * Encodes an OSC message into a caller supplied buffer, no allocation is made.
+ * buffer: destination, must be able to hold the whole message
+ * size: size of buffer in bytes
+ * address: string representing the node to send the command to
+ * argtypes: string with the arg types in order (eg. "s", "ifff", "ss"), may be NULL
+ * args: as for generateAndSendMessageWithArgs, ints and floats are 4 bytes in network order
+ *
+ * Returns the length of the encoded message, or -1 if it does not fit
+ */
+int oscEncodeMessage(char *buffer, int size, const char *address, const char *argtypes, char **args){
+	int add_len = strlen(address);
+	int argnum = argtypes == NULL ? 0 : strlen(argtypes);
 
+	// every length is known up front, so check the fit once
+	int message_len = round4(add_len + 1) + round4(argnum + 2);
 	for(int i = 0; i < argnum; i++){
-		char type = argtypes[i];
-		if(type == 'i'){
-			args_len += 4;
-		}else if(type == 'f'){
-			args_len += 4;
-		}else if(type == 's'){
-			int str_len = round4(strlen(args[i]) + 1); // count ending null
+		if(argtypes[i] == 's'){
+			message_len += round4(strlen(args[i]) + 1);
+		}else if(argtypes[i] == 'i' || argtypes[i] == 'f'){
+			message_len += 4;
+		}else{
+			return -1;
+		}
+	}
+	if(message_len > size){
+		return -1;
+	}
 
-			args_len += str_len;
-		}/*else if(type == 'b'){
+	int offset = putPadded(buffer, 0, address, add_len);
+	// type tag string is ',' followed by argtypes
+	int type_len = round4(argnum + 2);
+	buffer[offset] = ',';
+	if(argnum > 0){
+		memcpy(buffer + offset + 1, argtypes, argnum);
+	}
+	memset(buffer + offset + 1 + argnum, 0, type_len - argnum - 1);
+	offset += type_len;
 
-		}*/
+	for(int i = 0; i < argnum; i++){
+		if(argtypes[i] == 's'){
+			offset = putPadded(buffer, offset, args[i], strlen(args[i]));
+		}else{
+			memcpy(buffer + offset, args[i], 4);
+			offset += 4;
+		}
 	}
-	int message_len = add_len + type_len + args_len;
+	return offset;
+}
 
-	char *message = malloc(message_len);
-	if(message == NULL){
+/**
+ * Encodes an OSC message with no arguments (a query) into buffer.
+ *
+ * Returns the length of the encoded message, or -1 if it does not fit
+ */
+int oscEncodeQuery(char *buffer, int size, const char *address){
+	int add_len = strlen(address);
+	if(round4(add_len + 1) + 4 > size){
 		return -1;
 	}
+	int offset = putPadded(buffer, 0, address, add_len);
+	return putPadded(buffer, offset, ",", 1);
+}
 
-	memset(message, 0, message_len);
-	strcpy(message, address);
-	message[add_len] = ',';
-	strcpy(message + add_len + 1, argtypes);
+/**
+ * Encodes an OSC message with one int argument into buffer.
+ * value: host order integer
+ *
+ * Returns the length of the encoded message, or -1 if it does not fit
+ */
+int oscEncodeInt(char *buffer, int size, const char *address, int value){
+	int add_len = strlen(address);
+	if(round4(add_len + 1) + 8 > size){
+		return -1;
+	}
+	int offset = putPadded(buffer, 0, address, add_len);
+	offset = putPadded(buffer, offset, ",i", 2);
+	return putInt32(buffer, offset, value);
+}
 
-	int offset = add_len + type_len;
+/**
+ * Encodes an OSC message with one float argument into buffer.
+ * value: host order float, sent big endian as OSC requires
+ *
+ * Returns the length of the encoded message, or -1 if it does not fit
+ */
+int oscEncodeFloat(char *buffer, int size, const char *address, float value){
+	int add_len = strlen(address);
+	if(round4(add_len + 1) + 8 > size){
+		return -1;
+	}
+	uint32_t bits;
+	memcpy(&bits, &value, 4);
 
-	for(int i = 0; i < argnum; i++){
-		char type = argtypes[i];
-		if(type == 'i'){
-			memcpy(message + offset, args[i], 4);
-			offset += 4;
-		}else if(type == 'f'){
-			memcpy(message + offset, args[i], 4);
-			offset += 4;
-		}else if(type == 's'){
-			strcpy(message + offset, args[i]);
+	int offset = putPadded(buffer, 0, address, add_len);
+	offset = putPadded(buffer, offset, ",f", 2);
+	return putInt32(buffer, offset, bits);
+}
 
-			int str_len = round4(strlen(args[i]) + 1); // count ending null
+/**
+ * Encodes an OSC message with one string argument into buffer.
+ * value: null terminated string
+ *
+ * Returns the length of the encoded message, or -1 if it does not fit
+ */
+int oscEncodeString(char *buffer, int size, const char *address, const char *value){
+	int add_len = strlen(address);
+	int value_len = strlen(value);
+	if(round4(add_len + 1) + 4 + round4(value_len + 1) > size){
+		return -1;
+	}
+	int offset = putPadded(buffer, 0, address, add_len);
+	offset = putPadded(buffer, offset, ",s", 2);
+	return putPadded(buffer, offset, value, value_len);
+}
 
-			offset += str_len;
-		}/*else if(type == 'b'){
+/**
+ * Generates a message to send to the M32 given:
+ * address: string representing the node to send the command to
+ * argtypes: string with with the arg types in order (eg. "s", "ifff", "ss")
+ * args: string array with the arguments to be used. Length of array must be equal to strlen(argtypes)
+ * Args must be 4 bytes each
+ * 
+ * Messages are built on the stack; only messages longer than BSIZE (long
+ * strings) fall back to a heap buffer.
+ *
+ * Returns response from X32Send
+*/
+int generateAndSendMessageWithArgs(char* address, char* argtypes, char** args){
+	char message[BSIZE];
 
-		}*/
+	int message_len = oscEncodeMessage(message, BSIZE, address, argtypes, args);
+	if(message_len >= 0){
+		return X32Send(message, message_len);
 	}
 
-	int res = X32Send(message, message_len);
-	free(message);
+	// too long for the stack buffer, size it exactly
+	int size = round4(strlen(address) + 1) + round4(strlen(argtypes) + 2);
+	for(int i = 0; argtypes[i]; i++){
+		size += argtypes[i] == 's' ? round4(strlen(args[i]) + 1) : 4;
+	}
+	char *heap = malloc(size);
+	if(heap == NULL){
+		return -1;
+	}
+	message_len = oscEncodeMessage(heap, size, address, argtypes, args);
+	int res = message_len < 0 ? -1 : X32Send(heap, message_len);
+	free(heap);
 	return res;
 }
 
@@ -402,23 +422,113 @@ int generateAndSendMessageWithArgs(char* address, char* argtypes, char** args){
  * Returns response from X32Send
 */
 int generateAndSendMessage(char* address){
-	// Pad out address length
-	int add_len = round4(strlen(address)+1); // add null
+	char message[BSIZE];
 
-	int message_len = add_len+4;
+	int message_len = oscEncodeQuery(message, BSIZE, address);
+	if(message_len < 0){
+		return -1;
+	}
+	return X32Send(message, message_len);
+}
 
-	char *message = malloc(message_len);
-	if(message == NULL){
+/**
+ * Sends a set-message with one argument of type 'i', 'f' or 's' that is
+ * too long for the stack buffer of the send functions below (long address
+ * or string) from a heap buffer sized to it.
+ * value: int, float or null terminated string, by type
+ *
+ * Returns response from X32Send, or -1 on error
+ */
+static int sendOversized(const char *address, char type, const void *value){
+	int size = round4(strlen(address) + 1) + 4;
+	size += type == 's' ? round4(strlen(value) + 1) : 4;
+	char *heap = malloc(size);
+	if(heap == NULL){
 		return -1;
 	}
+	int message_len;
+	if(type == 'i'){
+		message_len = oscEncodeInt(heap, size, address, *(const int *)value);
+	}else if(type == 'f'){
+		message_len = oscEncodeFloat(heap, size, address, *(const float *)value);
+	}else{
+		message_len = oscEncodeString(heap, size, address, value);
+	}
+	int res = message_len < 0 ? -1 : X32Send(heap, message_len);
+	free(heap);
+	return res;
+}
 
-	memset(message, 0, message_len);
-	strcpy(message, address);
-	message[add_len] = ',';
+/**
+ * Queries address and decodes the reply, which must carry a value of type.
+ * msg: views into r_buf
+ *
+ * Returns X32_OK, or the error
+ */
+static enum x32_status getReply(const char *address, char type, char *r_buf, struct osc_message *msg){
+	long long start = monotonicUs();
+	int length;
+	enum x32_status status = X32Query(address, r_buf, &length);
+	if(status == X32_OK && (oscDecode(r_buf, length, msg) < 1 || msg->args[0].type != type)){
+		status = X32_TYPE_ERROR;
+	}
 
-	int res = X32Send(message, message_len);
-	free(message);
-	return res;
+	metricCount(METRIC_GETS, 1);
+	if(status != X32_OK){
+		metricCount(METRIC_GET_ERRORS, 1);
+	}
+	metricLatency(METRIC_GET, metricClass(address, strlen(address)), monotonicUs() - start);
+	return status;
+}
+
+/**
+ * Queries an integer parameter, retransmitting on loss.
+ * value: receives the value, left alone on failure
+ *
+ * Returns X32_OK, or the error
+ */
+enum x32_status X32GetInt(const char *address, int *value){
+	char r_buf[BSIZE];
+	struct osc_message msg;
+	enum x32_status status = getReply(address, 'i', r_buf, &msg);
+	if(status == X32_OK){
+		*value = msg.args[0].i;
+	}
+	return status;
+}
+
+/**
+ * Queries a float parameter, retransmitting on loss.
+ * value: receives the value, left alone on failure
+ *
+ * Returns X32_OK, or the error
+ */
+enum x32_status X32GetFloat(const char *address, float *value){
+	char r_buf[BSIZE];
+	struct osc_message msg;
+	enum x32_status status = getReply(address, 'f', r_buf, &msg);
+	if(status == X32_OK){
+		*value = msg.args[0].f;
+	}
+	return status;
+}
+
+/**
+ * Queries a string parameter, retransmitting on loss.
+ * value: receives the null terminated value, truncated to size - 1 chars
+ *
+ * Returns X32_OK, or the error
+ */
+enum x32_status X32GetString(const char *address, char *value, int size){
+	char r_buf[BSIZE];
+	struct osc_message msg;
+	enum x32_status status = getReply(address, 's', r_buf, &msg);
+	if(status == X32_OK){
+		int len = msg.args[0].s.len < size - 1 ? msg.args[0].s.len : size - 1;
+		memcpy(value, msg.args[0].s.ptr, len);
+		value[len] = '\0';
+	}
+	return status;
 }
 
 /**
@@ -427,23 +537,14 @@ int generateAndSendMessage(char* address){
  * address: string representing the node to send the command to
  * 
  * Returns integer response, or -1 on failure (Console should never send -integer);
+ * see X32GetInt to tell failures apart
 */
 int getIntValue(char* address){
-	if(generateAndSendMessage(address)){
-		char r_buf[BSIZE];
-		r_len = X32Recv(r_buf, TIMEOUT);
-		char **results = parseArgs(r_buf, r_len);
-		if(results == NULL){
-			return -1;
-		}
-
-		//convert int back to network order
-		int res = ((int *)results[0])[0];
-		free(results[0]);
-		free(results);
-		return res;
+	int value;
+	if(X32GetInt(address, &value) != X32_OK){
+		return -1;
 	}
-	return -1;
+	return value;
 }
 
 /**
@@ -451,16 +552,16 @@ int getIntValue(char* address){
  * address: string representing the node to send the command to
  * int: host order integer to send as argument
  * 
- * Returns response from generateAndSendMessageWithArgs.
+ * Returns response from X32Send.
 */
 int sendIntValue(char *address, int value){
-	int32_t arg1 = htonl(value);
-	char** args = malloc(1*sizeof(char*));
-	args[0] = (char *) &arg1;
+	char message[BSIZE];
 
-	int res = generateAndSendMessageWithArgs(address, "i", args);
-	free(args);
-	return res;
+	int message_len = oscEncodeInt(message, BSIZE, address, value);
+	if(message_len < 0){
+		return sendOversized(address, 'i', &value);
+	}
+	return X32Send(message, message_len);
 }
 
 /**
@@ -469,23 +570,14 @@ int sendIntValue(char *address, int value){
  * address: string representing the node to send the command to
  * 
  * Returns float response, or -1 on failure (Console should never send -integer);
+ * see X32GetFloat to tell failures apart
 */
 float getFloatValue(char* address){
-	if(generateAndSendMessage(address)){
-		char r_buf[BSIZE];
-		r_len = X32Recv(r_buf, TIMEOUT);
-		char **results = parseArgs(r_buf, r_len);
-		if(results == NULL){
-			return -1;
-		}
-
-		//convert int back to network order
-		int res = ((float *)results[0])[0];
-		free(results[0]);
-		free(results);
-		return res;
+	float value;
+	if(X32GetFloat(address, &value) != X32_OK){
+		return -1;
 	}
-	return -1;
+	return value;
 }
 
 /**
@@ -493,16 +585,16 @@ float getFloatValue(char* address){
  * address: string representing the node to send the command to
  * float: host order float to send as argument
  * 
- * Returns response from generateAndSendMessageWithArgs.
+ * Returns response from X32Send.
 */
 int sendFloatValue(char *address, float value){
-	float arg1 = value;
-	char** args = malloc(1*sizeof(char*));
-	args[0] = (char *) &arg1;
+	char message[BSIZE];
 
-	int res = generateAndSendMessageWithArgs(address, "f", args);
-	free(args);
-	return res;
+	int message_len = oscEncodeFloat(message, BSIZE, address, value);
+	if(message_len < 0){
+		return sendOversized(address, 'f', &value);
+	}
+	return X32Send(message, message_len);
 }
 
 /**
@@ -513,20 +605,11 @@ int sendFloatValue(char *address, float value){
  * Returns malloced string response, or NULL on failure
 */
 char *getStringValue(char* address){
-	if(generateAndSendMessage(address)){
-		char r_buf[BSIZE];
-		r_len = X32Recv(r_buf, TIMEOUT);
-		char **results = parseArgs(r_buf, r_len);
-		if(results == NULL){
-			return NULL;
-		}
-
-		//convert int back to network order
-		char *res = results[0];
-		free(results);
-		return res;
+	char value[BSIZE];
+	if(X32GetString(address, value, BSIZE) != X32_OK){
+		return NULL;
 	}
-	return NULL;
+	return strdup(value);
 }
 
 /**
@@ -534,16 +617,16 @@ char *getStringValue(char* address){
  * address: string representing the node to send the command to
  * string: null terminated string to send as argument
  * 
- * Returns response from generateAndSendMessageWithArgs.
+ * Returns response from X32Send.
 */
 int sendStringValue(char *address, char *value){
-	char* arg1 = value;
-	char** args = malloc(1*sizeof(char*));
-	args[0] = (char *) &arg1;
+	char message[BSIZE];
 
-	int res = generateAndSendMessageWithArgs(address, "s", args);
-	free(args);
-	return res;
+	int message_len = oscEncodeString(message, BSIZE, address, value);
+	if(message_len < 0){
+		return sendOversized(address, 's', value);
+	}
+	return X32Send(message, message_len);
 }
 
 int getChannelName(int ch, char* r_buf){
@@ -553,12 +636,7 @@ int getChannelName(int ch, char* r_buf){
 
 	char addr[20];
 	snprintf(addr, 20, "/ch/%02i/config/name", ch);
-	if(generateAndSendMessage(addr) < 0){
-		return -1;
-	}
-
-	int r_len = X32Recv(r_buf, TIMEOUT);
-	return r_len;
+	return X32Request(addr, r_buf, TIMEOUT);
 }
 
 int getChannelEq(int ch, int band, char* r_buf){
@@ -568,165 +646,12 @@ int getChannelEq(int ch, int band, char* r_buf){
 
 	char addr[13];
 	snprintf(addr, 13, "/ch/%02i/eq/%i", ch, band);
-	if(generateAndSendMessage(addr) < 0){
-		return -1;
-	}
-
-	int r_len = X32Recv(r_buf, TIMEOUT);
-	return r_len;
-}
-
-struct channel* getChannelInfo(int ch){
-	struct channel* channel;
-
-	if(ch < 1 || ch > 32){
-		return NULL;
-	}
-
-	channel = malloc(sizeof(struct channel));
-	if(channel == NULL){
-		return NULL;
-	}
-
-	char addr[40];
-	snprintf(addr, 40, "/ch/%02i", ch);
-	char *base_addr = addr + 6;
-
-	printf("Getting name\n");
-	// Config values
-	snprintf(base_addr, 34, "/config/name");
-	char* str_res = getStringValue(addr);
-	strcpy(channel->config.scribble.name, str_res);
-	free(str_res);
-	snprintf(base_addr, 34, "/config/icon");
-	channel->config.scribble.icon = getIntValue(addr);
-	snprintf(base_addr, 34, "/config/color");
-	channel->config.scribble.color = getIntValue(addr);
-	snprintf(base_addr, 34, "/config/source");
-	channel->config.source = getIntValue(addr);
-
-	// Delay
-	snprintf(base_addr, 34, "/delay/on");
-	channel->delay.on = getIntValue(addr);
-	snprintf(base_addr, 34, "/delay/time");
-	channel->delay.time = getFloatValue(addr);
-
-	// Preamp/HPF
-	snprintf(base_addr, 34, "/preamp/trim");
-	channel->preamp.trim = getFloatValue(addr);
-	snprintf(base_addr, 34, "/preamp/invert");
-	channel->preamp.invert = getIntValue(addr);
-	snprintf(base_addr, 34, "/preamp/hpon");
-	channel->preamp.hpon = getIntValue(addr);
-	snprintf(base_addr, 34, "/preamp/hpslope");
-	channel->preamp.hpslope = getIntValue(addr);
-	snprintf(base_addr, 34, "/preamp/hpf");
-	channel->preamp.hpf = getFloatValue(addr);
-
-	// Gate
-	snprintf(base_addr, 34, "/gate/on");
-	channel->gate.on = getIntValue(addr);
-	snprintf(base_addr, 34, "/gate/mode");
-	channel->gate.mode = getIntValue(addr);
-	snprintf(base_addr, 34, "/gate/thr");
-	channel->gate.thr = getFloatValue(addr);
-	snprintf(base_addr, 34, "/gate/range");
-	channel->gate.range = getFloatValue(addr);
-	snprintf(base_addr, 34, "/gate/attack");
-	channel->gate.attack = getFloatValue(addr);
-	snprintf(base_addr, 34, "/gate/hold");
-	channel->gate.hold = getFloatValue(addr);
-	snprintf(base_addr, 34, "/gate/release");
-	channel->gate.release = getFloatValue(addr);
-	snprintf(base_addr, 34, "/gate/keysrc");
-	channel->gate.keysrc = getIntValue(addr);
-
-	snprintf(base_addr, 34, "/gate/filter/on");
-	channel->gate.filter_on = getIntValue(addr);
-	snprintf(base_addr, 34, "/gate/filter/type");
-	channel->gate.filter_type = getIntValue(addr);
-	snprintf(base_addr, 34, "/gate/filter/f");
-	channel->gate.filter_f = getFloatValue(addr);
-
-	return channel;
-}
-
-int copyChannelConfig(int chsrc, int chdst){
-	char r_buf[BSIZE];
-
-	if(chsrc < 1 || chsrc > 32 || chdst < 1 || chdst > 32){
-		return -1;
-	}
-	char addr[30];
-
-	// Copy name
-	snprintf(addr, 30, "/ch/%02i/config/name", chsrc);
-	if(generateAndSendMessage(addr) < 0){
-		return -1;
-	}
-
-	int r_len = X32Recv(r_buf, TIMEOUT);
-	char **results = parseArgs(r_buf, r_len);
-	if(results == NULL){
-		return -1;
-	}
-
-	snprintf(addr, 30, "/ch/%02i/config/name", chdst);
-	if(generateAndSendMessageWithArgs(addr, "s", results) < 0){
-		return -1;
-	}
-	free(results[0]);
-	free(results);
-
-	// Copy icon
-	snprintf(addr, 30, "/ch/%02i/config/icon", chsrc);
-	if(generateAndSendMessage(addr) < 0){
-		return -1;
-	}
-
-	r_len = X32Recv(r_buf, TIMEOUT);
-	results = parseArgs(r_buf, r_len);
-	if(results == NULL){
-		return -1;
-	}
-
-	//convert int back to network order
-	((int *)results[0])[0] = htonl(((int *)results[0])[0]);
-
-	snprintf(addr, 30, "/ch/%02i/config/icon", chdst);
-	if(generateAndSendMessageWithArgs(addr, "i", results) < 0){
-		return -1;
-	}
-	free(results[0]);
-	free(results);
-
-	// Copy color
-	snprintf(addr, 30, "/ch/%02i/config/color", chsrc);
-	if(generateAndSendMessage(addr) < 0){
-		return -1;
-	}
-
-	r_len = X32Recv(r_buf, TIMEOUT);
-	results = parseArgs(r_buf, r_len);
-	if(results == NULL){
-		return -1;
-	}
-
-	//convert int back to network order
-	((int *)results[0])[0] = htonl(((int *)results[0])[0]);
-
-	snprintf(addr, 30, "/ch/%02i/config/color", chdst);
-	if(generateAndSendMessageWithArgs(addr, "i", results) < 0){
-		return -1;
-	}
-	free(results[0]);
-	free(results);
-
-	return 0;
+	return X32Request(addr, r_buf, TIMEOUT);
 }
 
 /*
-Initialize communication with Console at the given ip/port
+Initialize communication with Console at the given ip/port, on the socket
+of the current session (see X32Use); a previous connection is closed
 
 Returns:
     -3 on data send error
@@ -735,158 +660,346 @@ Returns:
     0 on connection timeout
     1 on validated connection
 */
-int X32Connect(char *ip_str, int port) {
+static int connectSocket(char *ip_str, int port) {
+    struct x32_socket *x = X32Socket();
     char r_buf[128]; // receive buffer for /info command test
     char Info[8] = "/info"; // testing connection with /info request (X32, M32)
     //char Info[8] = "/xinfo"; // testing connection with /xinfo request (XR series)
-    
+    struct pollfd ufds;
+    int p_status;
+
+    if (x->fd >= 0) {
+        close(x->fd);
+    }
+    x->state = 0;
+    x->bundles = BUNDLE_AUTO;
+
     // Create UDP socket
-    if ((Xfd = socket (PF_INET, SOCK_DGRAM, IPPROTO_UDP)) < 0) {
-		CONNECTION_STATE = 0;
+    if ((x->fd = socket (PF_INET, SOCK_DGRAM, IPPROTO_UDP)) < 0) {
         return -2; // An error occurred on socket creation
     }
 
     // Server sockaddr_in structure
-    memset (&Xip, 0, sizeof(Xip)); // Clear structure
-    Xip.sin_family = AF_INET; // Internet/IP
-    Xip.sin_addr.s_addr = inet_addr(ip_str); // IP address
-    Xip.sin_port = htons(port); // server port
+    memset (&x->address, 0, sizeof(x->address)); // Clear structure
+    x->address.sin_family = AF_INET; // Internet/IP
+    x->address.sin_addr.s_addr = inet_addr(ip_str); // IP address
+    x->address.sin_port = htons(port); // server port
     //
     // Prepare for poll() on receiving data
-    ufds.fd = Xfd;
+    ufds.fd = x->fd;
     ufds.events = POLLIN; //Check for normal data
     //
     // Validate connection by sending a /info command
-    if (sendto (Xfd, Info, 8, 0, Xip_addr, Xip_len) < 0) {
-		CONNECTION_STATE = 0;
+    if (sendto (x->fd, Info, 8, 0, (struct sockaddr *)&x->address, sizeof(x->address)) < 0) {
         return (-3);
     }
     if ((p_status = poll (&ufds, 1, 100)) > 0) { // X32 sent something?
-        r_len = recvfrom(Xfd, r_buf, 128, 0, 0, 0); // Get answer and
-        if ((strncmp(r_buf, Info, 5)) == 0) { // test data (5 bytes)
-			CONNECTION_STATE = 1;
+        int r_len = recvfrom(x->fd, r_buf, 128, 0, 0, 0); // Get answer and
+        if (r_len >= 5 && (strncmp(r_buf, Info, 5)) == 0) { // test data (5 bytes)
+			x->state = 1;
             return 1; // Connected
         }
     } else if (p_status < 0) {
-		CONNECTION_STATE = 0;
         return -1; // Error on polling (not connected)
     }
     // Not connected on timeout
-	CONNECTION_STATE = 0;
     return 0;
 }
 
 /*
-Searches for a console on all ports in a 255.255.255.0 subnet
+Connects as connectSocket does, counting attempts and their duration
+(see M32Metrics.c)
+*/
+int X32Connect(char *ip_str, int port) {
+	long long start = monotonicUs();
+	int res = connectSocket(ip_str, port);
+
+	metricCount(METRIC_CONNECTS, 1);
+	if (res != 1) {
+		metricCount(METRIC_CONNECT_FAILURES, 1);
+	}
+	metricLatency(METRIC_CONNECT, METRIC_OTHER, monotonicUs() - start);
+	return res;
+}
+
+/*
+Searches for consoles in the 192.168.0.0/24 subnet and prints them,
+see X32Discover for other networks
+
+Returns the number of consoles found, or a negative X32Discover error
 */
 int Search(int port){
-	struct sockaddr_in test_ip;
-	struct sockaddr* test_ip_addr = (struct sockaddr *)&test_ip;
-	socklen_t test_ip_len = sizeof(test_ip); // length of addresses
-	int test_fd; // X32 socket
-	struct pollfd test_ufds;
-	//
-	int test_r_len, test_p_status; // length and status for receiving
+	struct x32_console consoles[16];
 
+	int found = X32Discover("192.168.0.0/24", port, consoles, 16, 4 * TIMEOUT);
+	for(int i = 0; i < found; i++){
+		printf("%s %s %s %s\n", consoles[i].ip, consoles[i].name, consoles[i].model, consoles[i].firmware);
+	}
+	return found;
+}
 
-	char r_buf[128]; // receive buffer for /info command test
-    char Info[8] = "/info"; // testing connection with /info request (X32, M32)
-    //char Info[8] = "/xinfo"; // testing connection with /xinfo request (XR series)
-    
-    // Create UDP socket
-    if ((test_fd = socket (PF_INET, SOCK_DGRAM, IPPROTO_UDP)) < 0) {
-        return -2; // An error occurred on socket creation
-    }
+/*
+Sends a message to the Console of the current session, through its outbox
+when one was started (see M32Outbox.c); the values written are stored in
+the cache when it mirrors this session (see M32Cache.c)
+    buffer should be a char* with the data to send
+    length should be the size of the buffer in bytes
 
-	// Server sockaddr_in structure
-	memset (&test_ip, 0, sizeof(test_ip)); // Clear structure
-	test_ip.sin_family = AF_INET; // Internet/IP
-	test_ip.sin_port = htons(port); // server port
-	//
-	// Prepare for poll() on receiving data
-	test_ufds.fd = test_fd;
-	test_ufds.events = POLLIN; //Check for normal data
-
-	char ip_addr_str[14];
-	strcpy(ip_addr_str, "192.168.0.");
-	for(int i = 0; i < 256; i++) {
-		ip_addr_str[10]= i/100 % 10 +48;
-		ip_addr_str[11] = i/10 % 10 +48 ;
-		ip_addr_str[12] = i%10 + 48;
-		ip_addr_str[13] = '\0';
-
-		//printf("%s ", ip_addr_str);
-
-		test_ip.sin_addr.s_addr = inet_addr(ip_addr_str); // IP address
-
-		//
-		// Validate connection by sending a /info command
-		if (sendto (test_fd, Info, 8, 0, test_ip_addr, test_ip_len) < 0) {
-			// printf("%s: Error Sending\n", ip_addr_str);
-			continue;
-		}
-		if ((test_p_status = poll (&test_ufds, 1, 50)) > 0) { // Console sent something?
-			test_r_len = recvfrom(test_fd, r_buf, 128, 0, 0, 0); // Get answer and
-			if ((strncmp(r_buf, Info, 5)) == 0) { // test data (5 bytes)
-				printf("%s ", ip_addr_str);
-				printBuffer(r_buf, test_r_len);
-				printf("\n");
+Returns -1 on error, otherwise the length of data sent or queued
+*/
+int X32Send(char *buffer, int length) {
+	int res;
+	if (X32Socket()->outbox != NULL) {
+		res = X32OutboxSend(buffer, length);
+	} else {
+		res = X32Transmit(buffer, length);
+	}
+	if (res >= 0) {
+		X32CacheSent(buffer, length);
+	}
+	return res;
+}
+
+int BATCH_MODE = BATCH_ON;
+
+static _Thread_local struct x32_batch *batch; // collecting X32Transmit, see X32BatchBegin
+
+/**
+ * Sends the datagrams collected in a batch with sendmmsg and empties it.
+ * A datagram the socket refuses is counted as a send error and skipped.
+ *
+ * Returns the number of datagrams sent, or -1 if any failed
+ */
+static int batchFlush(struct x32_batch *b) {
+	struct mmsghdr msgs[BATCH_MAX];
+	struct iovec iov[BATCH_MAX];
+	int sent = 0, failed = 0;
+
+	for (int i = 0; i < b->count; i++) {
+		iov[i].iov_base = b->slab + b->offsets[i];
+		iov[i].iov_len = b->lengths[i];
+		memset(&msgs[i].msg_hdr, 0, sizeof(struct msghdr));
+		msgs[i].msg_hdr.msg_name = &b->socket->address;
+		msgs[i].msg_hdr.msg_namelen = sizeof(b->socket->address);
+		msgs[i].msg_hdr.msg_iov = iov + i;
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+	for (int i = 0; i < b->count;) {
+		int ret = sendmmsg(b->socket->fd, msgs + i, b->count - i, 0);
+		if (ret <= 0) {
+			if (ret < 0 && errno == EINTR) {
 				continue;
 			}
-		} else if (test_p_status < 0) {
-			// printf("%s: Error Polling\n", ip_addr_str);
+			metricCount(METRIC_SEND_ERRORS, 1);
+			failed++;
+			i++; // the first datagram was refused
 			continue;
 		}
-		// Not connected on timeout
-		// printf("%s: Timeout\n", ip_addr_str);
+		int bytes = 0;
+		for (int k = i; k < i + ret; k++) {
+			X32_TRACE(TRACE_SEND, b->slab + b->offsets[k], b->lengths[k], -1);
+			bytes += msgs[k].msg_len;
+		}
+		metricCount(METRIC_SENDS, ret);
+		metricCount(METRIC_SEND_BYTES, bytes);
+		sent += ret;
+		i += ret;
 	}
-	return 0;
+	b->count = b->used = 0;
+	b->failed |= failed > 0;
+	return failed > 0 ? -1 : sent;
 }
 
 /*
-Sends a message to the connected Console
-    buffer should be a char* with the data to send
-    length should be the size of the buffer in bytes
+Sends a message to the Console of the current session right away, or adds
+it to the batch of this thread (see X32BatchBegin)
 
-Returns -1 on error, otherwise the length of data sent
+Returns -1 on error, otherwise the length of data sent or batched
 */
-int X32Send(char *buffer, int length) {
-	
-	int ret = (sendto (Xfd, buffer, length, 0, Xip_addr, Xip_len));
-	printf("SEND %d: ", ret);
-	printBuffer(buffer, length);
+int X32Transmit(char *buffer, int length) {
+	struct x32_socket *x = X32Socket();
+	struct x32_batch *b = batch;
+	if (b != NULL && b->socket == x && length <= BATCH_BYTES) {
+		if (b->count == BATCH_MAX || b->used + length > BATCH_BYTES) {
+			batchFlush(b);
+		}
+		memcpy(b->slab + b->used, buffer, length);
+		b->offsets[b->count] = b->used;
+		b->lengths[b->count++] = length;
+		b->used += length;
+		return length;
+	}
+	int ret = (sendto (x->fd, buffer, length, 0, (struct sockaddr *)&x->address, sizeof(x->address)));
+	if (ret >= 0) {
+		X32_TRACE(TRACE_SEND, buffer, length, -1);
+		metricCount(METRIC_SENDS, 1);
+		metricCount(METRIC_SEND_BYTES, ret);
+	} else {
+		metricCount(METRIC_SEND_ERRORS, 1);
+	}
 	return ret;
 } 
 
+/**
+ * Starts collecting the datagrams X32Transmit sends on the socket of the
+ * current session from this thread; they go out BATCH_MAX per sendmmsg
+ * call, the rest with X32BatchEnd. Nested batches join the outer one.
+ * Does nothing with BATCH_MODE off.
+ * batch: kept by the caller until X32BatchEnd
+ */
+void X32BatchBegin(struct x32_batch *b) {
+	b->socket = X32Socket();
+	b->count = b->used = 0;
+	b->failed = false;
+	if (batch == NULL && BATCH_MODE == BATCH_ON) {
+		batch = b;
+	}
+}
+
+/**
+ * Sends what is left of a batch started with X32BatchBegin, unless it is
+ * nested in another one.
+
+Returns
+    -1 if any datagram of the batch could not be sent
+    0 otherwise
+*/
+int X32BatchEnd(struct x32_batch *b) {
+	if (batch != b) {
+		return 0;
+	}
+	int ret = batchFlush(b);
+	batch = NULL;
+	return b->failed || ret < 0 ? -1 : 0;
+}
+
 /*
-Receives data from the Connected server
-    buffer should be a char* of at least 512 bytes to read data into
+Receives the datagrams waiting on the socket of the current session into
+packets of the pool, with as few system calls as possible: one recvmmsg per
+BATCH_MAX with BATCH_MODE on.
+    packets receives up to max packets, one reference each for the caller
+    timeout is the time in ms to wait for the first one, as for X32Recv
+
+Returns
+    -1 on polling error
+    0 on timeout
+    otherwise the number of packets received
+*/
+int X32RecvMany(struct x32_packet **packets, int max, int timeout) {
+	struct x32_socket *x = X32Socket();
+	struct mmsghdr msgs[BATCH_MAX];
+	struct iovec iov[BATCH_MAX];
+	int count = 0;
+
+	if (timeout != 0) {
+		struct pollfd ufds = {x->fd, POLLIN, 0};
+		int p_status = poll (&ufds, 1, timeout);
+		if (p_status <= 0) {
+			if (p_status < 0) {
+				metricCount(METRIC_RECV_ERRORS, 1);
+			}
+			return p_status;
+		}
+	}
+	while (count < max) {
+		int n = BATCH_MODE != BATCH_ON ? 1 : max - count < BATCH_MAX ? max - count : BATCH_MAX;
+		for (int i = 0; i < n; i++) {
+			if ((packets[count + i] = X32PacketAlloc()) == NULL) {
+				n = i;
+				break;
+			}
+			iov[i].iov_base = packets[count + i]->data;
+			iov[i].iov_len = PACKET_SIZE;
+			memset(&msgs[i].msg_hdr, 0, sizeof(struct msghdr));
+			msgs[i].msg_hdr.msg_iov = iov + i;
+			msgs[i].msg_hdr.msg_iovlen = 1;
+		}
+		int ret = n == 0 ? 0 : BATCH_MODE == BATCH_ON ? recvmmsg(x->fd, msgs, n, MSG_DONTWAIT, NULL)
+				: recvfrom(x->fd, packets[count]->data, PACKET_SIZE, MSG_DONTWAIT, 0, 0);
+		if (ret > 0 && BATCH_MODE != BATCH_ON) {
+			msgs[0].msg_len = ret;
+			ret = 1;
+		}
+		int got = ret > 0 ? ret : 0;
+		for (int i = got; i < n; i++) {
+			X32PacketRelease(packets[count + i]);
+		}
+		if (ret < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				break;
+			}
+			metricCount(METRIC_RECV_ERRORS, 1);
+			return count > 0 ? count : -1;
+		}
+		int bytes = 0;
+		for (int i = 0; i < got; i++) {
+			packets[count + i]->length = msgs[i].msg_len;
+			bytes += msgs[i].msg_len;
+		}
+		metricCount(METRIC_RECEIVES, got);
+		metricCount(METRIC_RECV_BYTES, bytes);
+		count += got;
+		if (got < n || n == 0) {
+			break;
+		}
+	}
+	return count;
+}
+
+/*
+Receives data from the Console of the current session
+    buffer should be a char* of at least BSIZE (512) bytes to read data into
     timeout is the time in ms to wait before failing
-        0 always returns no data
+        0 only reads data already received, without polling
         negative means infinite
+    A datagram longer than BSIZE, eg. /node text or a meter blob, is not
+    returned truncated: it is counted as a receive error and lost; use
+    X32RecvMany for those
 
 Returns
-    -1 on polling error
+    -1 on polling error or for a datagram longer than BSIZE
     0 on timeout
     otherwise the amount of data read
 */
 int X32Recv(char *buffer, int timeout) {
+	struct x32_socket *x = X32Socket();
+	struct pollfd ufds = {x->fd, POLLIN, 0};
+	int p_status;
+
+	if (timeout == 0) {
+		// MSG_TRUNC: the length of the whole datagram is returned
+		int ret = recvfrom(x->fd, buffer, BSIZE, MSG_DONTWAIT | MSG_TRUNC, 0, 0);
+		if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			return 0;
+		}
+		if (ret < 0 || ret > BSIZE) {
+			metricCount(METRIC_RECV_ERRORS, 1);
+			return -1;
+		}
+		metricCount(METRIC_RECEIVES, 1);
+		metricCount(METRIC_RECV_BYTES, ret);
+		return ret;
+	}
 	if ((p_status = poll (&ufds, 1, timeout)) > 0) { // Data in?
-		int ret = recvfrom(Xfd, buffer, BSIZE, 0, 0, 0);// return length
-
-		printf("RECV %d: ", ret);
-		printBuffer(buffer, ret);
-
+		int ret = recvfrom(x->fd, buffer, BSIZE, MSG_TRUNC, 0, 0);// return length
+		if (ret < 0 || ret > BSIZE) {
+			metricCount(METRIC_RECV_ERRORS, 1);
+			return -1;
+		}
+		metricCount(METRIC_RECEIVES, 1);
+		metricCount(METRIC_RECV_BYTES, ret);
 		return ret;
 	} else if (p_status < 0) {
+		metricCount(METRIC_RECV_ERRORS, 1);
 		return -1; //An error occurred on polling
 	}
 	return 0; // No error, timeout
 }
 
 ////
-// Test purpose only - comment when linking the package to an application
+// Test purpose only - build with -DM32_NO_MAIN when linking the package to an application
 //
+#ifndef M32_NO_MAIN
 int main() {
 
 	//Search(10023);
@@ -894,7 +1007,6 @@ int main() {
 	char r_buf[512];
 	char s_buf[] = {"/status\0"};
 	int r_len = 0;
-	int s_len = 0;
 	int status;
 
 	char c_buf[] = "/ch/01/config/name\0";
@@ -904,17 +1016,15 @@ int main() {
 	printf ("Connection status: %d\n", status);
 
 	if (status) {
-		s_len = X32Send(s_buf, 8);
-		if (s_len) {
-			r_len = X32Recv(r_buf, TIMEOUT);
-		}
+		r_len = X32Request(s_buf, r_buf, TIMEOUT);
 
-		struct channel *channel = getChannelInfo(1);
-		FILE * file= fopen(channel->config.scribble.name, "wb");
-		if (file != NULL) {
-			fwrite(channel, sizeof(struct channel), 1, file);
-			fclose(file);
+		// capture the whole console as a one scene show file
+		struct x32_value *scene = oscIndexInit() < 0 ? NULL : malloc(oscIndexCount() * sizeof(struct x32_value));
+		if (scene != NULL && X32ShowFetch(scene, 0) >= 0) {
+			const char *name = "Current";
+			X32ShowWrite("console.show", &name, (const struct x32_value *const *)&scene, 1);
 		}
+		free(scene);
 		
 		// printf("\n");
 		// s_len = X32Send(c_buf, 20);
@@ -934,9 +1044,8 @@ int main() {
 		// 	printBuffer(r_buf,r_len);
 		// }
 
-		s_len = generateAndSendMessage(c_buf);
-		if (s_len) {
-			r_len = X32Recv(r_buf, TIMEOUT);
+		r_len = X32Request(c_buf, r_buf, TIMEOUT);
+		if (r_len > 0) {
 			printBuffer(r_buf,r_len);
 		}
 
@@ -948,4 +1057,5 @@ int main() {
 
 	printf("\n");
 	return 0;
-} 
\ No newline at end of file
+}
+#endif